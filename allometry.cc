@@ -8,6 +8,75 @@
 /* 10th Dec 98 structural calc from jgs agb allometry */
 /* 14th Dec 98 constrined to maximum h *equal to repro hgt */
 
+////////////////////////////////////////////////////////////////////////////////
+//! init_allometry
+//! Resolve which set of allometric equations each PFT uses and precompute
+//! the dbh-independent parts of the Saldarriaga leaf and stem allometries,
+//! so the per-cohort functions below only switch on an integer.
+//! Must be called after the PFT parameters are read.
+//!
+//! @param  data Userdata structure
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void init_allometry (UserData *data) {
+   double a1,c1,d1;
+   double a2,b2,c2,d2;
+   double dcrit,p,q,r;
+   double f,g;
+
+   for (size_t spp=0; spp<NSPECIES; spp++) {
+      if ((!strcmp(data->title[spp],"evergreen")) and data->allometry_type == 0) { /* spruce allometry */
+         data->allom_family[spp] = ALLOM_SPRUCE;
+      } else if(data->is_tropical[spp] or data->is_grass[spp] or 
+                (!strcmp(data->title[spp],"cold_decid") and 
+                 data->allometry_type == 0)) { /* all other species allometry */
+         data->allom_family[spp] = ALLOM_SALDARRIAGA;
+      } else { /* Albani et al. GCB 2006 */
+         data->allom_family[spp] = ALLOM_ALBANI;
+      }
+
+      /* leaf, dbh below max_dbh */
+      a1 = -1.981;
+      c1 = -0.584;
+      d1 = 0.55;
+      dcrit = 100.0;
+    
+      a2 = -4.111;
+      b2 = 0.605;
+      c2 = 0.848;
+      d2 = 0.438;
+      f  = 0.64;
+      g  = 0.37;
+    
+      p  = a1 + c1 * g * log(10.0) + d1 * log(data->rho[spp]);
+      r  = ( (a2 - a1) + g * log(10.0) * (c2 - c1) + 
+             log(data->rho[spp]) * (d2 - d1) ) * ( 1 / log(dcrit) );
+      q = 2.0 * b2 + c2 * f + r;  
+      data->allom_leaf_ep[spp] = exp(p);
+      data->allom_leaf_q[spp]  = q;
+
+      /* stem, dbh below max_dbh */
+      a1 = -1.981;
+      c1 = 0.572;
+      d1 = 0.931;
+      dcrit = 100.0;
+      a2 = -1.086;
+      b2 = 0.876;
+      c2 = 0.604;
+      d2 = 0.871;
+
+      f  = 0.64;
+      g  = 0.37;
+
+      p  = a1 + c1 * g * log(10.0) + d1 * log(data->rho[spp]);
+      r  = ( (a2 - a1) + g * log(10.0) * (c2 - c1) + 
+             log(data->rho[spp]) * (d2 - d1) ) * ( 1 / log(dcrit) );
+      q = 2.0 * b2 + c2 * f + r;     
+      data->allom_stem_ep[spp] = exp(p);
+      data->allom_stem_q[spp]  = q;
+   }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //! Dbh
 //! height(m) diameter(cm) relationships
@@ -21,17 +90,16 @@ double cohort::Dbh (UserData *data) {
    double m= 0.64;
    double c= 0.37;
 
-
-   if ( (!strcmp(data->title[species],"evergreen"))  and data->allometry_type == 0) { /* spruce allometry */    
+   switch (data->allom_family[species]) {
+   case ALLOM_SPRUCE:
       dbh = exp( ( log(hite) - 0.04 ) / 0.94 );
-   }
-   else if(data->is_tropical[species] or data->is_grass[species] or 
-           (!strcmp(data->title[species],"cold_decid") and 
-           data->allometry_type == 0)) { /* all other species allometry */
+      break;
+   case ALLOM_SALDARRIAGA:
       dbh = pow( 10.0, ( ( log10(hite) - c ) / m ) );
-   }
-   else {
-          dbh = log( 1- (hite - data->ref_hgt[species])/data->b1Ht[species])/data->b2Ht[species];         
+      break;
+   default:
+      dbh = log( 1- (hite - data->ref_hgt[species])/data->b1Ht[species])/data->b2Ht[species];         
+      break;
    }
 
    return(dbh); 
@@ -49,23 +117,24 @@ double cohort::Hite (UserData *data ) {
    double m= 0.64;
    double c= 0.37;
 
-   if ((!strcmp(data->title[species],"evergreen")) and data->allometry_type == 0) { /* spruce allometry */
+   switch (data->allom_family[species]) {
+   case ALLOM_SPRUCE:
       if (dbh <= data->max_dbh[species] )
          /* canadian forest service report */
          h = exp( 0.94 * log(dbh) + 0.04); 
       else
          h = exp( 0.94 * log(data->max_dbh[species]) + 0.04 );
-   } else if(data->is_tropical[species] or data->is_grass[species] or 
-           (!strcmp(data->title[species],"cold_decid") 
-           and data->allometry_type == 0)) { /* all other species allometry */
+      break;
+   case ALLOM_SALDARRIAGA:
       if (dbh <= data->max_dbh[species]) 
          h = pow( 10.0, (log10(dbh) * m + c) );
       else 
          h = pow( 10.0, (log10(data->max_dbh[species]) * m + c) );
-   }
-   else {
-         dbh   = (dbh < data->max_dbh[species])? dbh : data->max_dbh[species];
-         h = data->ref_hgt[species] + data->b1Ht[species] * (1 - exp( data->b2Ht[species] * dbh));
+      break;
+   default:
+      dbh   = (dbh < data->max_dbh[species])? dbh : data->max_dbh[species];
+      h = data->ref_hgt[species] + data->b1Ht[species] * (1 - exp( data->b2Ht[species] * dbh));
+      break;
    }
 
    return h; 
@@ -83,51 +152,32 @@ double cohort::Hite (UserData *data ) {
 double cohort::Bleaf (UserData *data ) { 
 
    double bleaf;
-   double a1,c1,d1;
-   double a2,b2,c2,d2;
-   double f,g,dcrit,p,q,r;
    int spp;
  
    spp = species;
 
-   if ((!strcmp(data->title[spp],"evergreen")) and data->allometry_type == 0) { /*spruce allometry*/
+   switch (data->allom_family[spp]) {
+   case ALLOM_SPRUCE:
       if (dbh <= data->max_dbh[spp] )
          bleaf = (1.0 / data->c2b) * (1.0 / 2.2) * 
             exp(-0.7980554 + 2.138061 * log(dbh / 2.54 )) + 0.005;
       else 
          bleaf = (1.0 / data->c2b) * (1.0 / 2.2) * 
             exp(-0.7980554 + 2.138061 * log(data->max_dbh[spp] / 2.54)) + 0.005;
-    
-   } else if(data->is_tropical[species] or data->is_grass[species] or 
-           (!strcmp(data->title[spp],"cold_decid") and 
-           data->allometry_type == 0)){ /* all other species allometry */
-      a1 = -1.981;
-      c1 = -0.584;
-      d1 = 0.55;
-      dcrit = 100.0;
-    
-      a2 = -4.111;
-      b2 = 0.605;
-      c2 = 0.848;
-      d2 = 0.438;
-      f  = 0.64;
-      g  = 0.37;
-    
-      p  = a1 + c1 * g * log(10.0) + d1 * log(data->rho[spp]);
-      r  = ( (a2 - a1) + g * log(10.0) * (c2 - c1) + 
-             log(data->rho[spp]) * (d2 - d1) ) * ( 1 / log(dcrit) );
-      q = 2.0 * b2 + c2 * f + r;  
-    
+      break;
+   case ALLOM_SALDARRIAGA:
+      /* exp(p) and q from init_allometry */
       if(dbh <= data->max_dbh[spp])
          bleaf = (1.0 / data->c2b) * 
-            ( exp(p) * pow(dbh, q) + data->bl_min[spp] );
+            ( data->allom_leaf_ep[spp] * pow(dbh, data->allom_leaf_q[spp]) + data->bl_min[spp] );
       else 
          bleaf = (1.0 / data->c2b) * 
-            ( exp(p) * pow(data->max_dbh[spp], q) + data->bl_min[spp] );
-      }
-   else {
+            ( data->allom_leaf_ep[spp] * pow(data->max_dbh[spp], data->allom_leaf_q[spp]) + data->bl_min[spp] );
+      break;
+   default:
       dbh   = (dbh < data->max_dbh[species])? dbh : data->max_dbh[species];
       bleaf = (1.0/data->c2b)*data->b1Bl[species] * pow(dbh,data->b2Bl[species]);
+      break;
    }
 
    return bleaf;
@@ -146,46 +196,41 @@ double cohort::Bdead (UserData *data ) {
    double a2,b2,c2,d2;
    double bdead;
    double dcrit,p,q,r;
-   double f,g;
    int spp;
 
    spp = species;
    
-   if ((!strcmp(data->title[spp],"evergreen")) and data->allometry_type == 0) { /* spruce allometry */
+   switch (data->allom_family[spp]) {
+   case ALLOM_SPRUCE:
       bdead = ( 1.0 / 2.2 ) * ( 1.0 / data->c2b ) * 
          exp( 1.10651 + 2.298388 * log( dbh / 2.54 ) ); 
-   } else if(data->is_tropical[species] or data->is_grass[species] or 
-           (!strcmp(data->title[spp],"cold_decid") and 
-           data->allometry_type == 0)){ /* all other species allometr */
-      a1 = -1.981;
-      c1 = 0.572;
-      d1 = 0.931;
-      dcrit = 100.0;
-      a2 = -1.086;
-      b2 = 0.876;
-      c2 = 0.604;
-      d2 = 0.871;
-
-      f  = 0.64;
-      g  = 0.37;
-    
+      break;
+   case ALLOM_SALDARRIAGA:
       if ( dbh > data->max_dbh[spp] ) {  
+         a1 = -1.981;
+         c1 = 0.572;
+         d1 = 0.931;
+         dcrit = 100.0;
+         a2 = -1.086;
+         b2 = 0.876;
+         c2 = 0.604;
+         d2 = 0.871;
+
          p = a1 + c1 * log(hite) + d1 * log(data->rho[spp]);
          r = ( (a2 - a1) + (c2 - c1) * log(hite) + 
                log(data->rho[spp]) * (d2 - d1) ) * ( 1 / log(dcrit) );
          q = 2.0 * b2 + r;
+         bdead = ( 1.0 / data->c2b ) * ( exp(p) * pow(dbh,q) ) + data->bs_min[spp];
       } else {
-         p  = a1 + c1 * g * log(10.0) + d1 * log(data->rho[spp]);
-         r  = ( (a2 - a1) + g * log(10.0) * (c2 - c1) + 
-                log(data->rho[spp]) * (d2 - d1) ) * ( 1 / log(dcrit) );
-         q = 2.0 * b2 + c2 * f + r;     
+         /* exp(p) and q from init_allometry */
+         bdead = ( 1.0 / data->c2b ) * ( data->allom_stem_ep[spp] * pow(dbh,data->allom_stem_q[spp]) ) 
+            + data->bs_min[spp];
       }
-         
-      bdead = ( 1.0 / data->c2b ) * ( exp(p) * pow(dbh,q) ) + data->bs_min[spp];
-   }
-   else {
+      break;
+   default:
       dbh   = (dbh < data->max_dbh[species])? dbh : data->max_dbh[species];
       bdead =  (1.0/data->c2b)*data->b1Bs[species] * pow(dbh,data->b2Bs[species]);
+      break;
    }
 
    return bdead;
@@ -200,47 +245,31 @@ double cohort::Bdead (UserData *data ) {
 //! @return 
 ////////////////////////////////////////////////////////////////////////////////
 double cohort::dHdBd (UserData *data ) {
-   double a1,c1,d1;
-   double a2,b2,c2,d2;
    double dhdbs;
-   double dcrit,q,r;
-   double f,g;
+   double f;
    int spp;
    double dhddbh;
    double ddbhdbs;
 
    spp = species;
    
-   if ((!strcmp(data->title[spp],"evergreen")) and data->allometry_type == 0) { /* spruce allometry */
+   switch (data->allom_family[spp]) {
+   case ALLOM_SPRUCE:
       dhdbs = exp( 0.40898 * log(bdead *2.2 * data->c2b) + 0.4639) * 
          0.40898 / bdead;
-   }
-   else if(data->is_tropical[species] or data->is_grass[species] or 
-           (!strcmp(data->title[spp],"cold_decid") and 
-           data->allometry_type == 0)) { /* all other species allometry */
-    
-      a1 = -1.981;
-      c1 = 0.572;
-      d1 = 0.931;
-      dcrit = 100.0;
-      a2 = -1.086;
-      b2 = 0.876;
-      c2 = 0.604;
-      d2 = 0.871;
+      break;
+   case ALLOM_SALDARRIAGA:
       f  = 0.64;
-      g  = 0.37;
   
       if ( dbh > data->max_dbh[spp] ) {  
          dhdbs = 0.0;
       }
       else {
-         r  = ( (a2 - a1) + g * log(10.0) * (c2 - c1) + log(data->rho[spp]) 
-                * (d2 - d1) ) * ( 1 / log(dcrit) );
-         q = 2.0 * b2 + c2 * f + r;
-         dhdbs = ( hite / (bdead) ) * ( 1.0 / q ) * f * 
+         dhdbs = ( hite / (bdead) ) * ( 1.0 / data->allom_stem_q[spp] ) * f * 
             log(10.0) * log10( exp(1.0) ); 
       }
-   } else {
+      break;
+   default:
        if(fabs((data->b1Ht[species]+data->ref_hgt[species]) - hite) > 0.01){
           dhddbh = -data->b1Ht[species] * data->b2Ht[species] * exp(data->b2Ht[species] * 
                   pow((bdead*data->c2b/data->b1Bs[species]),1.0/data->b2Bs[species]));
@@ -251,6 +280,7 @@ double cohort::dHdBd (UserData *data ) {
        }else{
           dhdbs = 0.0;                /* return 0 when height is within 1 cm of asymptote */
        }
+       break;
    }
 
    return dhdbs;
@@ -268,47 +298,40 @@ double cohort::dDbhdBd (UserData *data ) {
 
    double a1,c1,d1;
    double a2,b2,c2,d2;
-   double f,g;
    double dcrit,q,r;
    int spp;
 
    spp = species;
    
-   if ((!strcmp(data->title[spp],"evergreen")) and data->allometry_type == 0) { /* spruce allometry */
+   switch (data->allom_family[spp]) {
+   case ALLOM_SPRUCE:
       ddbhdbs = 2.54 * exp( (log(bdead * 2.2 * data->c2b) - 1.10651 ) / 
                             2.298388 ) / (2.298388 * bdead);
-   }
-   else if(data->is_tropical[species] or data->is_grass[species] or 
-           (!strcmp(data->title[spp],"cold_decid") and 
-           data->allometry_type == 0)) { /* all other species allometry */
-
-      a1 = -1.981;
-      c1 = 0.572;
-      d1 = 0.931;
-      dcrit = 100.0;
-      a2 = -1.086;
-      b2 = 0.876;
-      c2 = 0.604;
-      d2 = 0.871;
-
-      f  = 0.64;
-      g  = 0.37;
-
+      break;
+   case ALLOM_SALDARRIAGA:
       if (dbh > data->max_dbh[spp]) {  
+         a1 = -1.981;
+         c1 = 0.572;
+         d1 = 0.931;
+         dcrit = 100.0;
+         a2 = -1.086;
+         b2 = 0.876;
+         c2 = 0.604;
+         d2 = 0.871;
+
          r  = ( (a2 - a1) + (c2 - c1) * log(hite) 
                 + log(data->rho[spp]) * (d2 - d1) ) * ( 1 / log(dcrit) );
          q = 2.0 * b2 + r;
       }
       else {
-         r  = ( (a2 - a1) + g * log(10.0) * (c2 - c1) + 
-                log(data->rho[spp]) * (d2 - d1) ) * ( 1 / log(dcrit) );
-         q = 2.0 * b2 + c2 * f + r;      
+         q = data->allom_stem_q[spp];
       }
   
       ddbhdbs = ( dbh / (bdead) ) * ( 1.0 / q );        
-   }
-   else {
+      break;
+   default:
         ddbhdbs = pow(data->c2b/data->b1Bs[species],(1.0/data->b2Bs[species]))*pow(bdead, (1.0/data->b2Bs[species] - 1))*(1/data->b2Bs[species]);       
+        break;
    }
    
    return ddbhdbs;
@@ -323,42 +346,20 @@ double cohort::dDbhdBd (UserData *data ) {
 ////////////////////////////////////////////////////////////////////////////////
 double cohort::dDbhdBl ( UserData *data ) {
    double ddbhdbl;
-   double a1,c1,d1;
-   double a2,b2,c2,d2;
-   double dcrit,q,r;
-   double f,g;
    int spp;
 
    spp = species;
  
-   if ((!strcmp(data->title[spp],"evergreen")) and data->allometry_type == 0) { /* spruce allometry */
+   switch (data->allom_family[spp]) {
+   case ALLOM_SPRUCE:
       ddbhdbl = 3.3763239 * pow(bl, -0.5322767);
-   }
-   else if(data->is_tropical[species] or data->is_grass[species] or 
-           (!strcmp(data->title[spp],"cold_decid") and 
-           data->allometry_type == 0)) { /* all other species allometry */
-    
-      a1 = -1.981;
-      c1 = -0.584;
-      d1 = 0.55;
-      dcrit = 100.0;
-    
-      a2 = -4.111;
-      b2 = 0.605;
-      c2 = 0.848;
-      d2 = 0.438;
-    
-      f  = 0.64;
-      g  = 0.37;
-      r  = ( (a2 - a1) + g * log(10.0) * (c2 - c1) + 
-             log(data->rho[spp]) * (d2 - d1) ) * ( 1 / log(dcrit) );
-      q = 2 * b2 + c2 * f + r;
-    
-      ddbhdbl = ( dbh / (bl) ) * ( 1.0 / (q) );
-      
-   }
-   else {
+      break;
+   case ALLOM_SALDARRIAGA:
+      ddbhdbl = ( dbh / (bl) ) * ( 1.0 / (data->allom_leaf_q[spp]) );
+      break;
+   default:
        ddbhdbl = pow(data->c2b/data->b1Bl[species],1.0/data->b2Bl[species])*pow(bl, 1.0/data->b2Bl[species] - 1)*(1/data->b2Bl[species]);
+       break;
    }
 
    return ddbhdbl;
@@ -8,17 +8,43 @@
 #include "disturbance.h"
 #include "phenology.h"
 
+#include "ed_log.h"
 #include "cohort.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 //! get_cohort_vm0
-//! Downregulate Vm0 based on (1) light profile, and (2) day length
+//! Downregulate Vm0 based on (1) light profile, and (2) day length.
+//! Walks the cohorts above this one; inside the integrator canopy_vm0
+//! does the whole patch in one pass instead.
 //!
 //! @param  data Userdata structure
 //! @return Nothing, updates cohort Vm0 (carboxylation rate internally)
 ////////////////////////////////////////////////////////////////////////////////
 void cohort::get_cohort_vm0(UserData *data) {
    double cum_lai = 0.0;
+
+   if(data->num_Vm0 > 1 and data->do_downreg) {    
+      // Half of the current cohort's LAI contributes to shading as well, this is
+      // based on assumption that the chloroplasts on the leaves are placed mid-way
+      cohort *cc = this; 
+      cum_lai += lai/2.0;
+      while (cc->taller != NULL) {
+         cum_lai += cc->taller->lai;
+         cc = cc->taller;
+      }
+   }
+   downregulate_vm0(cum_lai, data);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! downregulate_vm0
+//! Set Vm0 from the PFT maximum, the LAI shading the cohort and day length
+//!
+//! @param  cum_lai LAI above the middle of the cohort's crown
+//! @param  data Userdata structure
+//! @return Nothing, updates cohort Vm0
+////////////////////////////////////////////////////////////////////////////////
+void cohort::downregulate_vm0(double cum_lai, UserData *data) {
    double Kn      = 0.0;
    
    Vm0 = data->Vm0_max[species];
@@ -28,20 +54,11 @@ void cohort::get_cohort_vm0(UserData *data) {
       // For expression relating Kn to Vm0, see Lloyd et al. 2010 (Figure 10)
       // http://www.biogeosciences.net/7/1833/2010/bg-7-1833-2010.pdf
       // Essentially, higher the Vm0 value, greater the extinction coefficient
-      cohort *cc = this; 
       Kn = exp(0.00963*Vm0 - 2.43);
       if(Kn>0.0) {
          Kn *= -1.0;
       }
 
-      // Half of the current cohort's LAI contributes to shading as well, this is
-      // based on assumption that the chloroplasts on the leaves are placed mid-way
-      cum_lai += lai/2.0;
-      while (cc->taller != NULL) {
-         cum_lai += cc->taller->lai;
-         cc = cc->taller;
-      }
-
       // Scale Vm0 of cohort based on cumulative LAI of cohorts above it
       Vm0 *= exp(Kn*cum_lai);
 
@@ -94,7 +111,7 @@ int cohort::get_cohort_vm0_bin(double Vm0, UserData* data) {
 //! @return 
 ////////////////////////////////////////////////////////////////////////////////
 void cohort_dynamics(unsigned int t, double t1, double t2, 
-                     patch** patchptr, FILE* outfile, UserData* data) {
+                     patch** patchptr, UserData* data) {
 
    patch* currentp = *patchptr;
    site* currents = currentp->siteptr;
@@ -142,7 +159,7 @@ void cohort_dynamics(unsigned int t, double t1, double t2,
    currentp = *patchptr;
    while (currentp != NULL) {    
       if(data->cd_file) {
-         fprintf(outfile, "cd: integrating site %s %p patch %p \n",
+         log_printf(data->cd_log, currents->sdata->name_, "cd: integrating site %s %p patch %p \n",
                  currents->sdata->name_, currentp->siteptr, currentp); 
       }
 
@@ -155,13 +172,13 @@ void cohort_dynamics(unsigned int t, double t1, double t2,
          }
          if(data->cd_file) {
             if (currentp->okint != 0) 
-               fprintf(outfile, "cd: exited from sode patch= %p ok=%d\n", currentp, currentp->okint);
-            fprintf(outfile, "cd: exited from sode patch= %p ok=%d\n", currentp, currentp->okint);
+               log_printf(data->cd_log, currents->sdata->name_, "cd: exited from sode patch= %p ok=%d\n", currentp, currentp->okint);
+            log_printf(data->cd_log, currents->sdata->name_, "cd: exited from sode patch= %p ok=%d\n", currentp, currentp->okint);
          }
       } else {
          currentp->okint = -99;
          if(data->cd_file)
-            fprintf(outfile, "cd: skipped integrating empty patch= %p ok=%d\n", currentp, currentp->okint); 
+            log_printf(data->cd_log, currents->sdata->name_, "cd: skipped integrating empty patch= %p ok=%d\n", currentp, currentp->okint); 
       }     
       currentp = currentp->older;
    } /* end loop over patches */    
@@ -180,14 +197,14 @@ void cohort_dynamics(unsigned int t, double t1, double t2,
       
             if(data->cd_file)
                if((currentp->tallest == NULL)&&(currentp->shortest == NULL)) 
-                  fprintf(outfile,"**** warning: no cohorts left in patch %p age %f area %f !\n",currentp,currentp->age,currentp->area); 
+                  log_printf(data->cd_log, currents->sdata->name_, "**** warning: no cohorts left in patch %p age %f area %f !\n",currentp,currentp->age,currentp->area); 
             currentp = currentp->older;
          }
       }
     
       /* sort remaining cohorts */      
       if(data->cd_file)
-         fprintf(outfile,"sort...  \n");
+         log_printf(data->cd_log, currents->sdata->name_, "sort...  \n");
 
       currentp=*patchptr;
       while (currentp != NULL){
@@ -202,7 +219,7 @@ void cohort_dynamics(unsigned int t, double t1, double t2,
    /****************/
    if((t)%(COHORT_FREQ) == 0){ 
    if(data->cd_file)
-      fprintf(outfile,"repro...  \n");
+      log_printf(data->cd_log, currents->sdata->name_, "repro...  \n");
     
       currentp=*patchptr;
       reproduction(t,&currentp,data);
@@ -212,7 +229,7 @@ void cohort_dynamics(unsigned int t, double t1, double t2,
    if((t)%(COHORT_FREQ) == 0){ 
       /* spawn new cohorts */
    if(data->cd_file)
-      fprintf(outfile,"spawn...\n");
+      log_printf(data->cd_log, currents->sdata->name_, "spawn...\n");
 
       currentp = *patchptr;
       while (currentp != NULL){
@@ -223,7 +240,7 @@ void cohort_dynamics(unsigned int t, double t1, double t2,
       if(data->cohort_fusion) {
          /*fuse cohorts*/
          if(data->cd_file)
-            fprintf(outfile,"fusing cohorts... \n");
+            log_printf(data->cd_log, currents->sdata->name_, "fusing cohorts... \n");
 
          currentp=*patchptr;
          fuse_cohorts(&currentp, data);    
@@ -232,7 +249,7 @@ void cohort_dynamics(unsigned int t, double t1, double t2,
       if(data->cohort_fission) {
          /*split cohorts*/
          if(data->cd_file)
-            fprintf(outfile,"splitting cohorts... \n");   
+            log_printf(data->cd_log, currents->sdata->name_, "splitting cohorts... \n");   
 
          currentp=*patchptr;
          split_cohorts(&currentp,data);
@@ -284,11 +301,8 @@ void init_cohorts(patch** patchptr, UserData* data){
 #endif
 
       /* creat a dummy cohort to figure out size of biomass compartments */  
-      cohort* dc = (cohort*) malloc(sizeof(cohort));
-      if (dc == NULL) {
-         printf("out of memory\n");
-         while(getchar() != '\n');
-      }
+      cohort dummy;
+      cohort* dc = &dummy;
 
       dc->species = spp; 
       dc->nindivs = nindivs;
@@ -303,9 +317,8 @@ void init_cohorts(patch** patchptr, UserData* data){
       dc->balive= dc->Bleaf(data)*(1.0 + data->q[spp] + data->qsw[dc->species]*dc->hite);
       dc->b = dc->balive + dc->bdead;
 
-      /* create appropritaely sized cohort then free dummy cohort */
+      /* create appropritaely sized cohort */
       create_cohort(dc->species,dc->nindivs,dc->hite,dc->dbh,dc->balive,dc->bdead,patchptr,data);  
-      free(dc);
    }  /* end loop over species */
 }
 
@@ -322,12 +335,9 @@ void create_cohort (unsigned int spp, double nindivs, double hite, double dbh,
    /* this function is called in model initialization from init_cohorts and *
     * read cohort distribution and during the model run from spawn_cohorts  */
   
-   cohort* newcohort = (cohort*) malloc(sizeof(cohort));
-   if (newcohort == NULL) {
-      printf("out of memory\n");
-      while( getchar() != '\n');
-   }
+   cohort* newcohort = (cohort*) pool_alloc(&(*patchptr)->siteptr->cohort_pool);
    /* assign cohort attributes */
+   newcohort->id       = (*patchptr)->siteptr->next_cohort_id++;
    newcohort->siteptr  = (*patchptr)->siteptr;
    newcohort->patchptr = *patchptr;
    newcohort->species  = spp;
@@ -463,7 +473,7 @@ void terminate_cohorts(cohort** ptallest, cohort** pshortest, UserData* data){
          else (currentc->taller)->shorter = currentc->shorter;
          if (currentc->shorter == NULL) *pshortest = currentc->taller;
          else (currentc->shorter)->taller = currentc->taller;
-         free (currentc);        
+         pool_free(&currentc->siteptr->cohort_pool, currentc);
       }
       currentc = nextc;
    } 
@@ -482,11 +492,8 @@ void spawn_cohorts(unsigned int t, patch** patchptr, UserData* data){
    /* add new cohorts to linked list of cohorts */
    /* dummy cohort is used to figure out biomass */
    for(int spp=0;spp<NSPECIES;spp++){
-      cohort* dc = (cohort*) malloc(sizeof(cohort));
-      if (dc == NULL) {
-         printf("out of memory\n");
-         while(getchar() != '\n');
-      }
+      cohort dummy;
+      cohort* dc = &dummy;
       dc->species = spp; 
       if(data->allometry_type == 0 or data->is_tropical[spp] or data->is_grass[spp]) {
          dc->hite = (data->hgt_min[spp]); 
@@ -510,7 +517,6 @@ void spawn_cohorts(unsigned int t, patch** patchptr, UserData* data){
       }
 
       cp->repro[spp] = 0.0;   /* reset reprodictive array */    
-      free(dc);        
    }  /* end loop over species */
 }
 
@@ -530,14 +536,11 @@ void split_cohorts (patch** patchptr, UserData* data) {
       cohort* currentc=currentp->tallest;
       while(currentc != NULL){
          if((currentc->lai > data->lai_tol)){           
-            cohort* copyc = (cohort*) malloc(sizeof(cohort));
-            if (copyc == NULL) {
-               printf("sc: out of memory\n");
-               while(getchar() != '\n');
-            }
+            cohort* copyc = (cohort*) pool_alloc(&currentp->siteptr->cohort_pool);
 
             /*copy cohort*/
             copy_cohort(&currentc,&copyc);
+            copyc->id = currentp->siteptr->next_cohort_id++;
             // Give each cohort half of the individuals and half lai
             // Only those variables that have units per area (m2) should be 
             // included below for halving. Variables with units per plant should
@@ -751,7 +754,7 @@ void fuse_cohorts (patch** patchptr, UserData* data) {
                }
         
                /* free memory of nextc */
-               free (nextc);
+               pool_free(&cp->siteptr->cohort_pool, nextc);
             } /* end if */
 
             if(nextnextc != NULL){
@@ -16,6 +16,7 @@ class patch;
 //    Typedef: cohort
 ////////////////////////////////////////
 struct cohort{
+   unsigned int id;  ///< unique within the site, see state_dump.cc
    int species;      ///< species number                   
    int pt;           ///< physiology 1=c3 2=c4             
    double nindivs;   ///< number of individuals in cohort  
@@ -68,6 +69,8 @@ struct cohort{
 
    double Vm0;                ///< vm for that cohort, called in mechanism code 
    size_t Vm0_bin;            ///< Vm0 bin
+   size_t light_index;        ///< light bin of mechanism tables, set with Vm0_bin
+   double light_weight;       ///< weight of light_index vs the brighter bin, 1 without interpolation
 
    double gr_resp;            ///< kgC/yr per indiv 
 
@@ -121,9 +124,12 @@ struct cohort{
    // In mechanism.c 
    void npp_function(UserData* data);
    void plant_respiration(UserData* data);
+   void set_light_index(UserData* data);
+   double light_lut(const mech_real* table);
    
    // In cohort.cc 
    void get_cohort_vm0(UserData *data);
+   void downregulate_vm0(double cum_lai, UserData *data);
    int get_cohort_vm0_bin(double Vm0, UserData* data);
 };
 
@@ -135,7 +141,7 @@ double radians(double degree);
 double degrees(double radians);
 double get_day_length(double lat, double month, int get_max);
 void cohort_dynamics(unsigned int t, double t1, double t2,
-                     patch** patchptr, FILE* outfile, UserData *data);
+                     patch** patchptr, UserData *data);
 void init_cohorts(patch** patchptr, UserData* data);
 void create_cohort(unsigned int spp, double nindivs, double hite, double dbh, 
                    double balive, double bdead, patch** patchptr, 
@@ -0,0 +1,378 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#include "edmodels.h"
+#include "site.h"
+#include "patch.h"
+#include "cohort.h"
+
+#include "cohort_soa.h"
+
+// number of per-cohort double arrays carved out of cohort_soa::block
+#define N_SOA_ARRAYS 24
+
+////////////////////////////////////////////////////////////////////////////////
+//! create_cohort_soa
+//! Allocate an empty cohort array container. Storage is grown on demand
+//! by gather, so one container can be reused for every patch of a site.
+//!
+//! @return new container
+////////////////////////////////////////////////////////////////////////////////
+cohort_soa* create_cohort_soa () {
+   cohort_soa* soa = (cohort_soa*) malloc(sizeof(cohort_soa));
+   if (soa == NULL) {
+      fprintf(stderr, "create_cohort_soa: out of memory\n");
+      exit(1);
+   }
+   soa->n = 0;
+   soa->capacity = 0;
+   soa->patchptr = NULL;
+   soa->cptr = NULL;
+   soa->block = NULL;
+   return soa;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! free_cohort_soa
+//!
+//!
+//! @param  psoa container to free, set to NULL on return
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void free_cohort_soa (cohort_soa** psoa) {
+   cohort_soa* soa = *psoa;
+   if (soa == NULL) return;
+   free(soa->cptr);
+   free(soa->block);
+   free(soa);
+   *psoa = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! gather
+//! Copy the cohorts of a patch, shortest first, into the arrays and mark
+//! the container as in use by that patch.
+//!
+//! @param  currentp patch about to be integrated
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void cohort_soa::gather (patch* currentp) {
+   size_t count = 0;
+   cohort* cc = currentp->shortest;
+   while (cc != NULL) {
+      count++;
+      cc = cc->taller;
+   }
+
+   if (count > capacity) {
+      size_t newcap = (capacity > 0) ? capacity : 32;
+      while (newcap < count) newcap *= 2;
+      free(cptr);
+      free(block);
+      cptr = (cohort**) malloc(newcap * sizeof(cohort*));
+      block = (double*) malloc(N_SOA_ARRAYS * newcap * sizeof(double));
+      if ((cptr == NULL) || (block == NULL)) {
+         fprintf(stderr, "cohort_soa::gather: out of memory\n");
+         exit(1);
+      }
+      capacity = newcap;
+
+      double* next = block;
+      nindivs     = next; next += capacity;
+      dbh         = next; next += capacity;
+      balive      = next; next += capacity;
+      bdead       = next; next += capacity;
+      dndt        = next; next += capacity;
+      ddbhdt      = next; next += capacity;
+      dbalivedt   = next; next += capacity;
+      dbdeaddt    = next; next += capacity;
+      old_nindivs = next; next += capacity;
+      old_dbh     = next; next += capacity;
+      old_balive  = next; next += capacity;
+      old_bdead   = next; next += capacity;
+      dndt1       = next; next += capacity;
+      ddbhdt1     = next; next += capacity;
+      dbalivedt1  = next; next += capacity;
+      dbdeaddt1   = next; next += capacity;
+      dndt2       = next; next += capacity;
+      ddbhdt2     = next; next += capacity;
+      dbalivedt2  = next; next += capacity;
+      dbdeaddt2   = next; next += capacity;
+      dndt3       = next; next += capacity;
+      ddbhdt3     = next; next += capacity;
+      dbalivedt3  = next; next += capacity;
+      dbdeaddt3   = next;
+   }
+
+   n = 0;
+   cc = currentp->shortest;
+   while (cc != NULL) {
+      cptr[n] = cc;
+      n++;
+      cc = cc->taller;
+   }
+   gather_state();
+   patchptr = currentp;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! release
+//! Write the integrated state back to the cohorts and detach from patch
+//!
+//! @param
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void cohort_soa::release () {
+   scatter_state();
+   patchptr = NULL;
+   n = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! scatter_state
+//! Copy integrated state from the arrays back to the cohorts
+//!
+//! @param
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void cohort_soa::scatter_state () {
+   for (size_t i=0; i<n; i++) {
+      cohort* cc = cptr[i];
+      cc->nindivs = nindivs[i];
+      cc->dbh = dbh[i];
+      cc->balive = balive[i];
+      cc->bdead = bdead[i];
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! gather_state
+//! Copy state and derivatives from the cohorts to the arrays
+//!
+//! @param
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void cohort_soa::gather_state () {
+   for (size_t i=0; i<n; i++) {
+      cohort* cc = cptr[i];
+      nindivs[i] = cc->nindivs;
+      dbh[i] = cc->dbh;
+      balive[i] = cc->balive;
+      bdead[i] = cc->bdead;
+      dndt[i] = cc->dndt;
+      ddbhdt[i] = cc->ddbhdt;
+      dbalivedt[i] = cc->dbalivedt;
+      dbdeaddt[i] = cc->dbdeaddt;
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! half_step
+//! Advance the current state by half of deltat using the current derivatives
+//!
+//! @param  deltat time step
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void cohort_soa::half_step (double deltat) {
+   for (size_t i=0; i<n; i++) {
+      nindivs[i] += dndt[i] * deltat / 2.;
+      dbh[i] += ddbhdt[i] * deltat / 2.;
+      balive[i] += dbalivedt[i] * deltat / 2.;
+      bdead[i] += dbdeaddt[i] * deltat / 2.;
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! full_step
+//! Advance the saved state by deltat using the current derivatives
+//!
+//! @param  deltat time step
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void cohort_soa::full_step (double deltat) {
+   for (size_t i=0; i<n; i++) {
+      nindivs[i] = old_nindivs[i] + dndt[i] * deltat;
+      dbh[i] = old_dbh[i] + ddbhdt[i] * deltat;
+      balive[i] = old_balive[i] + dbalivedt[i] * deltat;
+      bdead[i] = old_bdead[i] + dbdeaddt[i] * deltat;
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! check_for_negatives
+//! Cohort part of patch::check_for_negatives
+//!
+//! @param  dt time step
+//! @return 0 if no problems, 1 if negative (fixed by smaller dt), 2 if NaN
+////////////////////////////////////////////////////////////////////////////////
+int cohort_soa::check_for_negatives (double dt) {
+   for (size_t i=0; i<n; i++) {
+      if ((dndt[i]+ddbhdt[i]+dbalivedt[i]+dbdeaddt[i])*0!=0) return 2;
+      if ((nindivs[i]<0)|(dbh[i]<0)|(balive[i]<0)|(bdead[i]<0)) return 1;
+      if ((nindivs[i]+dndt[i]*dt<0)|(dbh[i]+ddbhdt[i]*dt<0)|
+          (balive[i]+dbalivedt[i]*dt<0)|(bdead[i]+dbdeaddt[i]*dt<0)) return 1;
+   }
+   return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! save_old
+//!
+//!
+//! @param
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void cohort_soa::save_old () {
+   for (size_t i=0; i<n; i++) {
+      old_nindivs[i] = nindivs[i];
+      old_dbh[i] = dbh[i];
+      old_balive[i] = balive[i];
+      old_bdead[i] = bdead[i];
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! load_old
+//!
+//!
+//! @param
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void cohort_soa::load_old () {
+   for (size_t i=0; i<n; i++) {
+      nindivs[i] = old_nindivs[i];
+      dbh[i] = old_dbh[i];
+      balive[i] = old_balive[i];
+      bdead[i] = old_bdead[i];
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! copy_derivatives
+//!
+//!
+//! @param
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void cohort_soa::copy_derivatives () {
+   for (size_t i=0; i<n; i++) {
+      dndt1[i] = dndt[i];
+      ddbhdt1[i] = ddbhdt[i];
+      dbalivedt1[i] = dbalivedt[i];
+      dbdeaddt1[i] = dbdeaddt[i];
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! load_derivatives
+//!
+//!
+//! @param
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void cohort_soa::load_derivatives () {
+   for (size_t i=0; i<n; i++) {
+      dndt[i] = dndt1[i];
+      ddbhdt[i] = ddbhdt1[i];
+      dbalivedt[i] = dbalivedt1[i];
+      dbdeaddt[i] = dbdeaddt1[i];
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! save_stage_derivatives
+//! Keep the current derivatives as stage 2 or 3 of an embedded rk step.
+//! Stage 1 is kept by copy_derivatives.
+//!
+//! @param  stage 2 or 3
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void cohort_soa::save_stage_derivatives (int stage) {
+   double* kn  = (stage == 2) ? dndt2 : dndt3;
+   double* kd  = (stage == 2) ? ddbhdt2 : ddbhdt3;
+   double* kba = (stage == 2) ? dbalivedt2 : dbalivedt3;
+   double* kbd = (stage == 2) ? dbdeaddt2 : dbdeaddt3;
+   for (size_t i=0; i<n; i++) {
+      kn[i] = dndt[i];
+      kd[i] = ddbhdt[i];
+      kba[i] = dbalivedt[i];
+      kbd[i] = dbdeaddt[i];
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! bs_stage
+//! Set state = old + h*(c1*k1 + c2*k2 + c3*k3)
+//!
+//! @param  h  step size
+//! @param  c1 weight of stage 1 derivatives
+//! @param  c2 weight of stage 2 derivatives
+//! @param  c3 weight of stage 3 derivatives
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void cohort_soa::bs_stage (double h, double c1, double c2, double c3) {
+   for (size_t i=0; i<n; i++) {
+      nindivs[i] = old_nindivs[i] + h * (c1*dndt1[i] + c2*dndt2[i] + c3*dndt3[i]);
+      dbh[i] = old_dbh[i] + h * (c1*ddbhdt1[i] + c2*ddbhdt2[i] + c3*ddbhdt3[i]);
+      balive[i] = old_balive[i] + h * (c1*dbalivedt1[i] + c2*dbalivedt2[i] + c3*dbalivedt3[i]);
+      bdead[i] = old_bdead[i] + h * (c1*dbdeaddt1[i] + c2*dbdeaddt2[i] + c3*dbdeaddt3[i]);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! has_negatives
+//!
+//!
+//! @param
+//! @return true if any integrated cohort quantity is negative
+////////////////////////////////////////////////////////////////////////////////
+bool cohort_soa::has_negatives () {
+   for (size_t i=0; i<n; i++) {
+      if ((nindivs[i]<0)|(dbh[i]<0)|(balive[i]<0)|(bdead[i]<0)) return true;
+   }
+   return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! has_nan_derivatives
+//!
+//!
+//! @param
+//! @return true if any current derivative is NaN or infinite
+////////////////////////////////////////////////////////////////////////////////
+bool cohort_soa::has_nan_derivatives () {
+   for (size_t i=0; i<n; i++) {
+      if ((dndt[i]+ddbhdt[i]+dbalivedt[i]+dbdeaddt[i])*0!=0) return true;
+   }
+   return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! bs_error
+//! Scaled local error of a Bogacki-Shampine step, using k1..k3 from the
+//! stage arrays and k4 from the current derivatives (evaluated at the new
+//! state).
+//!
+//! @param  h    step size
+//! @param  rtol relative tolerance
+//! @param  atol absolute tolerance
+//! @return max over all cohort quantities of |error| / (atol + rtol*|y|)
+////////////////////////////////////////////////////////////////////////////////
+double cohort_soa::bs_error (double h, double rtol, double atol) {
+   // difference between the 3rd and embedded 2nd order solutions
+   const double e1 = -5.0/72.0, e2 = 1.0/12.0, e3 = 1.0/9.0, e4 = -1.0/8.0;
+   double err = 0.0;
+   for (size_t i=0; i<n; i++) {
+      double en = h * (e1*dndt1[i] + e2*dndt2[i] + e3*dndt3[i] + e4*dndt[i]);
+      double ed = h * (e1*ddbhdt1[i] + e2*ddbhdt2[i] + e3*ddbhdt3[i] + e4*ddbhdt[i]);
+      double ea = h * (e1*dbalivedt1[i] + e2*dbalivedt2[i] + e3*dbalivedt3[i] + e4*dbalivedt[i]);
+      double eb = h * (e1*dbdeaddt1[i] + e2*dbdeaddt2[i] + e3*dbdeaddt3[i] + e4*dbdeaddt[i]);
+      err = std::max(err, fabs(en) / (atol + rtol * std::max(fabs(nindivs[i]), fabs(old_nindivs[i]))));
+      err = std::max(err, fabs(ed) / (atol + rtol * std::max(fabs(dbh[i]), fabs(old_dbh[i]))));
+      err = std::max(err, fabs(ea) / (atol + rtol * std::max(fabs(balive[i]), fabs(old_balive[i]))));
+      err = std::max(err, fabs(eb) / (atol + rtol * std::max(fabs(bdead[i]), fabs(old_bdead[i]))));
+   }
+   return err;
+}
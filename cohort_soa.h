@@ -0,0 +1,88 @@
+#ifndef EDM_COHORT_SOA_H_
+#define EDM_COHORT_SOA_H_
+
+#include <cstddef>
+
+struct cohort;
+struct patch;
+
+////////////////////////////////////////
+//    Typedef: cohort_soa
+//    Contiguous copy of the integrated
+//    cohort state of one patch, ordered
+//    shortest to tallest, so that the
+//    integrator's stage, error and
+//    negativity loops are linear. f()
+//    still evaluates the cohort structs,
+//    copying state in and derivatives
+//    out, see odeint.cc
+////////////////////////////////////////
+struct cohort_soa {
+   size_t n;          ///< number of cohorts currently gathered
+   size_t capacity;   ///< allocated length of each array
+   patch* patchptr;   ///< patch being integrated, NULL when idle
+   cohort** cptr;     ///< cohort owning each slot
+
+   // integrated state UNITS - see cohort.h
+   double* nindivs;
+   double* dbh;
+   double* balive;
+   double* bdead;
+
+   // derivatives
+   double* dndt;
+   double* ddbhdt;
+   double* dbalivedt;
+   double* dbdeaddt;
+
+   // For rk2 integrator
+   double* old_nindivs;
+   double* old_dbh;
+   double* old_balive;
+   double* old_bdead;
+   double* dndt1;
+   double* ddbhdt1;
+   double* dbalivedt1;
+   double* dbdeaddt1;
+
+   // extra stage derivatives for the adaptive integrator
+   double* dndt2;
+   double* ddbhdt2;
+   double* dbalivedt2;
+   double* dbdeaddt2;
+   double* dndt3;
+   double* ddbhdt3;
+   double* dbalivedt3;
+   double* dbdeaddt3;
+
+   double* block;     ///< single allocation backing all of the arrays above
+
+   void gather (patch* currentp);
+   void release ();
+   void scatter_state ();
+   void gather_state ();
+
+   void half_step (double deltat);
+   void full_step (double deltat);
+   int check_for_negatives (double dt);
+   void save_old ();
+   void load_old ();
+   void copy_derivatives ();
+   void load_derivatives ();
+
+   // Bogacki-Shampine 3(2) support, see adaptive_sodeint in odeint.cc
+   void save_stage_derivatives (int stage);
+   void bs_stage (double h, double c1, double c2, double c3);
+   bool has_negatives ();
+   bool has_nan_derivatives ();
+   double bs_error (double h, double rtol, double atol);
+};
+
+
+////////////////////////////////////////
+//    Function Prototypes
+////////////////////////////////////////
+cohort_soa* create_cohort_soa ();
+void free_cohort_soa (cohort_soa** psoa);
+
+#endif // EDM_COHORT_SOA_H_
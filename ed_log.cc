@@ -0,0 +1,237 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdarg>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <vector>
+
+#include "ed_log.h"
+
+// Records are fixed size, longer messages are truncated
+#define LOG_RECORD_LEN  256
+#define LOG_RING_SLOTS  1024   ///< records per thread ring, power of 2
+#define LOG_FLUSH_MS    50     ///< flusher wakes at least this often
+#define LOG_TL_STREAMS  4      ///< streams a thread remembers its ring for
+
+struct log_record {
+   unsigned long long seq;       ///< order of the record within its stream
+   unsigned short len;
+   char text[LOG_RECORD_LEN];
+};
+
+////////////////////////////////////////
+//    Typedef: log_ring
+//    Single producer (the owning thread)
+//    single consumer (the flusher) ring.
+//    head is only written by the producer
+//    and tail only by the flusher.
+////////////////////////////////////////
+struct log_ring {
+   std::atomic<size_t> head;
+   std::atomic<size_t> tail;
+   log_ring* next;               ///< next ring of the same stream
+   log_record slot[LOG_RING_SLOTS];
+};
+
+struct log_stream {
+   unsigned long id;             ///< never reused, keys the thread-local cache
+   FILE* outfile;
+   std::atomic<unsigned long long> seq; ///< next record sequence number
+   std::atomic<log_ring*> rings; ///< rings are only ever pushed on the front
+   std::mutex lock;              ///< serializes ring registration and wakeups
+   std::condition_variable wake;
+   bool stop;
+   std::thread flusher;
+};
+
+static std::atomic<unsigned long> next_stream_id(1);
+
+// ring of the calling thread for each of the last few streams it wrote to
+static thread_local unsigned long tl_stream_id[LOG_TL_STREAMS];
+static thread_local log_ring* tl_ring[LOG_TL_STREAMS];
+static thread_local unsigned int tl_next;
+
+////////////////////////////////////////////////////////////////////////////////
+//! drain_rings
+//! Write out everything the producers have published so far, merged across
+//! the rings in sequence order. A site may run on a different thread each
+//! step, so its records can sit in several rings; the merge keeps them in
+//! the order they were logged.
+//!
+//! @param  log stream to drain
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+static void drain_rings (log_stream* log) {
+   std::vector<log_ring*> rings;
+   std::vector<size_t> tails, heads;
+   for (log_ring* r = log->rings.load(std::memory_order_acquire); r != NULL; r = r->next) {
+      rings.push_back(r);
+      tails.push_back(r->tail.load(std::memory_order_relaxed));
+      heads.push_back(r->head.load(std::memory_order_acquire));
+   }
+
+   for (;;) {
+      size_t next = rings.size();
+      unsigned long long next_seq = 0;
+      for (size_t i=0; i<rings.size(); i++) {
+         if (tails[i] == heads[i]) continue;
+         unsigned long long seq = rings[i]->slot[tails[i] & (LOG_RING_SLOTS - 1)].seq;
+         if (next == rings.size() || seq < next_seq) {
+            next = i;
+            next_seq = seq;
+         }
+      }
+      if (next == rings.size()) break;
+
+      log_record* rec = &rings[next]->slot[tails[next] & (LOG_RING_SLOTS - 1)];
+      fwrite(rec->text, 1, rec->len, log->outfile);
+      tails[next]++;
+   }
+
+   for (size_t i=0; i<rings.size(); i++) {
+      rings[i]->tail.store(tails[i], std::memory_order_release);
+   }
+   fflush(log->outfile);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! flusher_loop
+//! Body of the flusher thread
+//!
+//! @param  log stream to flush
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+static void flusher_loop (log_stream* log) {
+   std::unique_lock<std::mutex> guard(log->lock);
+   while (! log->stop) {
+      log->wake.wait_for(guard, std::chrono::milliseconds(LOG_FLUSH_MS));
+      guard.unlock();
+      drain_rings(log);
+      guard.lock();
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! thread_ring
+//! Find the calling thread's ring for a stream, registering one on first use
+//!
+//! @param  log stream
+//! @return ring
+////////////////////////////////////////////////////////////////////////////////
+static log_ring* thread_ring (log_stream* log) {
+   for (unsigned int i=0; i<LOG_TL_STREAMS; i++) {
+      if (tl_stream_id[i] == log->id) return tl_ring[i];
+   }
+
+   log_ring* r = new log_ring;
+   r->head.store(0);
+   r->tail.store(0);
+   {
+      std::lock_guard<std::mutex> guard(log->lock);
+      r->next = log->rings.load(std::memory_order_relaxed);
+      log->rings.store(r, std::memory_order_release);
+   }
+
+   unsigned int i = tl_next++ % LOG_TL_STREAMS;
+   tl_stream_id[i] = log->id;
+   tl_ring[i] = r;
+   return r;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! open_log_stream
+//! Open a diagnostic file and start its flusher thread
+//!
+//! @param  filename file to write
+//! @param  append   append to an existing file rather than truncate it
+//! @return stream, exits if the file can't be opened
+////////////////////////////////////////////////////////////////////////////////
+log_stream* open_log_stream (const char* filename, int append) {
+   log_stream* log = new log_stream;
+   log->outfile = fopen(filename, append ? "a" : "w");
+   if (log->outfile == NULL) {
+      fprintf(stderr, "open_log_stream: Can't open file: %s \n", filename);
+      exit(1);
+   }
+   log->id = next_stream_id++;
+   log->seq.store(0);
+   log->rings.store(NULL);
+   log->stop = false;
+   log->flusher = std::thread(flusher_loop, log);
+   return log;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! close_log_stream
+//! Stop the flusher, write any remaining records and close the file.
+//! No thread may still be writing to the stream.
+//!
+//! @param  plog stream to close, set to NULL
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void close_log_stream (log_stream** plog) {
+   log_stream* log = *plog;
+   if (log == NULL) return;
+
+   {
+      std::lock_guard<std::mutex> guard(log->lock);
+      log->stop = true;
+   }
+   log->wake.notify_one();
+   log->flusher.join();
+   drain_rings(log);
+   fclose(log->outfile);
+
+   log_ring* r = log->rings.load();
+   while (r != NULL) {
+      log_ring* next = r->next;
+      delete r;
+      r = next;
+   }
+   delete log;
+   *plog = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! log_printf
+//! Append a record to the calling thread's ring. The record is prefixed with
+//! tag (normally the site name) so that the output of one site can be picked
+//! out when sites run in parallel. Returns at once if log is NULL. Blocks
+//! only when the ring is full, until the flusher catches up.
+//!
+//! @param  log stream, may be NULL
+//! @param  tag record tag, may be NULL
+//! @param  fmt printf format
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void log_printf (log_stream* log, const char* tag, const char* fmt, ...) {
+   if (log == NULL) return;
+
+   log_ring* r = thread_ring(log);
+   size_t head = r->head.load(std::memory_order_relaxed);
+   while (head - r->tail.load(std::memory_order_acquire) >= LOG_RING_SLOTS) {
+      log->wake.notify_one();
+      std::this_thread::yield();
+   }
+
+   log_record* rec = &r->slot[head & (LOG_RING_SLOTS - 1)];
+   rec->seq = log->seq.fetch_add(1, std::memory_order_relaxed);
+   int len = 0;
+   if (tag != NULL) {
+      len = snprintf(rec->text, LOG_RECORD_LEN, "[%s] ", tag);
+      if (len >= LOG_RECORD_LEN) len = LOG_RECORD_LEN - 1;
+   }
+   va_list ap;
+   va_start(ap, fmt);
+   int n = vsnprintf(rec->text + len, LOG_RECORD_LEN - len, fmt, ap);
+   va_end(ap);
+   len += n;
+   if (len >= LOG_RECORD_LEN) len = LOG_RECORD_LEN - 1;
+   rec->len = (unsigned short) len;
+
+   r->head.store(head + 1, std::memory_order_release);
+}
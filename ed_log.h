@@ -0,0 +1,26 @@
+#ifndef EDM_LOG_H_
+#define EDM_LOG_H_
+
+#include <cstdio>
+
+////////////////////////////////////////
+//    Typedef: log_stream
+//    Diagnostic text file (cd, fp) that
+//    can be written from TBB workers.
+//    Each thread appends records to its
+//    own ring and a flusher thread writes
+//    them to the file, so the file stays
+//    open for the whole run. See ed_log.cc
+////////////////////////////////////////
+struct log_stream;
+
+
+////////////////////////////////////////
+//    Function Prototypes
+////////////////////////////////////////
+log_stream* open_log_stream (const char* filename, int append);
+void close_log_stream (log_stream** plog);
+void log_printf (log_stream* log, const char* tag, const char* fmt, ...)
+   __attribute__ ((format (printf, 3, 4)));
+
+#endif // EDM_LOG_H_
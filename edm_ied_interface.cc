@@ -11,6 +11,9 @@
 #include "read_site_data.h"
 #include "outputter.h"
 #include "restart.h"
+#ifdef ED
+#include "cohort_soa.h"
+#endif
 
 #include "edm_ied_interface.h"
 
@@ -178,14 +181,32 @@ void EDMiEDInterface::readRegionAEZFile ( ) {
 
 
 site* EDMiEDInterface::copyWorld(site* world) {
+   // the copy is one block in list order, like the world init_sites builds
+   size_t n_sites = 0;
+   for (site* s=world; s!=NULL; s=s->next_site) {
+      n_sites++;
+   }
+   site *block = (site*)malloc((n_sites + 1) * sizeof(site));
+   if (block == NULL) {
+      fprintf(stderr, "copyWorld: out of memory\n");
+      exit(1);
+   }
+
    site *new_world = NULL;
    site *ls = NULL;
    site *cs = world;
-   site *ns;
+   site *ns = NULL;
+   size_t i = 0;
    while (cs != NULL) {
       //ns = new site(*cs);
-      ns = (site*)malloc(sizeof(site));
+      ns = &block[i++];
       *ns = *cs;
+      // the copy gets its own allocators, never share the original's
+      init_site_pools(ns, edmControl);
+      ns->soi_out = NULL; // the copy prints through plain fopen/fclose
+#ifdef ED
+      ns->cohort_arrays = NULL;
+#endif
       if (ls != NULL) {
          ls->next_site = ns;
       } else {   
@@ -199,10 +220,10 @@ site* EDMiEDInterface::copyWorld(site* world) {
          patch *cp = cs->youngest_patch[lu];
          while (cp != NULL) {
             //np = new patch(*cp);
-            np = (patch*)malloc(sizeof(patch));
+            np = (patch*)pool_alloc(&ns->patch_pool);
             *np = *cp;
             if (lu == LU_SCND){
-               np->phistory = (double*)calloc(edmControl->n_years_to_simulate+1, sizeof(double));
+               np->phistory = (double*)pool_calloc(&ns->phistory_pool);
 #if 0
                for (int i=0; i<edmControl->n_years_to_simulate+1; i++)
                   np->phistory[i] = cp->phistory[i];
@@ -226,7 +247,7 @@ site* EDMiEDInterface::copyWorld(site* world) {
             cohort *cc = cp->shortest;
             while (cc != NULL) {
                //nc = new cohort(cc);
-               nc = (cohort*)malloc(sizeof(cohort));
+               nc = (cohort*)pool_alloc(&ns->cohort_pool);
                *nc = *cc;
                nc->taller = NULL;
                nc->patchptr = np;
@@ -249,7 +270,11 @@ site* EDMiEDInterface::copyWorld(site* world) {
       ls = ns;
       cs = cs->next_site;
    }
-   ns->next_site = NULL;
+   if (ns != NULL) {
+      ns->next_site = NULL;
+   } else {
+      free(block);
+   }
 
    return new_world;
 }
@@ -258,27 +283,15 @@ site* EDMiEDInterface::copyWorld(site* world) {
 void delete_world(site* world) {
    site *cs = world;
    while (cs != NULL) {
-      for (int lu=0; lu<N_LANDUSE_TYPES; lu++) {
-         patch *cp = cs->youngest_patch[lu];
-         while (cp != NULL) {
+      // patches, histories and cohorts all live in the site's pools
+      free_site_pools(cs);
+      free_soi_writer(&cs->soi_out);
 #ifdef ED
-            cohort *cc = cp->shortest;
-            while (cc != NULL) {
-               cohort *tc = cc;
-               cc = cc->taller;
-               free(tc);
-            }
+      free_cohort_soa(&cs->cohort_arrays);
 #endif
-            if (lu == LU_SCND)
-               free(cp->phistory);
-            patch *tp = cp;
-            cp = tp->older;
-            free(tp);
-         }
-      }
-      site *ts = cs;
-      cs = ts->next_site;
-      free(ts);
+      cs = cs->next_site;
    }
+   // sites themselves are one block starting at the first site
+   free(world);
 }
 
@@ -26,6 +26,13 @@
 
 #define FTS 0
 
+#define MECH_FLOAT 0 ///< Store mechanism lookup tables in single precision
+#if MECH_FLOAT
+typedef float mech_real;
+#else
+typedef double mech_real;
+#endif
+
 ////////////////////////////////////////
 //    INTEGRATION                
 ////////////////////////////////////////
@@ -91,9 +98,20 @@
 #define LU_CROP 2
 #define LU_PAST 3
 
+// Allometric equations used by a PFT, see init_allometry
+#define ALLOM_SPRUCE      0 ///< evergreen with allometry_type 0
+#define ALLOM_SALDARRIAGA 1 ///< tropical, grass, cold_decid with allometry_type 0
+#define ALLOM_ALBANI      2 ///< Albani et al. GCB 2006
+
 ////////////////////////////////////////
 //    PRINTING                    
 ////////////////////////////////////////
+// statistic of region_aggregate, see Outputter::accumulateAll
+#define AGG_MEAN 0
+#define AGG_MIN  1
+#define AGG_MAX  2
+#define AGG_SUM  3
+
 #ifdef ED
 #define PRINTFREQ 1 ///< Timesteps bewteen output, 1=1month
 #elif defined MIAMI_LU
@@ -110,7 +128,9 @@
 // Forward declarations
 class Outputter;
 class Restart;
+struct BlobRestart;
 struct site;
+struct mech_store;
 namespace libconfig {
    class Config;
 }
@@ -131,10 +151,24 @@ struct UserData {
    // @TODO: only one of these is necessary
    site* first_site;
    site** site_arr;
+   size_t* site_order;     ///< site_arr indices, most expensive first within each arena's part
+   int site_grain;         ///< sites per parallel task
+   int cost_scheduling;    ///< 1: schedule sites by last step's cost, 0: grid order
+   int n_threads;          ///< threads for the site loops, 0 = all
+   int thread_pinning;     ///< 1: pin each thread to one cpu
+   int numa_arenas;        ///< 1: one arena per NUMA node, each owning a part of the sites
+   struct site_sched* sched;
+   double step_time_sum;   ///< wall time of the parallel site loop, summed over steps (s)
+   double step_time_max;   ///< slowest step of the parallel site loop (s)
+   unsigned long n_steps_timed;
+   double step_latency_sum; ///< wall time of whole time steps, output included (s)
+   double step_latency_max;
+   double output_time_sum;  ///< part of step_latency_sum spent in region output (s)
 
    Outputter* outputter;
    Restart* restartWriter;
    Restart* restartReader;
+   BlobRestart* blobReader;  ///< open binary restart while sites are initialized
    
    const char *model_name; ///< Which model are we running: ED or MLU?
    int allometry_type; 
@@ -210,6 +244,7 @@ struct UserData {
    int do_yearly_mech;
    int m_int;
    int m_string;
+   const char *mech_cache_file;  ///< binary mechanism table cache, "" for none
    
    int hurricane;
    const char *hurricane_file;
@@ -227,6 +262,11 @@ struct UserData {
    double height_threshold_delta;
    double tmax;        ///< Number of years to simulated
    int stiff_light;    ///< 1: Yes to stiff integration of light levels
+   int light_interpolation; ///< 1: Interpolate mechanism tables between light bins
+   int soa_integration;///< 1: Integrate cohorts from contiguous per-patch arrays
+   int integrator;     ///< 0: split-step RK2, 1: adaptive Bogacki-Shampine 3(2)
+   double ode_rtol;    ///< Relative error tolerance of the adaptive integrator
+   double ode_atol;    ///< Absolute error tolerance of the adaptive integrator
    int patch_dynamics; ///< Patch dynamics flag, 1=yes to patch dynamics
    int substeps; 
    
@@ -239,6 +279,9 @@ struct UserData {
    int new_restart_read;
    const char *restart_dir;
 
+   int blob_restart_write;   ///< binary restart, written in parallel, see write_blob_restart
+   int blob_restart_read;
+
    ////////////////////////////////////////
    //    BIOLOGY/BIOGEOCHEMISTRY     
    ////////////////////////////////////////
@@ -310,10 +353,19 @@ struct UserData {
 
    int print_system_state;   ///< flag to print system state files
    int print_ss_freq;        ///< in NSUB units
+   int region_sync_freq;     ///< records between syncs of the region file, 0: only when closed
+   int region_land_only;     ///< 1: region file holds modelled cells only (netcdf-4), see expandregion
+   int region_deflate;       ///< deflate level of the land only region file, 0: none
+   int region_aggregate_window; ///< region records folded into one written record, 1: none
+   int region_aggregate;     ///< AGG_MEAN, AGG_MIN, AGG_MAX or AGG_SUM over the window
+   int state_dump_freq;      ///< in NSUB units, patch and cohort state of all sites, 0: never
+   int state_dump_deflate;   ///< deflate level of the state dumps, 0: none
    
-   // These two (cd_file, fp_file) have to be off if using GCD or Intel TBB !!!
+   // cd and fp diagnostics, written through ed_log so they work with TBB
    int cd_file;              
    int fp_file;       
+   struct log_stream* cd_log;  ///< open cd stream, NULL if cd_file is off
+   struct log_stream* fp_log;  ///< open fp stream, NULL if fp_file is off
  
    int long_patch_file;
    int long_cd_file;
@@ -336,6 +388,8 @@ struct UserData {
    int climate_file_ncid;        ///< Stores the handle to the climate file to avoid re-opening
    int soil_file_ncid;
    int lu_file_ncid;             ///< Stores the handle to the landuse file to avoid re-opening
+   size_t lu_first_year;         ///< first landuse year held by the sites
+   size_t lu_n_years;            ///< number of landuse years held by the sites
    int qair_file_ncid;
    int sw_file_ncid;
    int tair_file_ncid;
@@ -343,7 +397,9 @@ struct UserData {
    // These are ED only
    int mech_c3_file_ncid[NUM_Vm0s];
    int mech_c4_file_ncid[NUM_Vm0s];
+   mech_store* mech_tables;      ///< mechanism lookup tables of all sites
    int mechanism_year;           ///<stores the mechanism year to use
+   struct forcing_pipeline* forcing; ///< yearly forcing read ahead, NULL unless do_yearly_mech
    char mech_year_string[256];
 
    // Integration structures parameters and coefficients
@@ -439,6 +495,11 @@ struct UserData {
    double beta[NSPECIES][NCMPT];     ///< resp rates of plant carbon pools (per year per kgC)
  
    double max_dbh[NSPECIES];         ///< size at which height growth stops (cm)
+   int allom_family[NSPECIES];       ///< allometric equations used, set in init_allometry
+   double allom_leaf_ep[NSPECIES];   ///< exp(p) of leaf allometry below max_dbh (Saldarriaga)
+   double allom_leaf_q[NSPECIES];    ///< dbh exponent of leaf allometry below max_dbh (Saldarriaga)
+   double allom_stem_ep[NSPECIES];   ///< exp(p) of stem allometry below max_dbh (Saldarriaga)
+   double allom_stem_q[NSPECIES];    ///< dbh exponent of stem allometry below max_dbh (Saldarriaga)
    double r_fract[NSPECIES];         ///< fraction of excess c going to seed repro
    double c_fract[NSPECIES];         ///< fraction of excess c going to clonal repro
    double hgt_min[NSPECIES];  
@@ -484,6 +545,16 @@ struct UserData {
    double ** grid_cell_area_total;
    double ** wtr_ice_f;
    //int mask[180][360];
+#ifdef ED
+   // soil and climate inputs of the region, only held while sites are initialized
+   double ** soil_depth_layer;
+   double ** theta_max_layer;
+   double ** k_sat_layer;
+   double ** tau_layer;
+   double ** precip_layer;       ///< [N_CLIMATE][n_lat*n_lon]
+   double ** temp_layer;         ///< [N_CLIMATE][n_lat*n_lon]
+   double ** soil_temp_layer;    ///< [N_CLIMATE][n_lat*n_lon]
+#endif
 
    double ** init_height;
    double ** max_pot_height;
@@ -526,5 +597,8 @@ void ed_finalize(UserData& data);
 void** malloc_2d (size_t nrows, size_t ncols, int elementsize);
 void init_data(const char* cfgFile, UserData* data);
 void init_mech_table (UserData *data);
+#ifdef ED
+void init_allometry (UserData *data);
+#endif
 
 #endif // EDM_DOMAIN_H_
@@ -0,0 +1,168 @@
+/* expandregion: converts a land only region file (region_land_only,  *
+ * CF compression by gathering over the "land" index variable) back   *
+ * to full time x lat x lon grids, for tools that expect those.       *
+ * Cells that were not modelled get the variable's missing_value.     */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "netcdf.h"
+
+#define NCERR(s, e) { printf("Error: %s %s\n", s, nc_strerror(e)); exit(62); }
+
+////////////////////////////////////////////////////////////////////////////////
+//! dim_len
+//!
+//!
+//! @param  ncid open file
+//! @param  name dimension name
+//! @param  dimid receives the dimension id
+//! @return length of the dimension
+////////////////////////////////////////////////////////////////////////////////
+static size_t dim_len (int ncid, const char* name, int* dimid) {
+   int rv;
+   size_t len;
+   if ((rv = nc_inq_dimid(ncid, name, dimid))) NCERR(name, rv);
+   if ((rv = nc_inq_dimlen(ncid, *dimid, &len))) NCERR(name, rv);
+   return len;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! copy_atts
+//! Copy all attributes of a variable
+//!
+//! @param  in      source file
+//! @param  in_var  source variable
+//! @param  out     destination file, in define mode
+//! @param  out_var destination variable
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+static void copy_atts (int in, int in_var, int out, int out_var) {
+   int rv, natts;
+   char name[NC_MAX_NAME+1];
+   if ((rv = nc_inq_varnatts(in, in_var, &natts))) NCERR("attributes", rv);
+   for (int a=0; a<natts; a++) {
+      if ((rv = nc_inq_attname(in, in_var, a, name))) NCERR("attributes", rv);
+      if ((rv = nc_copy_att(in, in_var, name, out, out_var))) NCERR(name, rv);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! main
+//!
+//!
+//! @param
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+int main (int ac, char *av[]) {
+   int rv, in, out;
+
+   if (ac != 3) {
+      fprintf(stderr, "Usage: %s land-region-file grid-region-file\n", av[0]);
+      return 1;
+   }
+
+   if ((rv = nc_open(av[1], NC_NOWRITE, &in))) NCERR(av[1], rv);
+
+   int time_dim, lat_dim, lon_dim, land_dim;
+   size_t n_time = dim_len(in, "time", &time_dim);
+   size_t n_lat  = dim_len(in, "lat", &lat_dim);
+   size_t n_lon  = dim_len(in, "lon", &lon_dim);
+   size_t n_land = dim_len(in, "land", &land_dim);
+
+   // cell of each land point, lat_index*n_lon+lon_index
+   int land_var;
+   std::vector<int> land(n_land);
+   if ((rv = nc_inq_varid(in, "land", &land_var))) NCERR("land", rv);
+   // a region with no modelled cells has an empty land dimension
+   if ((n_land > 0) && (rv = nc_get_var_int(in, land_var, land.data()))) NCERR("land", rv);
+   for (size_t i=0; i<n_land; i++) {
+      if ((land[i] < 0) || ((size_t)land[i] >= n_lat * n_lon)) {
+         fprintf(stderr, "expandregion: land index %d out of range\n", land[i]);
+         return 1;
+      }
+   }
+
+   if ((rv = nc_create(av[2], NC_CLOBBER | NC_64BIT_OFFSET, &out))) NCERR(av[2], rv);
+   int out_dims[3];
+   if ((rv = nc_def_dim(out, "time", NC_UNLIMITED, &out_dims[0]))) NCERR("time", rv);
+   if ((rv = nc_def_dim(out, "lat", n_lat, &out_dims[1]))) NCERR("lat", rv);
+   if ((rv = nc_def_dim(out, "lon", n_lon, &out_dims[2]))) NCERR("lon", rv);
+
+   // define a gridded twin of every variable
+   int nvars;
+   if ((rv = nc_inq_nvars(in, &nvars))) NCERR(av[1], rv);
+   std::vector<int> out_var(nvars, -1);
+   std::vector<int> is_rec(nvars, 0);
+   for (int v=0; v<nvars; v++) {
+      char name[NC_MAX_NAME+1];
+      nc_type type;
+      int ndims, dims[NC_MAX_VAR_DIMS];
+      if ((rv = nc_inq_var(in, v, name, &type, &ndims, dims, NULL))) NCERR(av[1], rv);
+      if (v == land_var) continue;
+
+      if ((ndims == 1) && (dims[0] == lat_dim)) {
+         rv = nc_def_var(out, name, type, 1, &out_dims[1], &out_var[v]);
+      } else if ((ndims == 1) && (dims[0] == lon_dim)) {
+         rv = nc_def_var(out, name, type, 1, &out_dims[2], &out_var[v]);
+      } else if ((ndims == 1) && (dims[0] == land_dim)) {
+         rv = nc_def_var(out, name, type, 2, &out_dims[1], &out_var[v]);
+      } else if ((ndims == 2) && (dims[0] == time_dim) && (dims[1] == land_dim)) {
+         rv = nc_def_var(out, name, type, 3, &out_dims[0], &out_var[v]);
+         is_rec[v] = 1;
+      } else {
+         fprintf(stderr, "expandregion: skipping %s, not on the land dimension\n", name);
+         continue;
+      }
+      if (rv) NCERR(name, rv);
+      copy_atts(in, v, out, out_var[v]);
+   }
+   if ((rv = nc_enddef(out))) NCERR(av[2], rv);
+
+   // scatter each record onto the grid
+   std::vector<double> packed(n_land > n_lon ? n_land : n_lon);
+   std::vector<double> grid(n_lat * n_lon);
+   for (int v=0; v<nvars; v++) {
+      if (out_var[v] < 0) continue;
+      char name[NC_MAX_NAME+1];
+      int ndims, dims[NC_MAX_VAR_DIMS];
+      if ((rv = nc_inq_var(in, v, name, NULL, &ndims, dims, NULL))) NCERR(av[1], rv);
+
+      if ((dims[0] == lat_dim) || (dims[0] == lon_dim)) {
+         size_t n = (dims[0] == lat_dim) ? n_lat : n_lon;
+         size_t start[1] = { 0 };
+         size_t count[1] = { n };
+         if ((rv = nc_get_vara_double(in, v, start, count, packed.data()))) NCERR(name, rv);
+         if ((rv = nc_put_vara_double(out, out_var[v], start, count, packed.data()))) NCERR(name, rv);
+         continue;
+      }
+
+      double fill;
+      if (nc_get_att_double(in, v, "missing_value", &fill) != NC_NOERR) {
+         fill = NC_FILL_FLOAT;
+      }
+      size_t n_rec = is_rec[v] ? n_time : 1;
+      for (size_t r=0; r<n_rec; r++) {
+         size_t in_start[2]  = { r, 0 };
+         size_t in_count[2]  = { 1, n_land };
+         size_t out_start[3] = { r, 0, 0 };
+         size_t out_count[3] = { 1, n_lat, n_lon };
+         int k = is_rec[v] ? 0 : 1;
+         if ((rv = nc_get_vara_double(in, v, in_start + k, in_count + k, packed.data()))) NCERR(name, rv);
+
+         for (size_t c=0; c<n_lat*n_lon; c++) grid[c] = fill;
+         for (size_t i=0; i<n_land; i++) grid[land[i]] = packed[i];
+
+         if ((rv = nc_put_vara_double(out, out_var[v], out_start + k, out_count + k, grid.data()))) {
+            NCERR(name, rv);
+         }
+      }
+   }
+
+   nc_close(in);
+   if ((rv = nc_close(out))) NCERR(av[2], rv);
+   printf("expandregion: %lu records of %lu land cells onto a %lu x %lu grid\n",
+          (unsigned long)n_time, (unsigned long)n_land, (unsigned long)n_lat, (unsigned long)n_lon);
+   return 0;
+}
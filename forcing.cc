@@ -0,0 +1,498 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include "netcdf.h"
+
+#include "edmodels.h"
+#include "site.h"
+#include "read_site_data.h"
+#include "mech_store.h"
+#include "site_sched.h"
+#include "forcing.h"
+
+#if MECH_FLOAT
+#define NC_GET_VARA_MECH nc_get_vara_float
+#else
+#define NC_GET_VARA_MECH nc_get_vara_double
+#endif
+
+#define FORCING_FIRST_YEAR 1901 ///< year of the files for model year 0 (m_int)
+#define FORCING_YEAR_LIST "/Network/Xgrid/data/MSTMIP/model_driver/cru_ncep/file_lists/fl1.txt"
+
+////////////////////////////////////////////////////////////////////////////////
+//! next_year_string
+//! Read the next year from the year list, starting over at the top of the
+//! list when it runs out
+//!
+//! @param  fp   pipeline
+//! @param  name receives the year
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+static void next_year_string (forcing_pipeline* fp, char* name) {
+   if ((fscanf(fp->year_list, "%255s", name) != 1) || (strlen(name) != 4)) {
+      rewind(fp->year_list);
+      if (fscanf(fp->year_list, "%255s", name) != 1) {
+         fprintf(stderr, "next_year_string: no years in %s\n", FORCING_YEAR_LIST);
+         exit(1);
+      }
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! year_file_name
+//! Name of the file of a year, base + year + .nc
+//!
+//! @param  name receives the file name
+//! @param  base file name without year
+//! @param  fy   year
+//! @param  data Userdata structure
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+static void year_file_name (char* name, const char* base, const forcing_year* fy,
+                            const UserData* data) {
+   if (data->m_int) {
+      sprintf(name, "%s%d.nc", base, fy->year);
+   } else {
+      sprintf(name, "%s%s.nc", base, fy->year_string);
+   }
+}
+
+#if !FTS
+typedef mech_real mech_table[NUM_Vm0s][N_CLIMATE][N_LIGHT]; ///< what SiteData::An etc. point to
+
+////////////////////////////////////////////////////////////////////////////////
+//! site_table
+//! One table of a site in a year buffer. Only Vm0 bin 0 is read, so
+//! NUM_Vm0s sites share each mech_tables of the buffer: site i uses bin
+//! i % NUM_Vm0s of element i / NUM_Vm0s. The result has the [PT][NUM_Vm0s]
+//! shape SiteData expects, of which only bin 0 belongs to the site.
+//!
+//! @param  var  An, E, Anb or Eb of element i / NUM_Vm0s
+//! @param  i    site list index
+//! @return table of the site
+////////////////////////////////////////////////////////////////////////////////
+static mech_table* site_table (mech_table* var, size_t i) {
+   return (mech_table*) &var[0][i % NUM_Vm0s];
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//! alloc_forcing_year
+//!
+//!
+//! @param  fp   pipeline
+//! @param  data Userdata structure
+//! @return new year, contents undefined
+////////////////////////////////////////////////////////////////////////////////
+static forcing_year* alloc_forcing_year (forcing_pipeline* fp, const UserData* data) {
+   size_t ncells = data->n_lat * data->n_lon;
+   forcing_year* fy = (forcing_year*) malloc(sizeof(forcing_year));
+   if (fy == NULL) {
+      fprintf(stderr, "alloc_forcing_year: out of memory\n");
+      exit(1);
+   }
+   fy->precip    = (double **)malloc_2d(N_CLIMATE, ncells, sizeof(double));
+   fy->temp      = (double **)malloc_2d(N_CLIMATE, ncells, sizeof(double));
+   fy->soil_temp = (double **)malloc_2d(N_CLIMATE, ncells, sizeof(double));
+#if !FTS
+   size_t n_mech = (fp->n_sites + NUM_Vm0s - 1) / NUM_Vm0s;
+   fy->mech = (mech_tables*) malloc(n_mech * sizeof(mech_tables));
+   fy->tf = (double (*)[PT][N_CLIMATE]) malloc(fp->n_sites * sizeof(*fy->tf));
+   if ((fp->n_sites > 0) && ((fy->mech == NULL) || (fy->tf == NULL))) {
+      fprintf(stderr, "alloc_forcing_year: out of memory for mechanism tables\n");
+      exit(1);
+   }
+#endif
+   return fy;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! free_forcing_year
+//!
+//!
+//! @param  fy year to release, may be NULL
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+static void free_forcing_year (forcing_year* fy) {
+   if (fy == NULL) return;
+   double** layers[3] = { fy->precip, fy->temp, fy->soil_temp };
+   for (size_t i=0; i<3; i++) {
+      if (layers[i] != NULL) {
+         free(layers[i][0]);
+         free(layers[i]);
+      }
+   }
+#if !FTS
+   free(fy->mech);
+   free(fy->tf);
+#endif
+   free(fy);
+}
+
+#if !FTS
+////////////////////////////////////////////////////////////////////////////////
+//! read_mech_year
+//! Read the mechanism tables of all sites from the files of one year, one
+//! hyperslab per variable and grid row holding sites, and copy each site's
+//! part into its tables. The netcdf lock is only held for the reads.
+//!
+//! @param  fp   pipeline, for the sites
+//! @param  fy   year to fill
+//! @param  data Userdata structure
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+static void read_mech_year (forcing_pipeline* fp, forcing_year* fy, UserData* data) {
+   const char* names[4] = { "An", "Anb", "E", "Eb" };
+   size_t table_len = N_CLIMATE * N_LIGHT;
+   mech_real* row = (mech_real*) malloc(data->n_lon * table_len * sizeof(mech_real));
+   double* tf_row = (double*) malloc(data->n_lon * N_CLIMATE * sizeof(double));
+   if ((row == NULL) || (tf_row == NULL)) {
+      fprintf(stderr, "read_mech_year: out of memory\n");
+      exit(1);
+   }
+
+   for (size_t pt=0; pt<PT; pt++) {
+      char filename[256];
+      year_file_name(filename, (pt == 0) ? data->mech_c3_file : data->mech_c4_file, fy, data);
+
+      int rv, ncid, tf_id, varids[4];
+      {
+         std::lock_guard<std::mutex> lock(netcdf_mutex);
+         if ((rv = nc_open(filename, NC_NOWRITE, &ncid))) {
+            NCERR(filename, rv);
+         }
+         // light levels, same everywhere and in every year
+         if (! data->mech_tables->have_light_levels[pt][0]) {
+            int varid;
+            if ((rv = nc_inq_varid(ncid, "shade", &varid))) {
+               NCERR("shade", rv);
+            }
+            if ((rv = nc_get_var_double(ncid, varid, &data->mech_tables->light_levels[pt][0][0]))) {
+               NCERR("shade", rv);
+            }
+            data->mech_tables->have_light_levels[pt][0] = 1;
+         }
+         if ((rv = nc_inq_varid(ncid, "tf", &tf_id))) {
+            NCERR("tf", rv);
+         }
+         for (size_t v=0; v<4; v++) {
+            if ((rv = nc_inq_varid(ncid, names[v], &varids[v]))) {
+               NCERR(names[v], rv);
+            }
+         }
+      }
+
+      // sites are in grid order, so each row is read once
+      size_t first = 0;
+      while (first < fp->n_sites) {
+         size_t y = fp->sites[first]->sdata->y_;
+         size_t last = first;
+         while ((last < fp->n_sites) && (fp->sites[last]->sdata->y_ == y)) last++;
+
+         size_t index1[3] = { data->start_lat + y, data->start_lon, 0 };
+         size_t count1[3] = { 1, data->n_lon, N_CLIMATE };
+         size_t index2[4] = { data->start_lat + y, data->start_lon, 0, 0 };
+         size_t count2[4] = { 1, data->n_lon, N_CLIMATE, N_LIGHT };
+         {
+            std::lock_guard<std::mutex> lock(netcdf_mutex);
+            if ((rv = nc_get_vara_double(ncid, tf_id, index1, count1, tf_row))) {
+               NCERR("tf", rv);
+            }
+         }
+         for (size_t i=first; i<last; i++) {
+            memcpy(&fy->tf[fp->slot[i]][pt][0], &tf_row[fp->sites[i]->sdata->x_ * N_CLIMATE],
+                   N_CLIMATE * sizeof(double));
+         }
+
+         for (size_t v=0; v<4; v++) {
+            {
+               std::lock_guard<std::mutex> lock(netcdf_mutex);
+               if ((rv = NC_GET_VARA_MECH(ncid, varids[v], index2, count2, row))) {
+                  NCERR(names[v], rv);
+               }
+            }
+            for (size_t i=first; i<last; i++) {
+               size_t k = fp->slot[i];
+               mech_tables* t = &fy->mech[k / NUM_Vm0s];
+               mech_table* var = (v == 0) ? t->An : (v == 1) ? t->Anb : (v == 2) ? t->E : t->Eb;
+               memcpy(&site_table(var, k)[pt][0][0][0], &row[fp->sites[i]->sdata->x_ * table_len],
+                      table_len * sizeof(mech_real));
+            }
+         }
+         first = last;
+      }
+
+      std::lock_guard<std::mutex> lock(netcdf_mutex);
+      nc_close(ncid);
+   }
+
+   free(row);
+   free(tf_row);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//! read_forcing_year
+//! Fill a year buffer from the files of the year. Runs on the reader thread
+//! for all years but the first.
+//!
+//! @param  fp   pipeline
+//! @param  fy   year to fill, year and year_string set
+//! @param  data Userdata structure
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+static void read_forcing_year (forcing_pipeline* fp, forcing_year* fy, UserData* data) {
+   char filename[256];
+   year_file_name(filename, data->climate_file, fy, data);
+   {
+      int rv, ncid;
+      std::lock_guard<std::mutex> lock(netcdf_mutex);
+      if ((rv = nc_open(filename, NC_NOWRITE, &ncid))) {
+         NCERR(filename, rv);
+      }
+      read_climate_layers(ncid, data, fy->precip, fy->temp, fy->soil_temp);
+      nc_close(ncid);
+   }
+#if !FTS
+   read_mech_year(fp, fy, data);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! start_read_ahead
+//! Start the reader on the year after the front one, unless the run ends first
+//!
+//! @param  fp   pipeline
+//! @param  data Userdata structure
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+static void start_read_ahead (forcing_pipeline* fp, UserData* data) {
+   if (fp->model_year >= fp->last_year) return;
+
+   forcing_year* fy = fp->back;
+   fy->year = fp->front->year + 1;
+   fy->year_string[0] = '\0';
+   if (data->m_string) {
+      next_year_string(fp, fy->year_string);
+   }
+   fp->reader = std::thread(read_forcing_year, fp, fy, data);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! apply_site_year
+//! Point one site at a year: new monthly climate, pet and dryness, and the
+//! mechanism tables of the year.
+//!
+//! @param  fy   year
+//! @param  cs   site
+//! @param  i    site list index of cs
+//! @param  data Userdata structure
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+static void apply_site_year (forcing_year* fy, site* cs, size_t i, UserData* data) {
+   SiteData* sdata = cs->sdata;
+   // a cell without data this year keeps last year's climate
+   if (sdata->loadClimate(fy->precip, fy->temp, fy->soil_temp, data->n_lon)) {
+      sdata->calcClimateIndices(*data);
+   }
+#if !FTS
+   mech_tables* t = &fy->mech[i / NUM_Vm0s];
+   sdata->An  = site_table(t->An, i);
+   sdata->E   = site_table(t->E, i);
+   sdata->Anb = site_table(t->Anb, i);
+   sdata->Eb  = site_table(t->Eb, i);
+   for (size_t pt=0; pt<PT; pt++) {
+      memcpy(sdata->tf[pt][0], fy->tf[i][pt], sizeof(fy->tf[i][pt]));
+   }
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! apply_forcing_year
+//! Point every site at the front year. Sites are split over the arenas as
+//! in community_dynamics, so each arena touches its own sites.
+//!
+//! @param  fp   pipeline
+//! @param  data Userdata structure
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+static void apply_forcing_year (forcing_pipeline* fp, UserData* data) {
+   forcing_year* fy = fp->front;
+#if GCD || TBB
+   site** site_arr = data->site_arr;
+   run_site_parts(data->sched, fp->n_sites, [&] (size_t begin, size_t end) {
+      for (size_t i=begin; i<end; i++) {
+         apply_site_year(fy, site_arr[i], i, data);
+      }
+   });
+#else
+   size_t i = 0;
+   for (site* cs=data->first_site; cs!=NULL; cs=cs->next_site) {
+      apply_site_year(fy, cs, i++, data);
+   }
+#endif
+
+   data->mechanism_year = fy->year;
+   strcpy(data->mech_year_string, fy->year_string);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! create_forcing
+//! Set up the pipeline and pick the year of the first files, before the
+//! input layers are read. Returns NULL unless do_yearly_mech is on.
+//!
+//! @param  data Userdata structure
+//! @return new pipeline or NULL
+////////////////////////////////////////////////////////////////////////////////
+forcing_pipeline* create_forcing (UserData* data) {
+   if (! data->do_yearly_mech) {
+      return NULL;
+   }
+#if !FTS
+   if (data->num_Vm0 > 1) {
+      // only bin 0 is read from the yearly files
+      fprintf(stderr, "create_forcing: do_yearly_mech needs num_Vm0s = 1\n");
+      exit(1);
+   }
+#endif
+
+   forcing_pipeline* fp = new forcing_pipeline;
+   fp->front      = NULL;
+   fp->back       = NULL;
+   fp->n_sites    = 0;
+   fp->sites      = NULL;
+   fp->slot       = NULL;
+   fp->model_year = data->start_time / N_CLIMATE;
+   fp->last_year  = ((int)(data->tmax * N_SUB)) / N_CLIMATE;
+   fp->year_list  = NULL;
+   fp->n_swaps    = 0;
+   fp->wait_sum   = 0.0;
+   fp->wait_max   = 0.0;
+
+   data->mechanism_year = FORCING_FIRST_YEAR + fp->model_year;
+   data->mech_year_string[0] = '\0';
+   if (data->m_string) {
+      if ((fp->year_list = fopen(FORCING_YEAR_LIST, "r")) == NULL) {
+         fprintf(stderr, "create_forcing: cannot open year list %s\n", FORCING_YEAR_LIST);
+         exit(1);
+      }
+      next_year_string(fp, data->mech_year_string);
+   }
+   printf("Mechanism_year_to use: %d %s\n", data->mechanism_year, data->mech_year_string);
+   return fp;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! start_forcing
+//! Take over the first year's climate layers from read_environmental_layers,
+//! read its mechanism tables, attach them to the sites and start reading
+//! the second year. Call once data->site_arr is set up, before
+//! free_environmental_layers.
+//!
+//! @param  fp         pipeline
+//! @param  first_site head of the site list
+//! @param  data       Userdata structure
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void start_forcing (forcing_pipeline* fp, site* first_site, UserData* data) {
+   for (site* cs=first_site; cs!=NULL; cs=cs->next_site) {
+      fp->n_sites++;
+   }
+   fp->sites = (site**) malloc(fp->n_sites * sizeof(site*));
+   fp->slot = (size_t*) malloc(fp->n_sites * sizeof(size_t));
+   if ((fp->n_sites > 0) && ((fp->sites == NULL) || (fp->slot == NULL))) {
+      fprintf(stderr, "start_forcing: out of memory\n");
+      exit(1);
+   }
+   std::vector<site*> list;
+   for (site* cs=first_site; cs!=NULL; cs=cs->next_site) {
+      fp->slot[list.size()] = list.size();
+      list.push_back(cs);
+   }
+   std::sort(fp->slot, fp->slot + fp->n_sites, [&] (size_t a, size_t b) {
+      const SiteData* sa = list[a]->sdata;
+      const SiteData* sb = list[b]->sdata;
+      return (sa->y_ < sb->y_) || ((sa->y_ == sb->y_) && (sa->x_ < sb->x_));
+   });
+   for (size_t i=0; i<fp->n_sites; i++) {
+      fp->sites[i] = list[fp->slot[i]];
+   }
+
+   fp->front = alloc_forcing_year(fp, data);
+   fp->back  = alloc_forcing_year(fp, data);
+
+   // the climate of the first year is already loaded
+   forcing_year* fy = fp->front;
+   fy->year = data->mechanism_year;
+   strcpy(fy->year_string, data->mech_year_string);
+   std::swap(fy->precip, data->precip_layer);
+   std::swap(fy->temp, data->temp_layer);
+   std::swap(fy->soil_temp, data->soil_temp_layer);
+#if !FTS
+   read_mech_year(fp, fy, data);
+#endif
+   apply_forcing_year(fp, data);
+
+   start_read_ahead(fp, data);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! advance_forcing
+//! Move the sites on to the next year at a year boundary. The reader has
+//! normally finished long before, so this is a pointer swap and a pass over
+//! the sites; the time spent waiting on the reader is recorded.
+//!
+//! @param  fp   pipeline
+//! @param  data Userdata structure
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void advance_forcing (forcing_pipeline* fp, UserData* data) {
+   if (! fp->reader.joinable()) return; // past the last year
+
+   std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+   fp->reader.join();
+   double wait = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+   fp->wait_sum += wait;
+   if (wait > fp->wait_max) fp->wait_max = wait;
+   fp->n_swaps++;
+
+   std::swap(fp->front, fp->back);
+   fp->model_year++;
+   apply_forcing_year(fp, data);
+   printf("Mechanism_year_to use: %d %s\n", data->mechanism_year, data->mech_year_string);
+
+   start_read_ahead(fp, data);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! free_forcing
+//! Wait for any read in flight and release the pipeline
+//!
+//! @param  pfp pipeline, set to NULL; may point to NULL
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void free_forcing (forcing_pipeline** pfp) {
+   forcing_pipeline* fp = *pfp;
+   if (fp == NULL) return;
+
+   if (fp->reader.joinable()) {
+      fp->reader.join();
+   }
+   if (fp->n_swaps > 0) {
+      printf("Forcing: %lu years read ahead, waited %.3f s in total, max %.3f s\n",
+             fp->n_swaps, fp->wait_sum, fp->wait_max);
+   }
+   free_forcing_year(fp->front);
+   free_forcing_year(fp->back);
+   free(fp->sites);
+   free(fp->slot);
+   if (fp->year_list != NULL) {
+      fclose(fp->year_list);
+   }
+   delete fp;
+   *pfp = NULL;
+}
@@ -0,0 +1,67 @@
+#ifndef EDM_FORCING_H_
+#define EDM_FORCING_H_
+
+#include <cstddef>
+#include <cstdio>
+#include <thread>
+
+#include "edmodels.h"
+
+struct site;
+struct mech_tables;
+
+////////////////////////////////////////
+//    Typedef: forcing_year
+//    Climate and mechanism tables of
+//    all sites for one year
+////////////////////////////////////////
+struct forcing_year {
+   int year;                  ///< year of the files (m_int)
+   char year_string[256];     ///< year of the files (m_string)
+   double** precip;           ///< [N_CLIMATE][n_lat*n_lon]
+   double** temp;             ///< [N_CLIMATE][n_lat*n_lon]
+   double** soil_temp;        ///< [N_CLIMATE][n_lat*n_lon]
+#if !FTS
+   mech_tables* mech;         ///< bin 0 tables, NUM_Vm0s sites per element, see site_table
+   double (*tf)[PT][N_CLIMATE]; ///< [n_sites] bin 0 temperature function
+#endif
+};
+
+////////////////////////////////////////
+//    Typedef: forcing_pipeline
+//    Yearly forcing for do_yearly_mech.
+//    While the sites run the front year,
+//    a reader thread loads the next year
+//    into the back buffer; at the year
+//    boundary the two are swapped and
+//    the sites pointed at the new front.
+//    See forcing.cc
+////////////////////////////////////////
+struct forcing_pipeline {
+   forcing_year* front;       ///< year being simulated
+   forcing_year* back;        ///< year being read ahead
+   std::thread reader;        ///< fills back, joinable while a read is in flight
+
+   size_t n_sites;
+   site** sites;              ///< sites in grid order, for reading by rows
+   size_t* slot;              ///< [n_sites] site list (and site_arr) index of sites[i]
+   int model_year;            ///< model year held by front
+   int last_year;             ///< last model year of the run
+   FILE* year_list;           ///< list of year strings (m_string)
+
+   // diagnostics
+   unsigned long n_swaps;
+   double wait_sum;           ///< time the model waited on the reader (s)
+   double wait_max;
+};
+
+
+////////////////////////////////////////
+//    Function Prototypes
+////////////////////////////////////////
+forcing_pipeline* create_forcing (UserData* data);
+void start_forcing (forcing_pipeline* fp, site* first_site, UserData* data);
+void advance_forcing (forcing_pipeline* fp, UserData* data);
+void free_forcing (forcing_pipeline** pfp);
+
+#endif // EDM_FORCING_H_
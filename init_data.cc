@@ -1,8 +1,12 @@
 #include <cmath>
+#include <cstring>
 
 #include "edmodels.h"
 #include "readconfiguration.h"
 #include "netcdf.h"
+#ifdef ED
+#include "mech_store.h"
+#endif
 
 #define QSW 3900.0 /* sapwood area to leaf area ratio (dimensionless m2 leaf/m2 sapwood) */ 
 void init_mech_table (UserData* data);
@@ -231,6 +235,7 @@ void init_data (const char* cfgFile, UserData* data) {
       /* data->qsw[i]= 0.05; */
       //printf("spp %d  qsw = %f \n", i, data->qsw[i]);     
    } /* end loop over species */ 
+   init_allometry(data);
      
    /* ratio of above gnd stem to total stem (stem plus structural roots) */
    data->agf_bs                               = get_val<double>(data, PARAMS, "", "agf_bs");
@@ -241,11 +246,26 @@ void init_data (const char* cfgFile, UserData* data) {
    data->climate_file_ncid                    = 0; 
    data->soil_file_ncid                       = 0;
    data->lu_file_ncid                         = 0; 
+   data->lu_first_year                        = 0;
+   data->lu_n_years                           = 0;
 #ifdef ED
    for(int k=0; k<NUM_Vm0s; k++) {
       data->mech_c3_file_ncid[k]              = 0;
       data->mech_c4_file_ncid[k]              = 0;
    }
+   data->soil_depth_layer                     = NULL; /* read with the grid */
+   data->theta_max_layer                      = NULL;
+   data->k_sat_layer                          = NULL;
+   data->tau_layer                            = NULL;
+   data->precip_layer                         = NULL;
+   data->temp_layer                           = NULL;
+   data->soil_temp_layer                      = NULL;
+   data->mech_tables                          = create_mech_store();
+#if !FTS
+   if (strlen(data->mech_cache_file) > 0) {
+      open_mech_cache(data->mech_tables, data->mech_cache_file, data);
+   }
+#endif
 #endif
 #if FTS
    init_mech_table(data);
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <cstdlib>
+#include <algorithm>
 #include "netcdf.h"
 #include "edmodels.h"
 #include "site.h"
@@ -163,29 +164,118 @@ char lu2charname (int lu) {
 }
 
 
+// years of transition rates read per hyperslab in read_transition_rates
+#define LU_READ_YEARS 16
+// cells of the sites' bounding box per site above which each site is read
+// on its own instead
+#define LU_SPARSE_CELLS 64
+
+////////////////////////////////////////
+//    Typedef: lu_read_box
+//    Part of the region holding the
+//    sites, read by read_lu_rate
+////////////////////////////////////////
+struct lu_read_box {
+   size_t y0, x0;   ///< first row and column, region coordinates
+   size_t n_y, n_x;
+   bool per_site;   ///< sites are sparse in the box, read each on its own
+};
+
 ////////////////////////////////////////////////////////////////////////////////
-//! read_transition_rates
-//! 
+//! read_lu_rate
+//! Read one transition variable for years [first, first+n) over the box of
+//! the sites, or site by site, and store it into field (an offset into
+//! landuse_rates) of every site
 //!
 //! @param  
 //! @return 
 ////////////////////////////////////////////////////////////////////////////////
-int read_transition_rates (site** current_site, UserData* data) {
-   int rv, ncid, varid, dlu, tlu, i;
-   char dn, tn;
-   char varname[10];
+static void read_lu_rate (int ncid, const char* varname, size_t field, 
+                          size_t first, size_t n, double* buf, const lu_read_box* box,
+                          site** sites, size_t n_sites, UserData* data) {
+   int rv, varid;
    size_t index[3], count[3];
-   double factor;
-
-   site* cs = *current_site;
+   size_t ncells = box->n_y * box->n_x;
+
+   if ((rv = nc_inq_varid(ncid, varname, &varid)))
+      NCERR(varname, rv);
+
+   index[0] = first;
+   count[0] = n;
+   if (box->per_site) {
+      count[1] = 1;
+      count[2] = 1;
+      for (size_t s=0; s<n_sites; s++) {
+         SiteData* sdata = sites[s]->sdata;
+         index[1] = data->start_lat + sdata->y_;
+         index[2] = data->start_lon + sdata->x_;
+         if ((rv = nc_get_vara_double(ncid, varid, index, count, buf)))
+            NCERR(varname, rv);
+         for (size_t i=0; i<n; i++) {
+            landuse_rates* rates = &sdata->lu_rates[first + i - data->lu_first_year];
+            *(double*)((char*)rates + field) = buf[i];
+         }
+      }
+      return;
+   }
 
-   index[0] = 0;
-   index[1] = cs->sdata->globY_;
-   index[2] = cs->sdata->globX_;
+   index[1] = data->start_lat + box->y0;
+   index[2] = data->start_lon + box->x0;
+   count[1] = box->n_y;
+   count[2] = box->n_x;
+   if ((rv = nc_get_vara_double(ncid, varid, index, count, buf)))
+      NCERR(varname, rv);
+
+   for (size_t s=0; s<n_sites; s++) {
+      SiteData* sdata = sites[s]->sdata;
+      size_t cell = (sdata->y_ - box->y0) * box->n_x + (sdata->x_ - box->x0);
+      for (size_t i=0; i<n; i++) {
+         landuse_rates* rates = &sdata->lu_rates[first + i - data->lu_first_year];
+         *(double*)((char*)rates + field) = buf[i * ncells + cell];
+      }
+   }
+}
 
-   count[0] = N_LANDUSE_YEARS;
-   count[1] = 1;
-   count[2] = 1;
+////////////////////////////////////////////////////////////////////////////////
+//! read_transition_rates
+//! Read the landuse transition and harvest rates of all sites, for the
+//! simulated years only: from the (restart) start year to tmax, clipped to
+//! the landuse record. Each variable is read LU_READ_YEARS years per
+//! hyperslab over the bounding box of the sites, or site by site, all years
+//! in one hyperslab, when the sites cover little of their box.
+//!
+//! @param  sites   sites to fill, after their restart has been read
+//! @param  n_sites number of sites
+//! @param  data    Userdata structure
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+int read_transition_rates (site** sites, size_t n_sites, UserData* data) {
+   int rv, ncid, dlu, tlu;
+   char dn, tn;
+   char varname[10];
+   landuse_rates layout;
+   /* byte offset of a rate within landuse_rates */
+#define LU_FIELD(f) ((size_t)((char*)&layout.f - (char*)&layout))
+
+   /* year window, see landuse_dynamics for the year used each step */
+   size_t first_year = data->start_time / N_CLIMATE;
+   size_t last_year = (size_t)((int)(data->tmax * N_SUB)) / N_CLIMATE;
+   if (first_year > N_LANDUSE_YEARS - 1) first_year = N_LANDUSE_YEARS - 1;
+   if (last_year > N_LANDUSE_YEARS - 1) last_year = N_LANDUSE_YEARS - 1;
+   if (last_year < first_year) last_year = first_year;
+   data->lu_first_year = first_year;
+   data->lu_n_years = last_year - first_year + 1;
+   printf("read_transition_rates: years %lu-%lu of %d\n", (unsigned long)first_year,
+          (unsigned long)last_year, N_LANDUSE_YEARS);
+
+   for (size_t s=0; s<n_sites; s++) {
+      SiteData* sdata = sites[s]->sdata;
+      sdata->lu_rates = (landuse_rates*) malloc(data->lu_n_years * sizeof(landuse_rates));
+      if (sdata->lu_rates == NULL) {
+         fprintf(stderr, "read_transition_rates: out of memory\n");
+         exit(1);
+      }
+   }
 
    if (data->lu_file_ncid == 0) {
       if ((rv = nc_open(data->lu_file, NC_NOWRITE, &ncid)))
@@ -195,56 +285,80 @@ int read_transition_rates (site** current_site, UserData* data) {
       ncid = data->lu_file_ncid;
    }
 
-   for (dlu=0; dlu<N_LANDUSE_TYPES; dlu++) {
-      for (tlu=1; tlu<N_LANDUSE_TYPES; tlu++) {
-         /* skip transitions self->self and v->s (v->s dealt with in sbh/vbh) */
-         if ((dlu != tlu) && !( (dlu == LU_NTRL) && (tlu == LU_SCND) ) ) { 
-            if ((dn = lu2charname(dlu)) && (tn = lu2charname(tlu))) {
-               sprintf(varname, "gfl%c%c", dn, tn);
-               if ((rv = nc_inq_varid(ncid, varname, &varid)))
-                  NCERR(varname, rv);
-               if ((rv = nc_get_vara_double(ncid, varid, index, count, 
-                                            &(cs->sdata->beta[dlu][tlu-1][0]))))
-                  NCERR(varname, rv);
+   /* bounding box of the sites */
+   lu_read_box box;
+   box.y0 = data->n_lat;
+   box.x0 = data->n_lon;
+   size_t y1 = 0, x1 = 0;
+   for (size_t s=0; s<n_sites; s++) {
+      SiteData* sdata = sites[s]->sdata;
+      box.y0 = std::min(box.y0, sdata->y_);
+      box.x0 = std::min(box.x0, sdata->x_);
+      y1 = std::max(y1, sdata->y_ + 1);
+      x1 = std::max(x1, sdata->x_ + 1);
+   }
+   box.n_y = (y1 > box.y0) ? y1 - box.y0 : 0;
+   box.n_x = (x1 > box.x0) ? x1 - box.x0 : 0;
+   box.per_site = (box.n_y * box.n_x > LU_SPARSE_CELLS * n_sites);
+   size_t buf_cells = box.per_site ? 1 : std::max(box.n_y * box.n_x, (size_t)1);
+   /* a lone site's whole window is small, read it in one hyperslab */
+   size_t chunk_years = box.per_site ? data->lu_n_years : LU_READ_YEARS;
+
+   double* buf = (double*) malloc(chunk_years * buf_cells * sizeof(double));
+   if (buf == NULL) {
+      fprintf(stderr, "read_transition_rates: out of memory\n");
+      exit(1);
+   }
+
+   for (size_t first=first_year; first<=last_year; first+=chunk_years) {
+      size_t n = last_year + 1 - first;
+      if (n > chunk_years) n = chunk_years;
+
+      for (dlu=0; dlu<N_LANDUSE_TYPES; dlu++) {
+         for (tlu=1; tlu<N_LANDUSE_TYPES; tlu++) {
+            /* skip transitions self->self and v->s (v->s dealt with in sbh/vbh) */
+            if ((dlu != tlu) && !( (dlu == LU_NTRL) && (tlu == LU_SCND) ) ) { 
+               if ((dn = lu2charname(dlu)) && (tn = lu2charname(tlu))) {
+                  sprintf(varname, "gfl%c%c", dn, tn);
+                  read_lu_rate(ncid, varname, LU_FIELD(beta[dlu][tlu-1]),
+                               first, n, buf, &box, sites, n_sites, data);
+               }
             }
          }
       }
-   }
-
-   for (dlu=0; dlu<N_VBH_TYPES; dlu++) {
-      sprintf(varname, "gfvh%d", dlu+1);
-      if ((rv = nc_inq_varid(ncid, varname, &varid)))
-         NCERR(varname, rv);
 
-      if ((rv = nc_get_vara_double(ncid, varid, index, count, 
-                                   &(cs->sdata->vbh[dlu][0]))))
-         NCERR(varname, rv);
-   }
-
-   for (dlu=0; dlu<N_SBH_TYPES; dlu++) {
-      sprintf(varname, "gfsh%d", dlu+1);
-      if ((rv = nc_inq_varid(ncid, varname, &varid)))
-         NCERR(varname, rv);
+      for (dlu=0; dlu<N_VBH_TYPES; dlu++) {
+         sprintf(varname, "gfvh%d", dlu+1);
+         read_lu_rate(ncid, varname, LU_FIELD(vbh[dlu]),
+                      first, n, buf, &box, sites, n_sites, data);
+      }
 
-      if ((rv = nc_get_vara_double(ncid, varid, index, count, 
-                                   &(cs->sdata->sbh[dlu][0]))))
-         NCERR(varname, rv);
+      for (dlu=0; dlu<N_SBH_TYPES; dlu++) {
+         sprintf(varname, "gfsh%d", dlu+1);
+         read_lu_rate(ncid, varname, LU_FIELD(sbh[dlu]),
+                      first, n, buf, &box, sites, n_sites, data);
+      }
    }
+   free(buf);
+#undef LU_FIELD
 
    /*re-normalize from fraction of grid cell area to fraction of the land area*/
-   if (cs->sdata->grid_cell_area_total != cs->sdata->grid_cell_area) {
-      factor = cs->sdata->grid_cell_area_total / cs->sdata->grid_cell_area;
-      for (dlu=0; dlu<N_LANDUSE_TYPES; dlu++)
-         for (tlu=0; tlu<N_LANDUSE_TYPES-1; tlu++) 
-            for (i=0; i<N_LANDUSE_YEARS; i++) 
-               cs->sdata->beta[dlu][tlu][i] *= factor;
-      for (dlu=0; dlu<N_VBH_TYPES; dlu++)
-         for (i=0; i<N_LANDUSE_YEARS; i++) 
-            cs->sdata->vbh[dlu][i] *= factor;
-      for (dlu=0; dlu<N_SBH_TYPES; dlu++)
-         for (i=0; i<N_LANDUSE_YEARS; i++) 
-            cs->sdata->sbh[dlu][i] *= factor;      
-   } 
+   for (size_t s=0; s<n_sites; s++) {
+      SiteData* sdata = sites[s]->sdata;
+      if (sdata->grid_cell_area_total != sdata->grid_cell_area) {
+         double factor = sdata->grid_cell_area_total / sdata->grid_cell_area;
+         for (size_t i=0; i<data->lu_n_years; i++) {
+            landuse_rates* rates = &sdata->lu_rates[i];
+            for (dlu=0; dlu<N_LANDUSE_TYPES; dlu++)
+               for (tlu=0; tlu<N_LANDUSE_TYPES-1; tlu++) 
+                  rates->beta[dlu][tlu] *= factor;
+            for (dlu=0; dlu<N_VBH_TYPES; dlu++)
+               rates->vbh[dlu] *= factor;
+            for (dlu=0; dlu<N_SBH_TYPES; dlu++)
+               rates->sbh[dlu] *= factor;      
+         }
+      } 
+   }
 
 #if 0
    /* TODO: this needs to be adjusted to use the multi-D lutype indexed arrays - justin */
@@ -438,6 +552,18 @@ void landuse_dynamics (unsigned int t, site** siteptr, UserData* data) {
          /* TODO: probably not the right assumption for all transitions. -justin */
          lu_year = N_LANDUSE_YEARS-1;
       }
+      /* only the simulated years are held, see read_transition_rates */
+      if ((data->lu_n_years == 0) || (currents->sdata->lu_rates == NULL)) {
+         fprintf(stderr, "landuse_dynamics: no landuse rates read for site %s\n",
+                 currents->sdata->name_);
+         exit(1);
+      }
+      if (lu_year < data->lu_first_year) {
+         lu_year = data->lu_first_year;
+      } else if (lu_year >= data->lu_first_year + data->lu_n_years) {
+         lu_year = data->lu_first_year + data->lu_n_years - 1;
+      }
+      const landuse_rates* rates = &currents->sdata->lu_rates[lu_year - data->lu_first_year];
 
       /************************************************/
       /*****            lu transistions            ****/
@@ -447,7 +573,7 @@ void landuse_dynamics (unsigned int t, site** siteptr, UserData* data) {
             if (tlu != dlu) {
                /* v2s will be dealt with in harvesting. skip */
                if ( !((dlu == LU_NTRL) && (tlu == LU_SCND)) ) {
-                  double beta = currents->sdata->beta[dlu][tlu-1][lu_year];
+                  double beta = rates->beta[dlu][tlu-1];
                   landuse_transition(&currents, data, dlu, tlu, beta);
                }
             }
@@ -456,10 +582,10 @@ void landuse_dynamics (unsigned int t, site** siteptr, UserData* data) {
 
 #if 1
       for (int i=0; i<N_VBH_TYPES; i++) {
-         cut_forest(&currents, data, LU_NTRL, currents->sdata->vbh[i][lu_year], i);
+         cut_forest(&currents, data, LU_NTRL, rates->vbh[i], i);
       }
       for (int i=0; i<N_SBH_TYPES; i++) {
-         cut_forest(&currents, data, LU_SCND, currents->sdata->sbh[i][lu_year], i);
+         cut_forest(&currents, data, LU_SCND, rates->sbh[i], i);
       }
 #endif
 
@@ -518,14 +644,14 @@ void landuse_dynamics (unsigned int t, site** siteptr, UserData* data) {
             cohort* currentc = currents->new_patch[lu]->shortest;
             while (currentc != NULL) {
                cohort* tmpc = currentc->taller;
-               free(currentc);
+               pool_free(&currents->cohort_pool, currentc);
                currentc = tmpc;
             }
 #endif
             if (lu == LU_SCND) {
-               free(currents->new_patch[lu]->phistory);
+               pool_free(&currents->phistory_pool, currents->new_patch[lu]->phistory);
             }
-            free(currents->new_patch[lu]);
+            pool_free(&currents->patch_pool, currents->new_patch[lu]);
          }
       }
    }
@@ -944,9 +1070,9 @@ void print_landuse (unsigned int time, site** siteptr, UserData* data) {
 
    FILE *outfile;
    if (time == 0) { 
-      outfile = fopen(filename, "w");
+      outfile = soi_open(cs->soi_out, filename, "w");
    } else {
-      outfile = fopen(filename, "a");
+      outfile = soi_open(cs->soi_out, filename, "a");
    }
    /* print to files */
    fprintf(outfile, 
@@ -959,7 +1085,7 @@ void print_landuse (unsigned int time, site** siteptr, UserData* data) {
            (cs->area_fraction[LU_NTRL] + cs->area_fraction[LU_CROP]
             + cs->area_fraction[LU_PAST] + cs->area_fraction[LU_SCND]));
   
-   fclose(outfile);
+   soi_close(cs->soi_out, outfile);
 }
 
 
@@ -6,7 +6,7 @@
 /* function prototypes */
 void read_initial_landuse_fractions (UserData* data);
 void read_initial_landuse_c (UserData* data);
-int read_transition_rates (site** first_site, UserData* data);
+int read_transition_rates (site** sites, size_t n_sites, UserData* data);
 
 void init_landuse_patches (site** siteptr, UserData* data);
 void landuse_dynamics (unsigned int t, site** siteptr, UserData* data);
@@ -10,9 +10,11 @@
 #if GCD
 #include <dispatch/dispatch.h> 
 #elif TBB
-#include "tbb/task_scheduler_init.h"
+#include <algorithm>
+#include <atomic>
 #include "tbb/parallel_for.h"
 #include "tbb/blocked_range.h"
+#include "tbb/tick_count.h"
 #endif
 #ifdef USEMPI
 #include "mpi.h"
@@ -24,6 +26,13 @@
 #include "read_site_data.h"
 #include "print_output.h"
 #include "readconfiguration.h"
+#include "ed_log.h"
+#include "state_dump.h"
+#include "site_sched.h"
+#ifdef ED
+#include "mech_store.h"
+#include "forcing.h"
+#endif
 
 time_t seconds;           /* time variable for rnd seeding */
 long intdum;              /* random no. seed */
@@ -38,24 +47,136 @@ using namespace std;
 #if TBB
 using namespace tbb;
 
+////////////////////////////////////////////////////////////////////////////////
+//! update_one_site
+//! Advance one site a step, recording its cost for the next step's schedule.
+//! SOI files are written from the site's own task, so the step needs no
+//! serial pass over the site list afterwards. Each SOI writes only files
+//! named after itself.
+//!
+//! @param  
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+static void update_one_site (unsigned int t, double t1, double t2, site** cs, 
+                             int print_soi, UserData* data) {
+   tick_count start = tick_count::now();
+   community_dynamics(t, t1, t2, cs, data); 
+   update_site(cs, data); 
+   if (print_soi && (*cs)->sdata->soi) {
+      print_soi_files(t, cs, data);
+   }
+   (*cs)->step_cost = (tick_count::now() - start).seconds();
+}
+
 class UpdateSites {
    site** const my_site_arr;
    unsigned int t;
    double t1;
    double t2;
+   int print_soi;
    UserData *data;
  public:
    void operator() ( const blocked_range<size_t>& r ) const {
       site** site_arr = my_site_arr;
       for (size_t i=r.begin(); i!=r.end(); ++i) {
-         community_dynamics(t, t1, t2, &(site_arr[i]), data); 
-         update_site(&(site_arr[i]), data); 
+         update_one_site(t, t1, t2, &(site_arr[i]), print_soi, data);
+      }
+   }
+   UpdateSites (site* site_arr[], unsigned int t, double t1, double t2, int print_soi,
+                UserData *data) 
+      : my_site_arr(site_arr), t(t), t1(t1), t2(t2), print_soi(print_soi), data(data)
+   {}
+};
+
+// Each task claims the next chunk of grain sites from a shared cursor over
+// site_order, so chunks start in order of cost whichever worker runs or
+// steals the task, and the cheap sites fill in the tail.
+class UpdateSitesByCost {
+   site** const my_site_arr;
+   const size_t* my_order;
+   std::atomic<size_t>* my_next;
+   size_t n;
+   size_t grain;
+   unsigned int t;
+   double t1;
+   double t2;
+   int print_soi;
+   UserData *data;
+ public:
+   void operator() ( const blocked_range<size_t>& r ) const {
+      for (size_t c=r.begin(); c!=r.end(); ++c) {
+         size_t first = my_next->fetch_add(grain);
+         size_t last  = (first + grain < n) ? first + grain : n;
+         for (size_t i=first; i<last; i++) {
+            update_one_site(t, t1, t2, &(my_site_arr[my_order[i]]), print_soi, data);
+         }
       }
    }
-   UpdateSites (site* site_arr[], unsigned int t, double t1, double t2, UserData *data) 
-      : my_site_arr(site_arr), t(t), t1(t1), t2(t2), data(data)
+   UpdateSitesByCost (site* site_arr[], const size_t* order, std::atomic<size_t>* next,
+                      size_t n, size_t grain, unsigned int t, double t1, double t2, 
+                      int print_soi, UserData *data) 
+      : my_site_arr(site_arr), my_order(order), my_next(next), n(n), grain(grain), 
+        t(t), t1(t1), t2(t2), print_soi(print_soi), data(data)
    {}
 };
+
+// orders site_arr indices by decreasing cost, ties in grid order
+struct SiteCostGreater {
+   site** site_arr;
+   bool operator() (size_t a, size_t b) const {
+      if (site_arr[a]->step_cost != site_arr[b]->step_cost) {
+         return site_arr[a]->step_cost > site_arr[b]->step_cost;
+      }
+      return a < b;
+   }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//! update_sites_parallel
+//! Advance all sites one step with TBB, each arena's part of site_arr in
+//! that arena (see site_sched.cc). With cost_scheduling the sites of a part
+//! are started most expensive first, using the cost measured on the
+//! previous step. Sites are independent, so the order does not change
+//! results.
+//!
+//! @param  t         time step
+//! @param  t1        start of step (yrs)
+//! @param  t2        end of step (yrs)
+//! @param  print_soi write SOI files after each site's step
+//! @param  data      Userdata structure
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+static void update_sites_parallel (unsigned int t, double t1, double t2, int print_soi,
+                                   UserData& data) {
+   tick_count start = tick_count::now();
+   size_t n = data.number_of_sites;
+   size_t grain = (data.site_grain > 0) ? data.site_grain : 1;
+
+   if (data.cost_scheduling) {
+      run_site_parts(data.sched, n, [&] (size_t begin, size_t end) {
+         size_t* order = data.site_order + begin;
+         size_t n_part = end - begin;
+         std::atomic<size_t> next(0);
+         size_t n_chunks = (n_part + grain - 1) / grain;
+         parallel_for(blocked_range<size_t>(0, n_chunks, 1), 
+                      UpdateSitesByCost(data.site_arr, order, &next, n_part, grain, 
+                                        t, t1, t2, print_soi, &data),
+                      simple_partitioner());
+         SiteCostGreater greater = { data.site_arr };
+         std::sort(order, order + n_part, greater);
+      });
+   } else {
+      run_site_parts(data.sched, n, [&] (size_t begin, size_t end) {
+         parallel_for(blocked_range<size_t>(begin, end, grain), 
+                      UpdateSites(data.site_arr, t, t1, t2, print_soi, &data) );
+      });
+   }
+
+   double elapsed = (tick_count::now() - start).seconds();
+   data.step_time_sum += elapsed;
+   if (elapsed > data.step_time_max) data.step_time_max = elapsed;
+   data.n_steps_timed++;
+}
 #endif
 
 
@@ -67,9 +188,6 @@ class UpdateSites {
 //! @return 
 ////////////////////////////////////////////////////////////////////////////////
 UserData* ed_initialize (char* expName, const char* cfgFile) {
-   /* Below added to supply yearly lists */
-   FILE *namefile;
-
    /* allocate data storage structure */
    //UserData* data = (UserData*) malloc(sizeof *data);  /* Allocate data memory */
    struct UserData* data = new UserData;
@@ -86,19 +204,28 @@ UserData* ed_initialize (char* expName, const char* cfgFile) {
 
    setup_dirs(*data, expName);
 
+   data->sched = create_site_sched(data);
+
+   /* a run from time 0 starts new logs, only a restart continues them */
+   data->cd_log = NULL;
+   data->fp_log = NULL;
+   if (data->cd_file) {
+      string cd_name = string(data->base_filename) + ".cd";
+      data->cd_log = open_log_stream(cd_name.c_str(), data->long_cd_file && data->restart);
+   }
+   if (data->fp_file) {
+      string fp_name = string(data->base_filename) + ".fp";
+      data->fp_log = open_log_stream(fp_name.c_str(), data->long_fp_file && data->restart);
+   }
+
 #if COUPLED
    data->sitelist_copy = NULL;
 #endif
 
    /* initialize site structures */
-   if(data->do_yearly_mech) {
-   data->mechanism_year = 1901;  /*  Added to allow initial mech year  */
-      if(data->m_string) {
-         /* Added to read list of years we want */
-         namefile = fopen("/Network/Xgrid/data/MSTMIP/model_driver/cru_ncep/file_lists/fl1.txt","r");
-         fscanf(namefile,"%s",data->mech_year_string);
-      }
-   }
+#ifdef ED
+   data->forcing = create_forcing(data); // picks the first year of do_yearly_mech
+#endif
 
    read_input_data_layers(data);
 
@@ -111,12 +238,18 @@ UserData* ed_initialize (char* expName, const char* cfgFile) {
       data->restartWriter = new Restart(restartDir + "/RESTART/");
       //data->restartWriter = new Restart("/tmp/");
    }
-   if (data->restart && data->new_restart_read) {
+   // only one restart format is read, the binary one takes precedence over the db
+   data->restartReader = NULL;
+   data->blobReader = NULL;
+   if (data->restart && data->blob_restart_read && ! data->old_restart_read) {
+      data->blobReader = open_blob_restart(data->restart_dir, data);
+   } else if (data->restart && data->new_restart_read) {
       data->restartReader = new Restart(data->restart_dir);
    }
 
    site* first_site = NULL;
    init_sites(&first_site, data);
+   close_blob_restart(&data->blobReader);
 
    data->first_site = first_site;
 
@@ -126,26 +259,40 @@ UserData* ed_initialize (char* expName, const char* cfgFile) {
       exit(0);
    }
 
-   if(data->print_output_files) {
-      print_initial(first_site, data);
-   }
-
-#if TBB
-   task_scheduler_init init;
-#endif
-
 #if GCD || TBB 
    // TODO: this should replace site list
    data->site_arr = (struct site**) malloc (data->number_of_sites 
                                             * sizeof(struct site*));
                                     
+   data->site_order = (size_t*) malloc (data->number_of_sites * sizeof(size_t));
+                                    
    site *siteptr = data->first_site;
    for (size_t i=0; i<data->number_of_sites; i++) {
       data->site_arr[i] = siteptr;
+      data->site_order[i] = i;
       siteptr = siteptr->next_site;
    }
+   data->step_time_sum = 0.0;
+   data->step_time_max = 0.0;
+   data->n_steps_timed = 0;
+   data->step_latency_sum = 0.0;
+   data->step_latency_max = 0.0;
+   data->output_time_sum = 0.0;
+#endif
+
+#ifdef ED
+   // after site_arr, which the forcing uses to attach each year
+   if (data->forcing != NULL) {
+      start_forcing(data->forcing, first_site, data);
+   }
+   free_environmental_layers(data);
+   print_mech_store(stdout, data->mech_tables);
 #endif
 
+   if(data->print_output_files) {
+      print_initial(first_site, data);
+   }
+
 #ifdef COUPLED
    data->lastTotalC = 0.0;
    site *cs = first_site;
@@ -166,6 +313,8 @@ UserData* ed_initialize (char* expName, const char* cfgFile) {
 //! @return 
 ////////////////////////////////////////////////////////////////////////////////
 void ed_finalize(UserData& data) {
+   data.outputter->flush(); // region records still queued for the writer
+   finish_state_dump();
    printf("Problematic Sites:\n");
    int count1 = 0, count2 = 0;
    site* current_site = data.first_site;
@@ -178,6 +327,36 @@ void ed_finalize(UserData& data) {
       current_site = current_site->next_site;
    }
    printf("Skipped %d out of %d sites\n", count1, count2);
+   // compare integrator = 0 and 1 on the same run
+   unsigned long long n_calls = 0;
+   for (site* cs=data.first_site; cs!=NULL; cs=cs->next_site) {
+      n_calls += cs->function_calls;
+   }
+   printf("Derivative evaluations: %llu (integrator %d)\n", n_calls, data.integrator);
+#if TBB
+   if (data.n_steps_timed > 0) {
+      printf("Site loop: %lu steps, mean %.3f s, max %.3f s per step\n", data.n_steps_timed,
+             data.step_time_sum / data.n_steps_timed, data.step_time_max);
+      // compare runs with print_output_files on and off to see what output costs
+      printf("Time step latency: mean %.3f s, max %.3f s, region output %.3f s per step "
+             "(print_output_files %d)\n", data.step_latency_sum / data.n_steps_timed,
+             data.step_latency_max, data.output_time_sum / data.n_steps_timed,
+             data.print_output_files);
+   }
+#endif
+   print_site_pool_counts(data.first_site);
+   close_soi_files(data.first_site);
+#ifdef ED
+   free_cohort_arrays(data.first_site);
+#endif
+   close_log_stream(&data.cd_log);
+   close_log_stream(&data.fp_log);
+#ifdef ED
+   free_forcing(&data.forcing);
+#endif
+   delete data.outputter; // syncs and closes the region file
+   data.outputter = NULL;
+   free_site_sched(&data.sched);
    printf("*** Program Complete ***\n");
 
    // Free up all used memory
@@ -293,6 +472,9 @@ void model (UserData& data) {
    unsigned int tsteps = ((int)(data.tmax * N_SUB)) + 1;
 
    for (unsigned int t=data.start_time; t<tsteps; t++) { /* absolute time offset */
+#if TBB
+      tick_count step_start = tick_count::now();
+#endif
 
       if(data.print_output_files) {
           if (tsteps-t<106*N_SUB+1)
@@ -300,6 +482,9 @@ void model (UserData& data) {
               print_region_files(t,&data.first_site,&data);
           }
       }
+#if TBB
+      data.output_time_sum += (tick_count::now() - step_start).seconds();
+#endif
 
       double t1 = t * TIMESTEP;
       double t2 = (t + 1) * TIMESTEP;
@@ -319,10 +504,15 @@ void model (UserData& data) {
       if ( (t > 0) && (t%data.print_ss_freq == 0) ) {
          if (data.old_restart_write) {
             print_system_states(t, data.first_site, &data);
+         } else if (data.blob_restart_write) {
+            write_blob_restart(data.first_site, data.year, &data);
          } else if (data.new_restart_write) {
             data.restartWriter->storeStates(data.first_site, data.year);
          }
       }
+      if ( (data.state_dump_freq > 0) && (t%data.state_dump_freq == 0) ) {
+         write_state_dump(t, data.first_site, &data);
+      }
 
       data.time_period = ((int) rint(t1 * N_CLIMATE)) % N_CLIMATE;
 #if USEMPI
@@ -346,76 +536,40 @@ void model (UserData& data) {
          }
       }
 
-      // do_yearly_mech is deprecated in favor of FTS
-#if 0
-      FILE *namefile;
-      if(data.do_yearly_mech) {
-          if(data.m_int) {
-             if (t > 0 && t%12 == 0) {
-                ncclose(data.mech_c3_file_ncid);
-                ncclose(data.mech_c4_file_ncid);
-                ncclose(data.climate_file_ncid);
-                data.mech_c3_file_ncid =0;
-                data.mech_c4_file_ncid =0;
-                data.climate_file_ncid =0;
-                data.mechanism_year = 1901+t1;
-                printf("Mechanism_year_to use: %d\n" , data.mechanism_year);
-                site* siteptr = data.first_site;
-                while (siteptr != NULL) {
-                   /* Now we have to read the site data again */
-                   siteptr->sdata->readSiteData(data); 
-                   siteptr = siteptr->next_site;
-                }    
-             }
-          }
-
-          if(data.m_string) {
-             if (t > 0 && t%12 == 0) {
-                ncclose(data.mech_c3_file_ncid);
-                ncclose(data.mech_c4_file_ncid);
-                ncclose(data.climate_file_ncid);
-                data.mech_c3_file_ncid =0;
-                data.mech_c4_file_ncid =0;
-                data.climate_file_ncid =0;
-                fscanf(namefile,"%s",data.mech_year_string);
-                printf("Mechanism_year_to use: %s\n" , data.mech_year_string);
-                if (strlen(data.mech_year_string)!= 4){
-                   fclose(namefile);
-                   namefile = fopen("/Network/Xgrid/data/MSTMIP/model_driver/cru_ncep/file_lists/fl1.txt","r");
-                   fscanf(namefile,"%s",data.mech_year_string);
-                   printf("Mechanism_year_to use: %s\n" , data.mech_year_string);
-                }
-                site* siteptr = data.first_site;
-                while (siteptr != NULL) {
-                   /* Now we have to read the site data again */
-                   siteptr->sdata->readSiteData(data); 
-                   siteptr = siteptr->next_site;
-                }    
-             }
-          }
+#ifdef ED
+      // next year's climate and mechanism tables were read while this one ran
+      if ((data.forcing != NULL) && (t > (unsigned int)data.start_time) && (t % N_CLIMATE == 0)) {
+         advance_forcing(data.forcing, &data);
       }
 #endif
 #if GCD 
       dispatch_apply(data.number_of_sites, dispatch_get_global_queue(0,0), ^(size_t i) { 
          community_dynamics(t, t1, t2, &(site_arr[i]), &data); 
          update_site(&(site_arr[i]), &data); 
+         // each site only writes its own SOI files, as with TBB
+         if(data.print_output_files) {
+            print_soi_files(t, &(site_arr[i]), &data);
+         }
       }); 
 #elif TBB
-      parallel_for(blocked_range<size_t>(0,data.number_of_sites,100), 
-                   UpdateSites(data.site_arr, t, t1, t2, &data) );
-#endif
+      update_sites_parallel(t, t1, t2, data.print_output_files, data);
+#else
       site* siteptr = data.first_site;
       while (siteptr != NULL) {
-#if !GCD && !TBB
          community_dynamics(t, t1, t2, &siteptr, &data);
          update_site(&siteptr, &data);
-#endif
          
          if(data.print_output_files) {
             print_soi_files(t, &siteptr, &data);
          }
          siteptr = siteptr->next_site;
       }
+#endif
+#if TBB
+      double latency = (tick_count::now() - step_start).seconds();
+      data.step_latency_sum += latency;
+      if (latency > data.step_latency_max) data.step_latency_max = latency;
+#endif
    }
 }
 
@@ -467,22 +621,24 @@ void ed_step (int year, UserData& data) {
       dispatch_apply(data.number_of_sites, dispatch_get_global_queue(0,0), ^(size_t i) { 
          community_dynamics(t, t1, t2, &(data.site_arr[i]), &data); 
          update_site(&(data.site_arr[i]), &data); 
+#if PRINT_OUTPUT_FILES
+         // each site only writes its own SOI files, as with TBB
+         print_soi_files(t, &(data.site_arr[i]), &data);
+#endif
       }); 
 #elif TBB
-      parallel_for(blocked_range<size_t>(0,data.number_of_sites,100), 
-                   UpdateSites(data.site_arr, t, t1, t2, &data) );
-#endif
+      update_sites_parallel(t, t1, t2, PRINT_OUTPUT_FILES, data);
+#else
       site* siteptr = data.first_site;
       while (siteptr != NULL) {
-#if !GCD && !TBB
          community_dynamics(t, t1, t2, &siteptr, &data);
          update_site(&siteptr, &data);
-#endif
 #if PRINT_OUTPUT_FILES
          print_soi_files(t, &siteptr, &data);
 #endif
          siteptr = siteptr->next_site;
       }
+#endif
 
 #if PRINT_OUTPUT_FILES          
       print_region_files(t,&(data.first_site),&data);
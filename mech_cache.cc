@@ -0,0 +1,134 @@
+/* mechcache: offline converter from the mechanism netcdf files to a  *
+ * binary, site indexed cache that readMechanismLUT can mmap. Reads   *
+ * the same configuration as edlu and writes the tables of every site *
+ * the model would run (see model_site).                              */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "edmodels.h"
+#include "site.h"
+#include "read_site_data.h"
+#include "mech_store.h"
+
+#define ROUND_UP(n, a) ((((n) + (a) - 1) / (a)) * (a))
+
+////////////////////////////////////////////////////////////////////////////////
+//! write_at
+//! 
+//!
+//! @param  f      cache file
+//! @param  offset byte offset to write at
+//! @param  buf    data
+//! @param  size   bytes to write
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+static void write_at (FILE* f, uint64_t offset, const void* buf, size_t size) {
+   if (fseeko(f, offset, SEEK_SET) != 0 || fwrite(buf, 1, size, f) != size) {
+      fprintf(stderr, "mechcache: write failed\n");
+      exit(1);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! main
+//! 
+//!
+//! @param  
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+int main (int ac, char *av[]) {
+
+   if (ac == 1) {
+      fprintf(stderr, "Usage: %s cache-file [config-file-name]\n", av[0]);
+      return 1;
+   }
+
+   UserData* data = new UserData;
+   if (ac > 2) {
+      init_data(av[2], data);
+   } else {
+      init_data(NULL, data);
+   }
+   // yearly tables are attached per year by the forcing reader, not per site
+   if (data->do_yearly_mech) {
+      fprintf(stderr, "mechcache: do_yearly_mech is not supported\n");
+      exit(1);
+   }
+   read_input_data_layers(data);
+
+   // always convert from the netcdf files, even if a cache is configured
+   free_mech_store(&data->mech_tables);
+   data->mech_tables = create_mech_store();
+
+   FILE* f = fopen(av[1], "wb");
+   if (f == NULL) {
+      fprintf(stderr, "mechcache: can't open %s\n", av[1]);
+      exit(1);
+   }
+
+   mech_cache_header hdr;
+   memset(&hdr, 0, sizeof(hdr));
+   strncpy(hdr.magic, MECH_CACHE_MAGIC, sizeof(hdr.magic));
+   hdr.pt           = PT;
+   hdr.num_vm0s     = NUM_Vm0s;
+   hdr.n_climate    = N_CLIMATE;
+   hdr.n_light      = N_LIGHT;
+   hdr.real_size    = sizeof(mech_real);
+   hdr.num_Vm0      = data->num_Vm0;
+   hdr.start_lat    = data->start_lat;
+   hdr.start_lon    = data->start_lon;
+   hdr.n_lat        = data->n_lat;
+   hdr.n_lon        = data->n_lon;
+   strncpy(hdr.which_mech, data->which_mech_to_use, sizeof(hdr.which_mech));
+   if (strlen(data->which_mech_to_use) >= sizeof(hdr.which_mech)
+       || mech_cache_sources(hdr.sources, sizeof(hdr.sources), data) != 0) {
+      fprintf(stderr, "mechcache: mechanism names too long for the cache header\n");
+      exit(1);
+   }
+   hdr.n_blocks     = 0;
+   hdr.block_size   = ROUND_UP(sizeof(mech_cache_block), MECH_CACHE_ALIGN);
+   hdr.index_offset = ROUND_UP(sizeof(mech_cache_header), MECH_CACHE_ALIGN);
+   hdr.data_offset  = ROUND_UP(hdr.index_offset + hdr.n_lat * hdr.n_lon * sizeof(int64_t),
+                               MECH_CACHE_ALIGN);
+
+   int64_t* index = (int64_t*) malloc(hdr.n_lat * hdr.n_lon * sizeof(int64_t));
+   mech_cache_block* block = (mech_cache_block*) calloc(1, hdr.block_size);
+   if (index == NULL || block == NULL) {
+      fprintf(stderr, "mechcache: out of memory\n");
+      exit(1);
+   }
+
+   size_t counter = 0;
+   for (size_t y=0; y<data->n_lat; y++) {
+      for (size_t x=0; x<data->n_lon; x++) {
+         index[y * data->n_lon + x] = -1;
+         counter++;
+         if (! model_site(y, x, counter, data)) continue;
+
+         SiteData* sdata = new SiteData(y, x, *data);
+         if (sdata->readSiteData(*data)) {
+            block->t = *sdata->mech_slot_;
+            memcpy(block->tf, sdata->tf, sizeof(block->tf));
+            write_at(f, hdr.data_offset + hdr.n_blocks * hdr.block_size, 
+                     block, hdr.block_size);
+            index[y * data->n_lon + x] = hdr.n_blocks++;
+         }
+         sdata->releaseMechanismLUT(*data);
+         delete sdata;
+      }
+   }
+
+   memcpy(hdr.light_levels, data->mech_tables->light_levels, sizeof(hdr.light_levels));
+   write_at(f, hdr.index_offset, index, hdr.n_lat * hdr.n_lon * sizeof(int64_t));
+   write_at(f, 0, &hdr, sizeof(hdr));
+   fclose(f);
+
+   printf("mechcache: wrote %lu sites to %s (%lu MB)\n", (unsigned long)hdr.n_blocks, av[1],
+          (unsigned long)((hdr.data_offset + hdr.n_blocks * hdr.block_size) >> 20));
+
+   free(index);
+   free(block);
+   return 0;
+}
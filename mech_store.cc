@@ -0,0 +1,226 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mech_store.h"
+
+// site tables per arena slab, about 17MB per slab in double precision
+#define MECH_SLAB_SITES 64
+
+////////////////////////////////////////////////////////////////////////////////
+//! create_mech_store
+//! Allocate an empty store. Tables are read per site in readMechanismLUT.
+//!
+//! @param  
+//! @return new store
+////////////////////////////////////////////////////////////////////////////////
+mech_store* create_mech_store () {
+   mech_store* store = (mech_store*) malloc(sizeof(mech_store));
+   if (store == NULL) {
+      fprintf(stderr, "create_mech_store: out of memory\n");
+      exit(1);
+   }
+
+   for (size_t pt=0; pt<PT; pt++) {
+      for (size_t i=0; i<NUM_Vm0s; i++) {
+         store->have_light_levels[pt][i] = 0;
+      }
+   }
+#if !FTS
+   init_pool(&store->tables, sizeof(mech_tables), MECH_SLAB_SITES);
+   store->cache_map   = NULL;
+   store->cache_size  = 0;
+   store->cache       = NULL;
+   store->cache_index = NULL;
+#endif
+   return store;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! free_mech_store
+//! Release the store and every site's tables. SiteData pointing into it
+//! become invalid.
+//!
+//! @param  pstore store to free, set to NULL
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void free_mech_store (mech_store** pstore) {
+   mech_store* store = *pstore;
+   if (store == NULL) return;
+#if !FTS
+   free_pool(&store->tables);
+   if (store->cache_map != NULL) {
+      munmap(store->cache_map, store->cache_size);
+   }
+#endif
+   free(store);
+   *pstore = NULL;
+}
+
+#if !FTS
+////////////////////////////////////////////////////////////////////////////////
+//! alloc_mech_tables
+//! Take the tables for one site out of the arena
+//!
+//! @param  store mechanism table store
+//! @return tables, contents undefined
+////////////////////////////////////////////////////////////////////////////////
+mech_tables* alloc_mech_tables (mech_store* store) {
+   return (mech_tables*) pool_alloc(&store->tables);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! free_mech_tables
+//! Return a site's tables to the arena
+//!
+//! @param  store  mechanism table store
+//! @param  tables tables from alloc_mech_tables
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void free_mech_tables (mech_store* store, mech_tables* tables) {
+   pool_free(&store->tables, tables);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! mech_cache_sources
+//! Names of the mechanism files readMechanismLUT reads, C3 and C4 of each
+//! Vm0 bin, one per line. Kept in a cache header to tell which files the
+//! cache was converted from.
+//!
+//! @param  buf  names, NUL terminated
+//! @param  size bytes in buf
+//! @param  data Userdata structure
+//! @return 0, or 1 if the names did not fit
+////////////////////////////////////////////////////////////////////////////////
+int mech_cache_sources (char* buf, size_t size, const UserData* data) {
+   size_t n = 0;
+   buf[0] = '\0';
+   for (size_t i=0; i<data->num_Vm0; i++) {
+      int len;
+      if (data->num_Vm0 > 1) {
+         len = snprintf(buf + n, size - n, "%s%s\n%s%s\n", 
+                        data->Vm0_basepath, data->list_c3_files.at(i).c_str(),
+                        data->Vm0_basepath, data->list_c4_files.at(i).c_str());
+      } else {
+         len = snprintf(buf + n, size - n, "%s\n%s\n", data->mech_c3_file, data->mech_c4_file);
+      }
+      if (len < 0 || (size_t)len >= size - n) return 1;
+      n += len;
+   }
+   return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! open_mech_cache
+//! Map a cache file written by mechcache. The mapping is read-only and
+//! shared, so pages are loaded on first use and are shared by every run
+//! on the node using the same file. The shade grid is taken from the
+//! header. A cache written for another build, configuration or set of
+//! mechanism files is not used, the tables are then read from netcdf.
+//!
+//! @param  store    mechanism table store
+//! @param  filename cache file
+//! @param  data     Userdata structure
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void open_mech_cache (mech_store* store, const char* filename, UserData* data) {
+   int fd = open(filename, O_RDONLY);
+   if (fd < 0) {
+      fprintf(stderr, "open_mech_cache: can't open %s\n", filename);
+      exit(1);
+   }
+   struct stat st;
+   if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(mech_cache_header)) {
+      fprintf(stderr, "open_mech_cache: %s is not a mechanism cache\n", filename);
+      exit(1);
+   }
+   void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED) {
+      fprintf(stderr, "open_mech_cache: can't map %s\n", filename);
+      exit(1);
+   }
+
+   const mech_cache_header* hdr = (const mech_cache_header*) map;
+   if (strncmp(hdr->magic, MECH_CACHE_MAGIC, sizeof(hdr->magic)) != 0
+       || hdr->pt != PT || hdr->num_vm0s != NUM_Vm0s 
+       || hdr->n_climate != N_CLIMATE || hdr->n_light != N_LIGHT
+       || hdr->real_size != sizeof(mech_real) || hdr->num_Vm0 != data->num_Vm0
+       || hdr->block_size < sizeof(mech_cache_block)
+       || hdr->data_offset + hdr->n_blocks * hdr->block_size > (uint64_t)st.st_size) {
+      fprintf(stderr, "open_mech_cache: %s does not match this build or configuration, "
+              "reading the mechanism files\n", filename);
+      munmap(map, st.st_size);
+      return;
+   }
+
+   char sources[MECH_CACHE_SOURCES];
+   if (strncmp(hdr->which_mech, data->which_mech_to_use, sizeof(hdr->which_mech)) != 0
+       || mech_cache_sources(sources, sizeof(sources), data) != 0
+       || strncmp(hdr->sources, sources, sizeof(hdr->sources)) != 0) {
+      fprintf(stderr, "open_mech_cache: %s was not written from %s mechanism files, "
+              "reading the mechanism files\n", filename, data->which_mech_to_use);
+      munmap(map, st.st_size);
+      return;
+   }
+
+   store->cache_map   = (char*) map;
+   store->cache_size  = st.st_size;
+   store->cache       = hdr;
+   store->cache_index = (const int64_t*) (store->cache_map + hdr->index_offset);
+
+   memcpy(store->light_levels, hdr->light_levels, sizeof(store->light_levels));
+   for (size_t pt=0; pt<PT; pt++) {
+      for (size_t i=0; i<data->num_Vm0; i++) {
+         store->have_light_levels[pt][i] = 1;
+      }
+   }
+   printf("mechanism cache: %s, %lu sites\n", filename, (unsigned long)hdr->n_blocks);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! find_mech_cache_block
+//! 
+//!
+//! @param  store mechanism table store
+//! @param  globY global row of the site
+//! @param  globX global column of the site
+//! @return the site's block, or NULL if there is no cache or the site isn't in it
+////////////////////////////////////////////////////////////////////////////////
+const mech_cache_block* find_mech_cache_block (const mech_store* store, 
+                                               size_t globY, size_t globX) {
+   const mech_cache_header* hdr = store->cache;
+   if (hdr == NULL) return NULL;
+   if (globY < hdr->start_lat || globY >= hdr->start_lat + hdr->n_lat) return NULL;
+   if (globX < hdr->start_lon || globX >= hdr->start_lon + hdr->n_lon) return NULL;
+
+   int64_t b = store->cache_index[(globY - hdr->start_lat) * hdr->n_lon + (globX - hdr->start_lon)];
+   if (b < 0) return NULL;
+   return (const mech_cache_block*) (store->cache_map + hdr->data_offset + b * hdr->block_size);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//! print_mech_store
+//! Report the memory held by the store against what per-site copies of
+//! the tables and shade grid would take
+//!
+//! @param  outfile stream to print to
+//! @param  store   mechanism table store
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void print_mech_store (FILE* outfile, const mech_store* store) {
+#if !FTS
+   const mem_pool* pool = &store->tables;
+   unsigned long held = pool->n_slabs * pool->slab_objects * pool->object_size
+      + sizeof(mech_store);
+   unsigned long copies = pool->in_use 
+      * (4 * PT * NUM_Vm0s * N_CLIMATE * N_LIGHT + PT * NUM_Vm0s * N_LIGHT) * sizeof(double);
+   fprintf(outfile, "mechanism tables: %lu sites, %lu kB (%lu kB as per-site copies)\n",
+           pool->in_use, held / 1024, copies / 1024);
+#endif
+}
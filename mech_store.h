@@ -0,0 +1,107 @@
+#ifndef EDM_MECH_STORE_H_
+#define EDM_MECH_STORE_H_
+
+#include <stdint.h>
+
+#include "edmodels.h"
+#include "mempool.h"
+
+#define MECH_CACHE_MAGIC "EDMECH2"
+#define MECH_CACHE_ALIGN 4096 ///< alignment of header, index and site blocks in a cache file
+#define MECH_CACHE_NAME 64      ///< bytes kept of which_mech_to_use
+#define MECH_CACHE_SOURCES 3072 ///< bytes kept of the mechanism file names
+
+#if !FTS
+////////////////////////////////////////
+//    Typedef: mech_tables
+//    Potential photosynthesis and
+//    transpiration tables of one site
+////////////////////////////////////////
+struct mech_tables {
+   mech_real An[PT][NUM_Vm0s][N_CLIMATE][N_LIGHT];  ///< pot. net photosynthesis (gC/(m2 mo)) 
+   mech_real E[PT][NUM_Vm0s][N_CLIMATE][N_LIGHT];   ///< potential transpitation (gW/(m2 mo))
+   mech_real Anb[PT][NUM_Vm0s][N_CLIMATE][N_LIGHT]; ///< pot. psyn when shut (g/(m2 mo))
+   mech_real Eb[PT][NUM_Vm0s][N_CLIMATE][N_LIGHT];  ///< pot. transp when shut (gW/(m2 mo)) 
+};
+
+////////////////////////////////////////
+//    Typedef: mech_cache_block
+//    Everything readMechanismLUT reads
+//    for one site, as laid out in a
+//    cache file
+////////////////////////////////////////
+struct mech_cache_block {
+   mech_tables t;
+   double tf[PT][NUM_Vm0s][N_CLIMATE];
+};
+
+////////////////////////////////////////
+//    Typedef: mech_cache_header
+//    Start of a mechanism cache file.
+//    Followed at index_offset by one
+//    int64 per cell of the grid
+//    (block number or -1), and at
+//    data_offset by the site blocks,
+//    each block_size bytes.
+////////////////////////////////////////
+struct mech_cache_header {
+   char magic[8];
+   uint32_t pt;
+   uint32_t num_vm0s;
+   uint32_t n_climate;
+   uint32_t n_light;
+   uint32_t real_size;      ///< sizeof(mech_real) when written
+   uint32_t num_Vm0;        ///< Vm0 bins actually read
+   uint64_t start_lat;      ///< global row of the first grid row
+   uint64_t start_lon;      ///< global column of the first grid column
+   uint64_t n_lat;
+   uint64_t n_lon;
+   uint64_t n_blocks;
+   uint64_t block_size;
+   uint64_t index_offset;
+   uint64_t data_offset;
+   double light_levels[PT][NUM_Vm0s][N_LIGHT];
+   char which_mech[MECH_CACHE_NAME];   ///< which_mech_to_use when written
+   char sources[MECH_CACHE_SOURCES];   ///< mechanism files read, see mech_cache_sources
+};
+#endif
+
+////////////////////////////////////////
+//    Typedef: mech_store
+//    Mechanism lookup tables of all
+//    sites. The shade grid is the same
+//    everywhere and is held once, the
+//    per-site tables are carved out of
+//    one arena instead of living in
+//    each SiteData.
+////////////////////////////////////////
+struct mech_store {
+   double light_levels[PT][NUM_Vm0s][N_LIGHT]; ///< shade grid of the mechanism files
+   int have_light_levels[PT][NUM_Vm0s];        ///< 1 once the grid has been read
+#if !FTS
+   mem_pool tables;                            ///< arena of per-site mech_tables
+
+   // optional memory mapped cache file, see mechcache
+   char* cache_map;                            ///< mapping of the whole file, NULL if none
+   size_t cache_size;
+   const mech_cache_header* cache;
+   const int64_t* cache_index;
+#endif
+};
+
+
+////////////////////////////////////////
+//    Function Prototypes
+////////////////////////////////////////
+mech_store* create_mech_store ();
+void free_mech_store (mech_store** pstore);
+#if !FTS
+mech_tables* alloc_mech_tables (mech_store* store);
+void free_mech_tables (mech_store* store, mech_tables* tables);
+int mech_cache_sources (char* buf, size_t size, const UserData* data);
+void open_mech_cache (mech_store* store, const char* filename, UserData* data);
+const mech_cache_block* find_mech_cache_block (const mech_store* store, size_t globY, size_t globX);
+#endif
+void print_mech_store (FILE* outfile, const mech_store* store);
+
+#endif // EDM_MECH_STORE_H_
@@ -54,6 +54,51 @@ void cohort::plant_respiration(UserData* data){
 
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//! set_light_index
+//! Find the mechanism table light bin for the cohort's light level, i.e. the
+//! first entry of the (descending) shade grid at or below lite. Binary search
+//! so understory cohorts don't scan the whole grid. Needs Vm0_bin.
+//!
+//! @param  data Userdata structure
+//! @return Nothing, updates light_index and light_weight
+////////////////////////////////////////////////////////////////////////////////
+void cohort::set_light_index(UserData* data){
+
+   const double* levels = siteptr->sdata->light_levels[pt][Vm0_bin];
+
+   size_t lo = 0;
+   size_t hi = N_LIGHT-1;
+   if (levels[hi] > lite) {
+      lo = hi; /* darker than the grid, use the last bin */
+   } else {
+      while (lo < hi) {
+         size_t mid = (lo + hi) / 2;
+         if (levels[mid] > lite) lo = mid + 1;
+         else hi = mid;
+      }
+   }
+   light_index = lo;
+
+   light_weight = 1.0;
+   if (data->light_interpolation and light_index > 0 
+       and levels[light_index] < lite and levels[light_index-1] > levels[light_index]) {
+      light_weight = (levels[light_index-1] - lite) / (levels[light_index-1] - levels[light_index]);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! light_lut
+//! Look up a mechanism table row at the cohort's light level
+//!
+//! @param  table row of N_LIGHT values for the cohort's pt, Vm0_bin and time
+//! @return table value at light_index, interpolated if light_interpolation is on
+////////////////////////////////////////////////////////////////////////////////
+double cohort::light_lut(const mech_real* table){
+   if (light_weight == 1.0) return table[light_index];
+   return table[light_index-1] + light_weight * (table[light_index] - table[light_index-1]);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //! npp_function
 //! 
@@ -69,17 +114,13 @@ void cohort::npp_function(UserData* data){
  
    /*driver index index*/
    size_t time_index = data->time_period;
-   get_cohort_vm0(data);
-   Vm0_bin= get_cohort_vm0_bin(Vm0, data);
+   /* Vm0 and Vm0_bin are set for the patch by canopy_vm0 in f() */
       
    /* RESPIRATION */
    plant_respiration(data);
   
    /*SET INDICIES*/
-   size_t light_index = 0;
-      while(cs->sdata->light_levels[pt][Vm0_bin][light_index] > lite){
-      light_index++;
-   }
+   /* light_index is set for the patch by canopy_vm0 in f() */
    /*PHOTOSYNTHESIS**************************/
    
 #if FTS
@@ -89,7 +130,7 @@ void cohort::npp_function(UserData* data){
    An_shut_max = 0.001*cs->An_shut[pt][120];
 #else
    //calc potential and max photosynthesis (KgC/m2/mon) 
-   An_pot = 0.001*cs->sdata->An[pt][Vm0_bin][time_index][light_index];
+   An_pot = 0.001*light_lut(cs->sdata->An[pt][Vm0_bin][time_index]);
    An_max = 0.001*cs->sdata->An[pt][Vm0_bin][time_index][0];  // TODO, should we use current Vm0_bin or 0
    //4/24/00 dowregulation idea, note Anb[120] below 
    An_shut = 0.001*cs->sdata->Anb[pt][Vm0_bin][time_index][N_LIGHT-1];
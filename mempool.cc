@@ -0,0 +1,152 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "mempool.h"
+
+// alignment of objects within a slab, enough for doubles and pointers
+#define POOL_ALIGN 16
+
+////////////////////////////////////////////////////////////////////////////////
+//! init_pool
+//! Set up an empty pool. No memory is requested until the first allocation.
+//!
+//! @param  pool         pool to initialize
+//! @param  object_size  size of the objects served by the pool
+//! @param  slab_objects number of objects requested from the heap at a time
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void init_pool (mem_pool* pool, size_t object_size, size_t slab_objects) {
+   if (object_size < sizeof(void*)) object_size = sizeof(void*);
+   pool->object_size  = (object_size + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN;
+   pool->slab_objects = (slab_objects > 0) ? slab_objects : 1;
+   pool->free_list    = NULL;
+   pool->slabs        = NULL;
+   pool->n_allocs     = 0;
+   pool->n_frees      = 0;
+   pool->in_use       = 0;
+   pool->peak         = 0;
+   pool->n_slabs      = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! pool_alloc
+//! Take one object from the pool, adding a new slab if the free list is empty.
+//! Contents of the object are undefined, as with malloc.
+//!
+//! @param  pool pool to allocate from
+//! @return pointer to object
+////////////////////////////////////////////////////////////////////////////////
+void* pool_alloc (mem_pool* pool) {
+   if (pool->free_list == NULL) {
+      // first POOL_ALIGN bytes of each slab link it into the slab list
+      char* slab = (char*) malloc(POOL_ALIGN + pool->slab_objects * pool->object_size);
+      if (slab == NULL) {
+         fprintf(stderr, "pool_alloc: out of memory\n");
+         exit(1);
+      }
+      *(void**)slab = pool->slabs;
+      pool->slabs = slab;
+      pool->n_slabs++;
+
+      // thread the new objects onto the free list in address order
+      char* obj = slab + POOL_ALIGN;
+      for (size_t i=0; i<pool->slab_objects; i++) {
+         char* next = (i+1 < pool->slab_objects) ? obj + pool->object_size : NULL;
+         *(void**)obj = next;
+         obj += pool->object_size;
+      }
+      pool->free_list = slab + POOL_ALIGN;
+   }
+
+   void* obj = pool->free_list;
+   pool->free_list = *(void**)obj;
+
+   pool->n_allocs++;
+   pool->in_use++;
+   if (pool->in_use > pool->peak) pool->peak = pool->in_use;
+   return obj;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! pool_calloc
+//! As pool_alloc, but the object is zeroed
+//!
+//! @param  pool pool to allocate from
+//! @return pointer to object
+////////////////////////////////////////////////////////////////////////////////
+void* pool_calloc (mem_pool* pool) {
+   void* obj = pool_alloc(pool);
+   memset(obj, 0, pool->object_size);
+   return obj;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! pool_free
+//! Return an object to the pool it was allocated from
+//!
+//! @param  pool pool the object came from
+//! @param  obj  object to release, may be NULL
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void pool_free (mem_pool* pool, void* obj) {
+   if (obj == NULL) return;
+   *(void**)obj = pool->free_list;
+   pool->free_list = obj;
+   pool->n_frees++;
+   pool->in_use--;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! free_pool
+//! Release all slabs of a pool back to the heap. Any objects still in use
+//! become invalid.
+//!
+//! @param  pool pool to empty
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void free_pool (mem_pool* pool) {
+   void* slab = pool->slabs;
+   while (slab != NULL) {
+      void* next = *(void**)slab;
+      free(slab);
+      slab = next;
+   }
+   pool->slabs = NULL;
+   pool->free_list = NULL;
+   pool->in_use = 0;
+   pool->n_slabs = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! add_pool_counts
+//! Accumulate the diagnostic counters of a pool, e.g. to sum over sites
+//!
+//! @param  total pool receiving the sums (only counters are used)
+//! @param  pool  pool to add
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void add_pool_counts (mem_pool* total, const mem_pool* pool) {
+   total->object_size  = pool->object_size;
+   total->slab_objects = pool->slab_objects;
+   total->n_allocs   += pool->n_allocs;
+   total->n_frees    += pool->n_frees;
+   total->in_use     += pool->in_use;
+   total->peak       += pool->peak;
+   total->n_slabs    += pool->n_slabs;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! print_pool_counts
+//!
+//!
+//! @param  outfile stream to print to
+//! @param  name    label for the pool
+//! @param  pool    pool whose counters are printed
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void print_pool_counts (FILE* outfile, const char* name, const mem_pool* pool) {
+   fprintf(outfile, "%-10s allocs %lu frees %lu in use %lu peak %lu slabs %lu (%lu kB)\n",
+           name, pool->n_allocs, pool->n_frees, pool->in_use, pool->peak, pool->n_slabs,
+           (unsigned long)(pool->n_slabs * pool->slab_objects * pool->object_size / 1024));
+}
@@ -0,0 +1,41 @@
+#ifndef EDM_MEMPOOL_H_
+#define EDM_MEMPOOL_H_
+
+#include <cstddef>
+#include <cstdio>
+
+////////////////////////////////////////
+//    Typedef: mem_pool
+//    Fixed-size object allocator. Objects
+//    are carved out of slabs and recycled
+//    through a free list, so a site's
+//    patches and cohorts never go back
+//    to the global heap while it runs.
+////////////////////////////////////////
+struct mem_pool {
+   size_t object_size;    ///< bytes per object, rounded up for alignment
+   size_t slab_objects;   ///< number of objects in each slab
+   void* free_list;       ///< singly linked list of free objects
+   void* slabs;           ///< singly linked list of slabs
+
+   // diagnostics
+   unsigned long n_allocs; ///< objects handed out
+   unsigned long n_frees;  ///< objects returned
+   unsigned long in_use;   ///< objects currently live
+   unsigned long peak;     ///< high-water mark of in_use
+   unsigned long n_slabs;  ///< slabs obtained from the heap
+};
+
+
+////////////////////////////////////////
+//    Function Prototypes
+////////////////////////////////////////
+void init_pool (mem_pool* pool, size_t object_size, size_t slab_objects);
+void* pool_alloc (mem_pool* pool);
+void* pool_calloc (mem_pool* pool);
+void pool_free (mem_pool* pool, void* obj);
+void free_pool (mem_pool* pool);
+void add_pool_counts (mem_pool* total, const mem_pool* pool);
+void print_pool_counts (FILE* outfile, const char* name, const mem_pool* pool);
+
+#endif // EDM_MEMPOOL_H_
@@ -11,8 +11,17 @@
 #include "patch.h"
 #include "read_site_data.h"
 #include "cohort.h"
+#include "cohort_soa.h"
 
 static void f(double t, void *f_data);
+static cohort_soa* active_cohort_soa(patch* currentp);
+static int adaptive_sodeint(patch* currentp, double t1, UserData* data);
+
+// patch level quantities integrated alongside the cohorts
+#define N_PATCH_ODE 8
+static void get_patch_state(patch* p, double* y);
+static void set_patch_state(patch* p, const double* y);
+static void get_patch_derivatives(patch* p, double* dy);
 
 using namespace std;
 
@@ -36,6 +45,18 @@ int cm_sodeint (patch** patchptr, int time_step, double t1, double t2,
    int split_factor, split_count;
 
    patch* currentp = *patchptr;
+
+   if (data->integrator == 1) return adaptive_sodeint(currentp, t1, data);
+
+   // Optionally integrate cohort state from contiguous arrays owned by the site
+   cohort_soa* soa = NULL;
+   if (data->soa_integration) {
+      if (currentp->siteptr->cohort_arrays == NULL)
+         currentp->siteptr->cohort_arrays = create_cohort_soa();
+      soa = currentp->siteptr->cohort_arrays;
+      soa->gather(currentp);
+   }
+
    iout = 0;
    while (iout<data->substeps){ 
       split_factor=1;
@@ -55,14 +76,18 @@ int cm_sodeint (patch** patchptr, int time_step, double t1, double t2,
             currentp->fast_soil_N += currentp->dfsn * deltat / 2.;
             currentp->passive_soil_C += currentp->dpsc * deltat / 2.;
             currentp->structural_soil_L += currentp->dstsl * deltat / 2.;
-            cohort* currentc = currentp->shortest;
-            while (currentc != NULL) {
-               currentc->nindivs += currentc->dndt * deltat / 2.;
-               currentc->dbh += currentc->ddbhdt * deltat / 2.;
-               currentc->balive += currentc->dbalivedt * deltat / 2.;
-               currentc->bdead += currentc->dbdeaddt * deltat / 2.;
-               currentc = currentc->taller;
-            }            
+            if (soa != NULL) {
+               soa->half_step(deltat);
+            } else {
+               cohort* currentc = currentp->shortest;
+               while (currentc != NULL) {
+                  currentc->nindivs += currentc->dndt * deltat / 2.;
+                  currentc->dbh += currentc->ddbhdt * deltat / 2.;
+                  currentc->balive += currentc->dbalivedt * deltat / 2.;
+                  currentc->bdead += currentc->dbdeaddt * deltat / 2.;
+                  currentc = currentc->taller;
+               }
+            }
             f(t1 + deltat / 2., currentp);  
             flag = currentp->check_for_negatives(deltat);
             if (flag==0) {
@@ -71,6 +96,7 @@ int cm_sodeint (patch** patchptr, int time_step, double t1, double t2,
             else if ((flag==2)|(split_count>15)) {
                 if (flag==2) printf("Failed for flag=2\n");
                 if (split_count>15) printf("Failed for split_count>15\n");
+               if (soa != NULL) soa->release();
                return 1;
             }
             //Otherwise split step
@@ -89,21 +115,218 @@ int cm_sodeint (patch** patchptr, int time_step, double t1, double t2,
          currentp->passive_soil_C = currentp->old_passive_soil_C + currentp->dpsc * deltat;
          currentp->structural_soil_L = currentp->old_structural_soil_L + currentp->dstsl * deltat; 
                   
-         cohort* currentc = currentp->shortest;
-         while (currentc != NULL) {
-            currentc->nindivs = currentc->old_nindivs + currentc->dndt * deltat;
-            currentc->dbh = currentc->old_dbh + currentc->ddbhdt * deltat;
-            currentc->balive = currentc->old_balive + currentc->dbalivedt * deltat; 
-            currentc->bdead = currentc->old_bdead + currentc->dbdeaddt * deltat;  
-            currentc = currentc->taller;
+         if (soa != NULL) {
+            soa->full_step(deltat);
+         } else {
+            cohort* currentc = currentp->shortest;
+            while (currentc != NULL) {
+               currentc->nindivs = currentc->old_nindivs + currentc->dndt * deltat;
+               currentc->dbh = currentc->old_dbh + currentc->ddbhdt * deltat;
+               currentc->balive = currentc->old_balive + currentc->dbalivedt * deltat; 
+               currentc->bdead = currentc->old_bdead + currentc->dbdeaddt * deltat;  
+               currentc = currentc->taller;
+            }
          }
          iout2++;
       }
       iout++;
    }
+   if (soa != NULL) soa->release();
    return 0;   /* return to community dynamics */
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//! adaptive_sodeint
+//! Integrate a patch over one time step with the embedded Bogacki-Shampine
+//! 3(2) pair. The step size is controlled by the ode_rtol/ode_atol error
+//! tolerances, steps that would make any quantity negative are retried
+//! with a smaller step, and the last accepted step is remembered by the
+//! patch as the first guess for the next time step. Uses the first-same-
+//! as-last property, so an accepted step costs three evaluations of f.
+//! Soil water is integrated with the other patch quantities instead of by
+//! Update_Water: where dwdt would change sign over a step the error test
+//! shortens the step, which is what the equilibrium search in cm_sodeint
+//! is for.
+//!
+//! @param  currentp patch to integrate
+//! @param  t1       start time (yrs)
+//! @param  data     UserData structure
+//! @return 0 if integrated successfully, 1 if encountered problem
+////////////////////////////////////////////////////////////////////////////////
+static int adaptive_sodeint (patch* currentp, double t1, UserData* data) {
+
+   const double safety = 0.9;
+   const double min_factor = 0.2;
+   const double max_factor = 5.0;
+
+   // always integrate the cohorts from contiguous arrays
+   site* currents = currentp->siteptr;
+   if (currents->cohort_arrays == NULL)
+      currents->cohort_arrays = create_cohort_soa();
+   cohort_soa* soa = currents->cohort_arrays;
+   soa->gather(currentp);
+
+   double span = data->deltat;
+   double tend = t1 + span;
+   double hmin = span / (data->substeps * 65536.0);
+   double h = currentp->ode_step;
+   if ((h <= 0.0) || (h > span)) h = span / data->substeps;
+
+   double y0[N_PATCH_ODE], y[N_PATCH_ODE];
+   double k1[N_PATCH_ODE], k2[N_PATCH_ODE], k3[N_PATCH_ODE], k4[N_PATCH_ODE];
+
+   double t = t1;
+   currentp->save_old();
+   get_patch_state(currentp, y0);
+   f(t, currentp);
+   get_patch_derivatives(currentp, k1);
+   soa->copy_derivatives();
+
+   while (t < tend) {
+      // don't let the final step overshoot, but remember the unclamped size
+      bool last = (t + h >= tend);
+      double hstep = last ? tend - t : h;
+      bool ok = true;
+      bool nan = false;
+
+      // stage 2
+      for (int i=0; i<N_PATCH_ODE; i++) y[i] = y0[i] + hstep * 0.5 * k1[i];
+      set_patch_state(currentp, y);
+      soa->bs_stage(hstep, 0.5, 0.0, 0.0);
+      for (int i=0; i<N_PATCH_ODE; i++) ok = ok && (y[i] >= 0);
+      ok = ok && !soa->has_negatives();
+      if (ok) {
+         f(t + 0.5 * hstep, currentp);
+         get_patch_derivatives(currentp, k2);
+         soa->save_stage_derivatives(2);
+
+         // stage 3
+         for (int i=0; i<N_PATCH_ODE; i++) y[i] = y0[i] + hstep * 0.75 * k2[i];
+         set_patch_state(currentp, y);
+         soa->bs_stage(hstep, 0.0, 0.75, 0.0);
+         for (int i=0; i<N_PATCH_ODE; i++) ok = ok && (y[i] >= 0);
+         ok = ok && !soa->has_negatives();
+      }
+      if (ok) {
+         f(t + 0.75 * hstep, currentp);
+         get_patch_derivatives(currentp, k3);
+         soa->save_stage_derivatives(3);
+
+         // third order solution
+         for (int i=0; i<N_PATCH_ODE; i++) 
+            y[i] = y0[i] + hstep * (2.0/9.0 * k1[i] + 1.0/3.0 * k2[i] + 4.0/9.0 * k3[i]);
+         set_patch_state(currentp, y);
+         soa->bs_stage(hstep, 2.0/9.0, 1.0/3.0, 4.0/9.0);
+         for (int i=0; i<N_PATCH_ODE; i++) ok = ok && (y[i] >= 0);
+         ok = ok && !soa->has_negatives();
+      }
+
+      double err = 0.0;
+      if (ok) {
+         f(t + hstep, currentp);
+         get_patch_derivatives(currentp, k4);
+         for (int i=0; i<N_PATCH_ODE; i++) nan = nan || (k4[i]*0 != 0);
+         nan = nan || soa->has_nan_derivatives();
+         if (nan) {
+            printf("Failed for NaN derivative in adaptive integrator\n");
+            soa->release();
+            return 1;
+         }
+
+         // error estimate from the embedded second order solution
+         for (int i=0; i<N_PATCH_ODE; i++) {
+            double e = hstep * (-5.0/72.0 * k1[i] + 1.0/12.0 * k2[i] + 1.0/9.0 * k3[i] - 1.0/8.0 * k4[i]);
+            double sc = data->ode_atol + data->ode_rtol * max(fabs(y[i]), fabs(y0[i]));
+            err = max(err, fabs(e) / sc);
+         }
+         err = max(err, soa->bs_error(hstep, data->ode_rtol, data->ode_atol));
+      }
+
+      if (ok && (err <= 1.0)) {
+         // accept: new state becomes the start of the next step, k4 its k1
+         t = last ? tend : t + hstep;
+         currentp->save_old();
+         for (int i=0; i<N_PATCH_ODE; i++) {
+            y0[i] = y[i];
+            k1[i] = k4[i];
+         }
+         soa->copy_derivatives();
+         double factor = (err > 0.0) ? safety * pow(err, -1.0/3.0) : max_factor;
+         if (!last) h *= min(max_factor, max(min_factor, factor));
+      } else {
+         // reject: back to the start of the step with a smaller step
+         currentp->load_old();
+         if (ok) 
+            h = hstep * max(min_factor, safety * pow(err, -1.0/3.0));
+         else
+            h = hstep * 0.5; // positivity
+         if (h < hmin) {
+            printf("Failed for step size below %g in adaptive integrator\n", hmin);
+            soa->release();
+            return 1;
+         }
+      }
+   }
+
+   currentp->ode_step = h;
+   soa->release();
+   return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! get_patch_state
+//! Pack the integrated patch quantities into y
+//!
+//! @param  
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+static void get_patch_state (patch* p, double* y) {
+   y[0] = p->water;
+   y[1] = p->fast_soil_C;
+   y[2] = p->structural_soil_C;
+   y[3] = p->slow_soil_C;
+   y[4] = p->mineralized_soil_N;
+   y[5] = p->fast_soil_N;
+   y[6] = p->passive_soil_C;
+   y[7] = p->structural_soil_L;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! set_patch_state
+//! Unpack y into the integrated patch quantities
+//!
+//! @param  
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+static void set_patch_state (patch* p, const double* y) {
+   p->water              = y[0];
+   p->fast_soil_C        = y[1];
+   p->structural_soil_C  = y[2];
+   p->slow_soil_C        = y[3];
+   p->mineralized_soil_N = y[4];
+   p->fast_soil_N        = y[5];
+   p->passive_soil_C     = y[6];
+   p->structural_soil_L  = y[7];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! get_patch_derivatives
+//! Pack the derivatives of the integrated patch quantities into dy
+//!
+//! @param  
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+static void get_patch_derivatives (patch* p, double* dy) {
+   dy[0] = p->dwdt;
+   dy[1] = p->dfsc;
+   dy[2] = p->dstsc;
+   dy[3] = p->dssc;
+   dy[4] = p->dmsn;
+   dy[5] = p->dfsn;
+   dy[6] = p->dpsc;
+   dy[7] = p->dstsl;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //! f
 //! Functions Called by the CVODE Solver. f routine. Compute f(t,u).
@@ -120,18 +343,35 @@ static void f(double t, void *f_data){
    
    currents->function_calls++;
    
+   cohort_soa* soa = active_cohort_soa(currentp);
    cohort* currentc = currentp->shortest;
    // The order of functions is critical. Important to call Allocate_Biomass first 
    // so that functions following it are using accurate biomass/allometry estimates
-   while(currentc!=NULL){
-      currentc->Allocate_Biomass(data);
-      currentc=currentc->taller;
-   }   
+   if (soa != NULL) {
+      // the right hand side is still evaluated per cohort struct: copy the
+      // stage state in as it is allocated (Hite may cap dbh)
+      for (size_t i=0; i<soa->n; i++) {
+         cohort* cc = soa->cptr[i];
+         cc->nindivs = soa->nindivs[i];
+         cc->dbh     = soa->dbh[i];
+         cc->balive  = soa->balive[i];
+         cc->bdead   = soa->bdead[i];
+         cc->Allocate_Biomass(data);
+         soa->dbh[i] = cc->dbh;
+      }
+   } else {
+      while(currentc!=NULL){
+         currentc->Allocate_Biomass(data);
+         currentc=currentc->taller;
+      }
+   }
 
    if(data->stiff_light) {
       sort_cohorts(&currentp,data);
       light_levels(&currentp,data);
    }
+   // lai is fixed for the rest of this call, so Vm0 is set once per cohort here
+   canopy_vm0(&currentp,data);
 
    currentp->Water_and_Nitrogen_Uptake(data->time_period,t,data);
    currentp->Dwdt(t,data); 
@@ -143,17 +383,43 @@ static void f(double t, void *f_data){
 
    /* call growth function */
    /* printf("f: calculating growth function \n"); */
-   currentc = currentp->shortest;
-   while(currentc!=NULL){
-      /* printf("f: currentc %p \n",currentc); */
-      currentc->Growth_Derivatives(t,data);  
-      currentc=currentc->taller;
-   }   
+   if (soa != NULL) {
+      // and copy the derivatives out for the array loops of the integrator
+      for (size_t i=0; i<soa->n; i++) {
+         cohort* cc = soa->cptr[i];
+         cc->Growth_Derivatives(t,data);
+         soa->dbh[i]       = cc->dbh; // Bleaf may cap dbh
+         soa->dndt[i]      = cc->dndt;
+         soa->ddbhdt[i]    = cc->ddbhdt;
+         soa->dbalivedt[i] = cc->dbalivedt;
+         soa->dbdeaddt[i]  = cc->dbdeaddt;
+      }
+   } else {
+      currentc = currentp->shortest;
+      while(currentc!=NULL){
+         /* printf("f: currentc %p \n",currentc); */
+         currentc->Growth_Derivatives(t,data);  
+         currentc=currentc->taller;
+      }
+   }
    currentp->Litter(t,data);
    currentp->Dsdt(data->time_period,t,data);
    return;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//! active_cohort_soa
+//! Cohort arrays of the site, if they are currently gathered for this patch
+//!
+//! @param  currentp patch
+//! @return cohort arrays or NULL when the patch is integrated from its list
+////////////////////////////////////////////////////////////////////////////////
+static cohort_soa* active_cohort_soa(patch* currentp) {
+   cohort_soa* soa = currentp->siteptr->cohort_arrays;
+   if ((soa != NULL) && (soa->patchptr == currentp)) return soa;
+   return NULL;
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //! Water_and_Nitrogen_Uptake
@@ -171,23 +437,18 @@ void patch::Water_and_Nitrogen_Uptake (unsigned int time_period, double time, Us
    while(currentc != NULL){
       size_t spp = currentc->species;
       size_t pt = currentc->pt;
-      currentc->get_cohort_vm0(data);
-      currentc->Vm0_bin= currentc->get_cohort_vm0_bin(currentc->Vm0, data);
       currentc->leaf_area = currentc->bl*data->specific_leaf_area[spp];
       
       size_t time_index = data->time_period;
-      size_t light_index = 0; /*calc light index*/
-      while(currents->sdata->light_levels[pt][currentc->Vm0_bin][light_index] > currentc->lite){
-         light_index++;
-      }
 #if FTS
+      size_t light_index = currentc->light_index; /* set by canopy_vm0 */
       currentc->E_pot = currents->E[pt][light_index];
       currentc->E_pot *= currentc->leaf_area*12/1000.0;
       currentc->E_shut = currents->E_shut[pt][120];
       currentc->E_shut *= currentc->leaf_area*12/1000.0;
 #else
       //potential transpiration (gH20/m2(leaf)/mon)
-      currentc->E_pot = currents->sdata->E[pt][currentc->Vm0_bin][time_index][light_index]; 
+      currentc->E_pot = currentc->light_lut(currents->sdata->E[pt][currentc->Vm0_bin][time_index]); 
       //convert to (kgH20/yr per plant)
       currentc->E_pot *= currentc->leaf_area*N_CLIMATE/1000.0;
 
@@ -228,7 +489,7 @@ void patch::Water_and_Nitrogen_Uptake (unsigned int time_period, double time, Us
            currentc->E_pot = currents->E[pt][light_index];
            currentc->E_shut = currents->E_shut[pt][120];
 #else
-           currentc->E_pot = currents->sdata->E[pt][currentc->Vm0_bin][time_index][light_index];
+           currentc->E_pot = currentc->light_lut(currents->sdata->E[pt][currentc->Vm0_bin][time_index]);
            currentc->E_shut = currents->sdata->Eb[pt][currentc->Vm0_bin][time_index][N_LIGHT-1];
 #endif
            currentc->E_pot *= currentc->leaf_area*12/1000.0;
@@ -330,6 +591,9 @@ int patch::check_for_negatives(double dt){
        return 1; //update_water uses old_water, not water, so check for negatives there as well.
    }
    
+   cohort_soa* soa = active_cohort_soa(this);
+   if (soa != NULL) return soa->check_for_negatives(dt);
+
    cohort* cc = shortest;
    while (cc != NULL) {
       if ((cc->dndt+cc->ddbhdt+cc->dbalivedt+cc->dbdeaddt)*0!=0) return 2;
@@ -426,6 +690,12 @@ void patch::save_old(){
    old_passive_soil_C = passive_soil_C; 
    old_structural_soil_L = structural_soil_L; 
    
+   cohort_soa* soa = active_cohort_soa(this);
+   if (soa != NULL) {
+      soa->save_old();
+      return;
+   }
+
    cohort* cc = shortest;
    while (cc != NULL) {
       cc->old_nindivs = cc->nindivs; 
@@ -455,6 +725,12 @@ void patch::load_old(){
    passive_soil_C = old_passive_soil_C; 
    structural_soil_L = old_structural_soil_L; 
    
+   cohort_soa* soa = active_cohort_soa(this);
+   if (soa != NULL) {
+      soa->load_old();
+      return;
+   }
+
    cohort* cc = shortest;
    while (cc != NULL) {
       cc->nindivs = cc->old_nindivs; 
@@ -484,6 +760,12 @@ void patch::copy_derivatives(){
    dpsc1 = dpsc;
    dstsl1 = dstsl;
    
+   cohort_soa* soa = active_cohort_soa(this);
+   if (soa != NULL) {
+      soa->copy_derivatives();
+      return;
+   }
+
    cohort* cc = shortest;
    while (cc!=NULL){
       cc->dndt1 = cc->dndt;
@@ -513,6 +795,12 @@ void patch::load_derivatives(){
    dpsc = dpsc1;
    dstsl = dstsl1;
    
+   cohort_soa* soa = active_cohort_soa(this);
+   if (soa != NULL) {
+      soa->load_derivatives();
+      return;
+   }
+
    cohort* cc = shortest;
    while (cc!=NULL){
       cc->dndt = cc->dndt1;
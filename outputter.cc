@@ -1,4 +1,7 @@
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <mutex>
 #include <netcdfcpp.h>
 #include <string>
 
@@ -7,6 +10,10 @@
 #include "read_site_data.h"
 
 #include "outputter.h"
+#if TBB
+#include "tbb/parallel_for.h"
+#include "tbb/blocked_range.h"
+#endif
 
 using namespace std;
 
@@ -19,13 +26,28 @@ using namespace std;
 ////////////////////////////////////////////////////////////////////////////////
 Outputter::Outputter (UserData* data) :
       recNo(0),
-      data(data)
+      data(data),
+      landOnly(data->region_land_only != 0),
+      landReady(false),
+      nLand(0),
+      recCells(data->n_lat * data->n_lon),
+      aggWindow(data->region_aggregate_window > 1 ? data->region_aggregate_window : 1),
+      aggStat(data->region_aggregate),
+      aggRecords(0),
+      aggWindowNo(0),
+      writing(false),
+      stopWriter(false),
+      gatherTime(0.0),
+      stallTime(0.0),
+      writeTime(0.0)
 {
    string filename (data->base_filename);
    filename += ".region.nc";
 
    NcError err(NcError::verbose_nonfatal);
-   outputFile = new NcFile(filename.c_str(), NcFile::Replace);
+   // chunking and deflate of the land only layout need netcdf-4
+   outputFile = new NcFile(filename.c_str(), NcFile::Replace, NULL, 0, 
+                           landOnly ? NcFile::Netcdf4 : NcFile::Classic);
 
    // TODO: get rid of these exception throws
    if (!outputFile->is_valid()) throw "Failed to create file";
@@ -48,6 +70,126 @@ Outputter::Outputter (UserData* data) :
    
    latVar->put(&data->lats[0], data->n_lat);
    lonVar->put(&data->lons[0], data->n_lon);
+
+   // snapshots are sized once all variables are registered, see layoutSnapshots
+   for (size_t i=0; i<OUTPUT_SNAPSHOTS; i++)
+      snapshots[i].data = NULL;
+   writer = thread(&Outputter::writerLoop, this);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! ~Outputter
+//! Write any queued records, then sync and close the file
+//!
+//! @param  
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+Outputter::~Outputter () {
+   if (aggRecords > 0) {
+      queueRecord(NULL); // partial last window
+   }
+   {
+      lock_guard<mutex> lock(queueLock);
+      stopWriter = true;
+   }
+   queueCond.notify_all();
+   writer.join(); // writes whatever is still queued
+
+   if (recNo > 0) {
+      printf("Region output: %lu records, gather %.3f s, stalled on writer %.3f s, "
+             "written in background %.3f s\n", (unsigned long)recNo, gatherTime, stallTime, writeTime);
+   }
+
+   lock_guard<mutex> lock(netcdf_mutex);
+   outputFile->sync();
+   delete outputFile;
+   for (size_t i=0; i<OUTPUT_SNAPSHOTS; i++)
+      free(snapshots[i].data);
+   for (size_t i=0; i<registeredVars.size(); i++)
+      delete registeredVars[i];
+   for (size_t i=0; i<registeredLUVars.size(); i++)
+      delete registeredLUVars[i];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! setupLand
+//! Land only layout: number the modelled cells in grid order and write them
+//! as the "land" index variable (CF compression by gathering). Records are
+//! then nLand values long instead of n_lat*n_lon. Call with netcdf_mutex held.
+//!
+//! @param  firstsite head of the site list
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void Outputter::setupLand (site* firstsite) {
+   vector<int> cells;
+   for (site* cs=firstsite; cs!=NULL; cs=cs->next_site)
+      cells.push_back(cs->sdata->y_ * data->n_lon + cs->sdata->x_);
+
+   vector<int> land(cells);
+   sort(land.begin(), land.end());
+   land.erase(unique(land.begin(), land.end()), land.end());
+
+   // slot of each site, in site list (and site_arr) order
+   siteSlot.resize(cells.size());
+   for (size_t i=0; i<cells.size(); i++)
+      siteSlot[i] = lower_bound(land.begin(), land.end(), cells[i]) - land.begin();
+
+   nLand = land.size();
+   recCells = nLand;
+
+   NcDim *landDim;
+   NcVar *landVar;
+   if (!(landDim = outputFile->add_dim("land", nLand)))
+      throw "Failed to create land dim";
+   if (!(landVar = outputFile->add_var("land", ncInt, landDim)))
+      throw "Failed to create land var";
+   landVar->add_att("compress", "lat lon");
+   landVar->add_att("long_name", "modelled cells, lat_index*n_lon+lon_index");
+   landVar->put(&land[0], nLand);
+   landReady = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! addVar
+//! Define an output variable: time x lat x lon, or time x land in the land
+//! only layout, which is also chunked one record per chunk (unless there
+//! are no land cells) and deflated
+//!
+//! @param  name  variable name
+//! @param  dtype netcdf type
+//! @param  isRec true for a record (time) variable
+//! @return new variable
+////////////////////////////////////////////////////////////////////////////////
+NcVar* Outputter::addVar (const char* name, NcType dtype, bool isRec) {
+   NcVar *var;
+   if (landOnly) {
+      if (isRec)
+         var = outputFile->add_var(name, dtype, outputFile->get_dim("time"), 
+                                   outputFile->get_dim("land"));
+      else
+         var = outputFile->add_var(name, dtype, outputFile->get_dim("land"));
+
+      int rv;
+      // a region without land cells has an empty land dimension, nothing to chunk
+      if (nLand > 0) {
+         size_t chunks[2] = { 1, nLand };
+         if ((rv = nc_def_var_chunking(outputFile->id(), var->id(), NC_CHUNKED, 
+                                       isRec ? chunks : chunks + 1)))
+            NCERR(name, rv);
+      }
+      if (data->region_deflate > 0) {
+         if ((rv = nc_def_var_deflate(outputFile->id(), var->id(), 1, 1, data->region_deflate)))
+            NCERR(name, rv);
+      }
+   } else {
+      if (isRec)
+         var = outputFile->add_var(name, dtype, outputFile->get_dim("time"),
+                                   outputFile->get_dim("lat"), outputFile->get_dim("lon"));
+      else
+         var = outputFile->add_var(name, dtype, outputFile->get_dim("lat"),
+                                   outputFile->get_dim("lon"));
+   }
+   return var;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -63,15 +205,9 @@ NcVar* Outputter::getOrCreateVariable (Var<T> *v, bool isRec) {
       
    NcVar *var = outputFile->get_var(v->name.c_str());
    if (var == NULL || !var->is_valid()) {
-      if (isRec)
-         var = outputFile->add_var(v->name.c_str(), v->dtype, 
-                                   outputFile->get_dim("time"),
-                                   outputFile->get_dim("lat"),
-                                   outputFile->get_dim("lon"));
-      else
-         var = outputFile->add_var(v->name.c_str(), v->dtype, 
-                                   outputFile->get_dim("lat"),
-                                   outputFile->get_dim("lon"));
+      var = addVar(v->name.c_str(), v->dtype, isRec);
+      if (isRec && (aggWindow > 1))
+         var->add_att("cell_methods", cellMethods().c_str());
       if (!v->units.empty())
          var->add_att("units", v->units.c_str());
       var->add_att("missing_value", v->fill);
@@ -95,16 +231,9 @@ NcVar* Outputter::getOrCreateLUVariable (LUVar<T> *v, size_t luType, bool isRec)
 
    NcVar *var = outputFile->get_var(name.c_str());
    if (var == NULL || !var->is_valid()) {
-      if (isRec)
-         var = outputFile->add_var(name.c_str(), v->dtype, 
-                                   outputFile->get_dim("time"),
-                                   outputFile->get_dim("lat"),
-                                   outputFile->get_dim("lon"));
-      else
-         var = outputFile->add_var(name.c_str(), v->dtype, 
-                                   outputFile->get_dim("lat"),
-                                   outputFile->get_dim("lon"));
-
+      var = addVar(name.c_str(), v->dtype, isRec);
+      if (isRec && (aggWindow > 1))
+         var->add_att("cell_methods", cellMethods().c_str());
       if (!v->units.empty())
          var->add_att("units", v->units.c_str());
       var->add_att("missing_value", v->fill);
@@ -114,105 +243,423 @@ NcVar* Outputter::getOrCreateLUVariable (LUVar<T> *v, size_t luType, bool isRec)
    return var;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//! layoutSnapshots
+//! Place every registered variable in the snapshot buffers and allocate
+//! them. Done on the first record, after registerOutputVars.
+//!
+//! @param  
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void Outputter::layoutSnapshots (site* firstsite) {
+   if (landOnly && !landReady) {
+      lock_guard<mutex> lock(netcdf_mutex);
+      setupLand(firstsite);
+   }
+   size_t ncells = recCells;
+   size_t bytes = 0;
+   size_t slots = 0;
+
+   vector<VarBase *> vars(registeredVars);
+   vars.insert(vars.end(), registeredLUVars.begin(), registeredLUVars.end());
+   for (size_t k=0; k<vars.size(); k++) {
+      vars[k]->offset = bytes;
+      bytes += vars[k]->size(ncells);
+      vars[k]->accOffset = slots;
+      slots += vars[k]->slabs() * ncells;
+   }
+
+   if (aggWindow > 1) {
+      acc.resize(slots);
+      accCount.resize(ncells);
+      resetAccumulators();
+   }
+
+   lock_guard<mutex> lock(queueLock);
+   for (size_t i=0; i<OUTPUT_SNAPSHOTS; i++) {
+      if ((snapshots[i].data = (char*) malloc(bytes)) == NULL) {
+         fprintf(stderr, "Outputter: out of memory for %lu byte snapshots\n", (unsigned long)bytes);
+         exit(1);
+      }
+      freeSnaps.push_back(&snapshots[i]);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! gatherAll
+//! Fill a snapshot with all registered variables in one pass over the sites
+//!
+//! @param  snap      snapshot data
+//! @param  firstsite head of the site list
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void Outputter::gatherAll (char* snap, site* firstsite) {
+   size_t ncells = recCells;
+
+   vector<VarBase *> vars(registeredVars);
+   vars.insert(vars.end(), registeredLUVars.begin(), registeredLUVars.end());
+   for (size_t k=0; k<vars.size(); k++)
+      vars[k]->clear(snap, ncells);
+
+#if TBB
+   // each site fills its own cell of every variable
+   site** site_arr = data->site_arr;
+   tbb::parallel_for(tbb::blocked_range<size_t>(0, data->number_of_sites, 64),
+                     [&] (const tbb::blocked_range<size_t>& r) {
+      for (size_t i=r.begin(); i!=r.end(); i++) {
+         site* cs = site_arr[i];
+         if (cs->skip_site) continue;
+         size_t cell = landOnly ? siteSlot[i] : cs->sdata->y_ * data->n_lon + cs->sdata->x_;
+         for (size_t k=0; k<vars.size(); k++)
+            vars[k]->gather(snap, cs, cell, ncells);
+      }
+   });
+#else
+   site* cs = firstsite;
+   for (size_t i=0; cs!=NULL; i++) {
+      if (!cs->skip_site) {
+         size_t cell = landOnly ? siteSlot[i] : cs->sdata->y_ * data->n_lon + cs->sdata->x_;
+         for (size_t k=0; k<vars.size(); k++)
+            vars[k]->gather(snap, cs, cell, ncells);
+      }
+      cs = cs->next_site;
+   }
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! resetAccumulators
+//! Start a new aggregation window
+//!
+//! @param  
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void Outputter::resetAccumulators () {
+   double init = 0.0;
+   if (aggStat == AGG_MIN) init = HUGE_VAL;
+   else if (aggStat == AGG_MAX) init = -HUGE_VAL;
+   fill(acc.begin(), acc.end(), init);
+   fill(accCount.begin(), accCount.end(), 0);
+   aggRecords = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! accumulateAll
+//! Fold the sites' current values of all registered variables into the
+//! running statistic of the window, in one pass over the sites
+//!
+//! @param  firstsite head of the site list
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void Outputter::accumulateAll (site* firstsite) {
+   size_t ncells = recCells;
+   double* a = &acc[0];
+
+   vector<VarBase *> vars(registeredVars);
+   vars.insert(vars.end(), registeredLUVars.begin(), registeredLUVars.end());
+
+#if TBB
+   site** site_arr = data->site_arr;
+   tbb::parallel_for(tbb::blocked_range<size_t>(0, data->number_of_sites, 64),
+                     [&] (const tbb::blocked_range<size_t>& r) {
+      for (size_t i=r.begin(); i!=r.end(); i++) {
+         site* cs = site_arr[i];
+         if (cs->skip_site) continue;
+         size_t cell = landOnly ? siteSlot[i] : cs->sdata->y_ * data->n_lon + cs->sdata->x_;
+         for (size_t k=0; k<vars.size(); k++)
+            vars[k]->accumulate(a, cs, cell, ncells, aggStat);
+         accCount[cell]++;
+      }
+   });
+#else
+   site* cs = firstsite;
+   for (size_t i=0; cs!=NULL; i++) {
+      if (!cs->skip_site) {
+         size_t cell = landOnly ? siteSlot[i] : cs->sdata->y_ * data->n_lon + cs->sdata->x_;
+         for (size_t k=0; k<vars.size(); k++)
+            vars[k]->accumulate(a, cs, cell, ncells, aggStat);
+         accCount[cell]++;
+      }
+      cs = cs->next_site;
+   }
+#endif
+   aggRecords++;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //! outputAll
-//! 
+//! Output the sites' current values of every registered variable. With
+//! region_aggregate_window > 1 they are folded into the running statistic
+//! and a record is written at the end of each window. Windows are fixed
+//! spans of aggWindow*PRINTFREQ time steps from t = 0, e.g. calendar years
+//! for 12 monthly records, so a run restarted mid window writes a partial
+//! first window.
+//!
+//! @param  t         time step of the values
+//! @param  firstsite head of the site list
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void Outputter::outputAll (unsigned int t, site* firstsite) {
+   if (snapshots[0].data == NULL) {
+      layoutSnapshots(firstsite);
+   }
+
+   if (aggWindow > 1) {
+      unsigned int span = aggWindow * PRINTFREQ;
+      if ((aggRecords > 0) && (t / span != aggWindowNo)) {
+         queueRecord(NULL); // window ended without its last record
+      }
+      aggWindowNo = t / span;
+
+      chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+      accumulateAll(firstsite);
+      gatherTime += chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+      if ((t + PRINTFREQ) / span == aggWindowNo) return;
+   }
+   queueRecord(firstsite);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! queueRecord
+//! Fill a snapshot, from the sites or from the window's statistic, and queue
+//! it for the writer thread, which writes it while the model moves on. If
+//! the writer is still busy with the records before, this waits for a free
+//! snapshot.
+//!
+//! @param  firstsite head of the site list, not used when aggregating
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void Outputter::queueRecord (site* firstsite) {
+   chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+   snapshot* s;
+   {
+      unique_lock<mutex> lock(queueLock);
+      queueCond.wait(lock, [this] { return !freeSnaps.empty(); });
+      s = freeSnaps.back();
+      freeSnaps.pop_back();
+   }
+   chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+
+   if (aggWindow > 1) {
+      vector<VarBase *> vars(registeredVars);
+      vars.insert(vars.end(), registeredLUVars.begin(), registeredLUVars.end());
+      for (size_t k=0; k<vars.size(); k++)
+         vars[k]->emit(s->data, &acc[0], &accCount[0], recCells, aggStat);
+      resetAccumulators();
+   } else {
+      gatherAll(s->data, firstsite);
+   }
+   s->recNo = recNo++;
+
+   {
+      lock_guard<mutex> lock(queueLock);
+      fullSnaps.push_back(s);
+   }
+   queueCond.notify_all();
+
+   stallTime  += chrono::duration<double>(t1 - t0).count();
+   gatherTime += chrono::duration<double>(chrono::steady_clock::now() - t1).count();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! flush
+//! Write the partial last window, if any, and wait until every queued
+//! record has been written and synced
+//!
+//! @param  
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void Outputter::flush () {
+   if (aggRecords > 0) {
+      queueRecord(NULL);
+   }
+   {
+      unique_lock<mutex> lock(queueLock);
+      queueCond.wait(lock, [this] { return fullSnaps.empty() && !writing; });
+   }
+   lock_guard<mutex> lock(netcdf_mutex);
+   outputFile->sync();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! writerLoop
+//! Body of the writer thread: write queued snapshots in order until stopped
+//! and the queue is empty
 //!
 //! @param  
 //! @return 
 ////////////////////////////////////////////////////////////////////////////////
-void Outputter::outputAll (site* firstsite) {
+void Outputter::writerLoop () {
+   while (true) {
+      snapshot* s;
+      {
+         unique_lock<mutex> lock(queueLock);
+         queueCond.wait(lock, [this] { return !fullSnaps.empty() || stopWriter; });
+         if (fullSnaps.empty()) break;
+         s = fullSnaps.front();
+         fullSnaps.erase(fullSnaps.begin());
+         writing = true;
+      }
+
+      chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+      writeSnapshot(s);
+      writeTime += chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+      {
+         lock_guard<mutex> lock(queueLock);
+         freeSnaps.push_back(s);
+         writing = false;
+      }
+      queueCond.notify_all();
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! writeSnapshot
+//! Write one record, syncing the file every region_sync_freq records
+//!
+//! @param  s snapshot to write
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void Outputter::writeSnapshot (const snapshot* s) {
+   lock_guard<mutex> lock(netcdf_mutex); // the forcing reader may be reading
    vector<VarBase *>::iterator i;
 
    for (i=registeredVars.begin(); i!=registeredVars.end(); i++) {
       if ((*i)->dtype == ncFloat)
-         outputRec<float> (dynamic_cast<Var<float>* >((VarBase*)(*i)), firstsite);
+         putVar<float> (dynamic_cast<Var<float>* >((VarBase*)(*i)), s->data, s->recNo, true);
       else if ((*i)->dtype == ncInt)
-         outputRec<int> (dynamic_cast<Var<int>* >((VarBase*)(*i)), firstsite);
+         putVar<int> (dynamic_cast<Var<int>* >((VarBase*)(*i)), s->data, s->recNo, true);
    }
 
    for (i=registeredLUVars.begin(); i!=registeredLUVars.end(); i++) {
       if ((*i)->dtype == ncFloat)
-         outputLURec<float> (dynamic_cast<LUVar<float>* >((VarBase*)(*i)), firstsite);
+         putLUVar<float> (dynamic_cast<LUVar<float>* >((VarBase*)(*i)), s->data, s->recNo, true);
       else if ((*i)->dtype == ncInt)
-         outputLURec<int> (dynamic_cast<LUVar<int>* >((VarBase*)(*i)), firstsite);
+         putLUVar<int> (dynamic_cast<LUVar<int>* >((VarBase*)(*i)), s->data, s->recNo, true);
    }
-   recNo++;
+
+   if ((data->region_sync_freq > 0) && ((s->recNo + 1) % data->region_sync_freq == 0))
+      outputFile->sync();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //! outputRec
-//! 
+//! Gather and write a single variable, on the calling thread
 //!
 //! @param  
 //! @return 
 ////////////////////////////////////////////////////////////////////////////////
 template <class T>
    void Outputter::outputRec (Var<T> *v, site* firstsite, bool isRec) {
-   T d[data->n_lat][data->n_lon];
+   lock_guard<mutex> lock(netcdf_mutex);
+   if (landOnly && !landReady)
+      setupLand(firstsite);
 
-   NcVar *var = getOrCreateVariable(v, isRec);
-
-   for (size_t i=0; i<data->n_lat; i++)
-      for (size_t j=0; j<data->n_lon; j++) 
-         d[i][j] = v->fill;
+   size_t ncells = recCells;
+   vector<char> snap(v->size(ncells));
 
+   v->offset = 0;
+   v->clear(&snap[0], ncells);
    site* cs = firstsite;
-   while (cs != NULL) {
-      if (!cs->skip_site) d[cs->sdata->y_][cs->sdata->x_] = (*(v->get))(cs);
+   for (size_t i=0; cs!=NULL; i++) {
+      if (!cs->skip_site) 
+         v->gather(&snap[0], cs, landOnly ? siteSlot[i] : cs->sdata->y_ * data->n_lon + cs->sdata->x_, ncells);
       cs = cs->next_site;
    }
 
-   if (isRec) {
-      if (!var->put_rec(&d[0][0], recNo))
-         cout << "could not output " << v->name << " " << recNo << endl;
-   } else {
-      if (!var->put(&d[0][0], data->n_lat, data->n_lon))
-         cout << "count not output " << v->name << endl;
-   }
-
+   putVar(v, &snap[0], recNo, isRec);
    outputFile->sync();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //! outputLURec
-//! 
+//! Gather and write a single landuse variable, on the calling thread
 //!
 //! @param  
 //! @return 
 ////////////////////////////////////////////////////////////////////////////////
 template <class T>
 void Outputter::outputLURec (LUVar<T> *v, site* firstsite, bool isRec) {
-   T d[N_LANDUSE_TYPES][data->n_lat][data->n_lon];
-   NcVar *var[N_LANDUSE_TYPES];
-
-   for (size_t lu=0; lu<N_LANDUSE_TYPES; lu++) 
-      var[lu] = getOrCreateLUVariable(v, lu, isRec);
+   lock_guard<mutex> lock(netcdf_mutex);
+   if (landOnly && !landReady)
+      setupLand(firstsite);
 
-   for (size_t lu=0; lu<N_LANDUSE_TYPES; lu++)
-      for (size_t i=0; i<data->n_lat; i++)
-         for (size_t j=0; j<data->n_lon; j++) 
-            d[lu][i][j] = v->fill;
+   size_t ncells = recCells;
+   vector<char> snap(v->size(ncells));
 
+   v->offset = 0;
+   v->clear(&snap[0], ncells);
    site* cs = firstsite;
-   while (cs != NULL) {
+   for (size_t i=0; cs!=NULL; i++) {
       if (!cs->skip_site) 
-         for (size_t lu=0; lu<N_LANDUSE_TYPES; lu++)
-            d[lu][cs->sdata->y_][cs->sdata->x_] = (*(v->get))(cs, lu);
+         v->gather(&snap[0], cs, landOnly ? siteSlot[i] : cs->sdata->y_ * data->n_lon + cs->sdata->x_, ncells);
       cs = cs->next_site;
    }
 
+   putLUVar(v, &snap[0], recNo, isRec);
+   outputFile->sync();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! putVar
+//! Write a variable from a snapshot
+//!
+//! @param  
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+template <class T>
+void Outputter::putVar (Var<T> *v, const char* snap, size_t rec, bool isRec) {
+   NcVar *var = getOrCreateVariable(v, isRec);
+   const T* d = (const T*)(snap + v->offset);
+
+   if (isRec) {
+      if (!var->put_rec(d, rec))
+         cout << "could not output " << v->name << " " << rec << endl;
+   } else {
+      if (!(landOnly ? var->put(d, nLand) : var->put(d, data->n_lat, data->n_lon)))
+         cout << "count not output " << v->name << endl;
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! putLUVar
+//! Write a landuse variable from a snapshot, one variable per type
+//!
+//! @param  
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+template <class T>
+void Outputter::putLUVar (LUVar<T> *v, const char* snap, size_t rec, bool isRec) {
+   size_t ncells = recCells;
+   NcVar *var[N_LANDUSE_TYPES];
+
+   for (size_t lu=0; lu<N_LANDUSE_TYPES; lu++) 
+      var[lu] = getOrCreateLUVariable(v, lu, isRec);
+
+   const T* d = (const T*)(snap + v->offset);
    if (isRec) {
       for (size_t lu=0; lu<N_LANDUSE_TYPES; lu++)
-         if (!var[lu]->put_rec(&d[lu][0][0], recNo))
-            cout << "could not output " << v->name << "_" << this->luShortName(lu) << " " << recNo << endl;
+         if (!var[lu]->put_rec(&d[lu * ncells], rec))
+            cout << "could not output " << v->name << "_" << this->luShortName(lu) << " " << rec << endl;
    } else {
       for (size_t lu=0; lu<N_LANDUSE_TYPES; lu++)
-         if (!var[lu]->put(&d[lu][0][0], data->n_lat, data->n_lon))
+         if (!(landOnly ? var[lu]->put(&d[lu * ncells], nLand)
+                        : var[lu]->put(&d[lu * ncells], data->n_lat, data->n_lon)))
             cout << "count not output " << v->name << "_" << this->luShortName(lu) << endl;
    }
+}
 
-   outputFile->sync();
+////////////////////////////////////////////////////////////////////////////////
+//! cellMethods
+//! CF cell_methods of aggregated records
+//!
+//! @param  
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+string Outputter::cellMethods () {
+   const char* names[4] = { "mean", "minimum", "maximum", "sum" };
+   return string("time: ") + names[aggStat];
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1,9 +1,18 @@
 #ifndef EDM_OUTPUTTER_H_
 #define EDM_OUTPUTTER_H_
 
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include "netcdfcpp.h"
 
+#include "edmodels.h"
+
+#define OUTPUT_SNAPSHOTS 2 ///< records that can be gathered ahead of the writer
+
 // Forward declarations
 struct UserData;
 struct site;
@@ -13,58 +22,160 @@ class Outputter {
    class VarBase {
     public:
       VarBase (std::string name, std::string units, NcType dtype)
-         : name(name), units(units), dtype(dtype)
+         : name(name), units(units), dtype(dtype), offset(0), accOffset(0)
       {
       }
       virtual ~VarBase () {}
 
+      // values of one record live in a snapshot, at offset, see outputAll
+      virtual size_t slabs () = 0;
+      virtual size_t size (size_t ncells) = 0;
+      virtual void clear (char* snap, size_t ncells) = 0;
+      virtual void gather (char* snap, site* cs, size_t cell, size_t ncells) = 0;
+
+      // running statistic over a window of records, see accumulateAll
+      virtual void accumulate (double* acc, site* cs, size_t cell, size_t ncells, int stat) = 0;
+      virtual void emit (char* snap, const double* acc, const unsigned* count, 
+                         size_t ncells, int stat) = 0;
+
       std::string name;
       std::string units;
       NcType dtype;
+      size_t offset;       ///< bytes from the start of a snapshot, [n_lat][n_lon] per slab
+      size_t accOffset;    ///< doubles from the start of the accumulators
    };
 
+   ////////////////////////////////////////////////////////////////////////////////
+   //! combine
+   //! Fold one value into a running statistic
+   //!
+   //! @param  a    running value
+   //! @param  x    new value
+   //! @param  stat AGG_MEAN, AGG_MIN, AGG_MAX or AGG_SUM
+   //! @return 
+   ////////////////////////////////////////////////////////////////////////////////
+   static void combine (double& a, double x, int stat) {
+      if (stat == AGG_MIN) {
+         if (x < a) a = x;
+      } else if (stat == AGG_MAX) {
+         if (x > a) a = x;
+      } else {
+         a += x;
+      }
+   }
+
    template <class T> class Var : public VarBase {
-    public: 
-      Var (std::string name, T (*get)(site*), std::string units, T fill, NcType dtype) 
+    public:
+      Var (std::string name, T (*get)(site*), std::string units, T fill, NcType dtype)
          : VarBase(name, units, dtype), get(get), fill(fill)
       {
       }
-            
+
+      size_t slabs () {
+         return 1;
+      }
+      size_t size (size_t ncells) {
+         return ncells * sizeof(T);
+      }
+      void clear (char* snap, size_t ncells) {
+         T* d = (T*)(snap + offset);
+         std::fill(d, d + ncells, fill);
+      }
+      void gather (char* snap, site* cs, size_t cell, size_t ncells) {
+         ((T*)(snap + offset))[cell] = (*get)(cs);
+      }
+      void accumulate (double* acc, site* cs, size_t cell, size_t ncells, int stat) {
+         combine(acc[accOffset + cell], (*get)(cs), stat);
+      }
+      void emit (char* snap, const double* acc, const unsigned* count, size_t ncells, int stat) {
+         T* d = (T*)(snap + offset);
+         for (size_t c=0; c<ncells; c++) {
+            if (count[c] == 0)
+               d[c] = fill;
+            else
+               d[c] = (T)((stat == AGG_MEAN) ? acc[accOffset + c] / count[c] : acc[accOffset + c]);
+         }
+      }
+
       T (*get)(site*);
       T fill;
    };
 
    template <class T> class LUVar : public VarBase {
-    public: 
-      LUVar (std::string name, T (*get)(site*, size_t luType), std::string units, T fill, NcType dtype) 
+    public:
+      LUVar (std::string name, T (*get)(site*, size_t luType), std::string units, T fill, NcType dtype)
          : VarBase(name, units, dtype), get(get), fill(fill)
       {
       }
-            
+
+      size_t slabs () {
+         return N_LANDUSE_TYPES;
+      }
+      size_t size (size_t ncells) {
+         return N_LANDUSE_TYPES * ncells * sizeof(T);
+      }
+      void clear (char* snap, size_t ncells) {
+         T* d = (T*)(snap + offset);
+         std::fill(d, d + N_LANDUSE_TYPES * ncells, fill);
+      }
+      void gather (char* snap, site* cs, size_t cell, size_t ncells) {
+         for (size_t lu=0; lu<N_LANDUSE_TYPES; lu++)
+            ((T*)(snap + offset))[lu * ncells + cell] = (*get)(cs, lu);
+      }
+      void accumulate (double* acc, site* cs, size_t cell, size_t ncells, int stat) {
+         for (size_t lu=0; lu<N_LANDUSE_TYPES; lu++)
+            combine(acc[accOffset + lu * ncells + cell], (*get)(cs, lu), stat);
+      }
+      void emit (char* snap, const double* acc, const unsigned* count, size_t ncells, int stat) {
+         T* d = (T*)(snap + offset);
+         for (size_t lu=0; lu<N_LANDUSE_TYPES; lu++) {
+            for (size_t c=0; c<ncells; c++) {
+               size_t k = lu * ncells + c;
+               if (count[c] == 0)
+                  d[k] = fill;
+               else
+                  d[k] = (T)((stat == AGG_MEAN) ? acc[accOffset + k] / count[c] : acc[accOffset + k]);
+            }
+         }
+      }
+
       T (*get)(site*, size_t luType);
       T fill;
    };
 
+   ////////////////////////////////////////
+   //    Typedef: snapshot
+   //    One record of every registered
+   //    variable, gathered on the model
+   //    thread and written by the writer
+   ////////////////////////////////////////
+   struct snapshot {
+      char *data;
+      size_t recNo;
+   };
+
  public:
-   
+
    Outputter (UserData* data);
+   ~Outputter ();
 
-   template <class T> void registerVar (const char *name, T (*get)(site*), 
+   template <class T> void registerVar (const char *name, T (*get)(site*),
                                         const char *units, T fill, NcType dtype) {
       registeredVars.push_back(new Var<T>(std::string(name), get, units, fill, dtype));
    }
 
-   template <class T> void registerLUVar (const char *name, T (*get)(site*, size_t luType), 
+   template <class T> void registerLUVar (const char *name, T (*get)(site*, size_t luType),
                                           const char *units, T fill, NcType dtype) {
       registeredLUVars.push_back(new LUVar<T>(std::string(name), get, units, fill, dtype));
    }
 
-   void outputAll (site* firstsite);
+   void outputAll (unsigned int t, site* firstsite);
+   void flush ();
 
    template <class T> void outputRec (Var<T> *v, site* firstsite, bool isRec=true);
    template <class T> void outputLURec (LUVar<T> *v, site* firstsite, bool isRec=true);
 
-   template <class T> void outputSingle (const char *name, T (*get)(site*), 
+   template <class T> void outputSingle (const char *name, T (*get)(site*),
                                          const char *units, T fill, NcType dtype,
                                          site* firstsite) {
       Var<T> v(name, get, units, fill, dtype);
@@ -72,7 +183,8 @@ class Outputter {
    }
 
    std::string luShortName (size_t luType);
-   size_t recNo;
+   std::string cellMethods ();
+   size_t recNo;           ///< next record to be gathered
 
  private:
    template <class T>
@@ -81,13 +193,53 @@ class Outputter {
    template <class T>
       NcVar* getOrCreateLUVariable (LUVar<T> *v, size_t luType, bool isRec=true);
 
+   template <class T> void putVar (Var<T> *v, const char* snap, size_t rec, bool isRec);
+   template <class T> void putLUVar (LUVar<T> *v, const char* snap, size_t rec, bool isRec);
+   NcVar* addVar (const char* name, NcType dtype, bool isRec);
+   void setupLand (site* firstsite);
+   void layoutSnapshots (site* firstsite);
+   void gatherAll (char* snap, site* firstsite);
+   void accumulateAll (site* firstsite);
+   void resetAccumulators ();
+   void queueRecord (site* firstsite);
+   void writeSnapshot (const snapshot* s);
+   void writerLoop ();
+
    UserData *data;
    NcFile *outputFile;
    std::vector<VarBase *> registeredVars;
    std::vector<VarBase *> registeredLUVars;
 
+   // land only layout, see setupLand
+   bool landOnly;
+   bool landReady;
+   size_t nLand;                        ///< modelled cells
+   size_t recCells;                     ///< values per slab of a record, nLand or n_lat*n_lon
+   std::vector<size_t> siteSlot;        ///< land index of each site, in site list order
+
+   // temporal aggregation, see accumulateAll
+   int aggWindow;                       ///< records folded into each written record
+   int aggStat;                         ///< AGG_MEAN, AGG_MIN, AGG_MAX or AGG_SUM
+   int aggRecords;                      ///< records folded into the current window
+   unsigned int aggWindowNo;            ///< window of those records, t / (aggWindow*PRINTFREQ)
+   std::vector<double> acc;             ///< running statistic of every slot
+   std::vector<unsigned> accCount;      ///< records each cell contributed to the window
+
+   // background writer, see outputAll
+   snapshot snapshots[OUTPUT_SNAPSHOTS];
+   std::vector<snapshot *> freeSnaps;   ///< ready to be gathered into
+   std::vector<snapshot *> fullSnaps;   ///< waiting for the writer, oldest first
+   bool writing;                        ///< writer holds a snapshot
+   bool stopWriter;
+   std::mutex queueLock;
+   std::condition_variable queueCond;
+   std::thread writer;
+
+   // diagnostics
+   double gatherTime;      ///< model thread time spent gathering (s)
+   double stallTime;       ///< model thread time spent waiting for a free snapshot (s)
+   double writeTime;       ///< writer thread time spent writing (s)
 };
 
 
 #endif // EDM_OUTPUTTER_H_
-
@@ -12,6 +12,7 @@
 #include "cohort.h"
 #endif
 
+#include "ed_log.h"
 #include "patch.h"
 
 using namespace std;
@@ -100,13 +101,10 @@ void create_patch (site** siteptr, patch** pnewp, int landuse,
 
    site* current_site = *siteptr; /* assign pointer to site */
 
-   patch* newpatch = (patch*) malloc (sizeof(patch));
-   if (newpatch == NULL) {
-      fprintf(stderr, "create_patch: out of memory\n");
-      exit(1);
-   }
+   patch* newpatch = (patch*) pool_alloc(&current_site->patch_pool);
    
    /* assign patch attributes */
+   newpatch->id                 = current_site->next_patch_id++;
    newpatch->track              = track;
    newpatch->age                = age;   
    newpatch->area               = area; 
@@ -151,6 +149,7 @@ void create_patch (site** siteptr, patch** pnewp, int landuse,
    newpatch->theta              = newpatch->water / (current_site->sdata->soil_depth 
                                                      * current_site->sdata->theta_max);
    newpatch->total_water_uptake = 0.0;
+   newpatch->ode_step           = 0.0;
 
    /* assign elements of integration array */
    newpatch->fsc_e  = 1;
@@ -167,7 +166,7 @@ void create_patch (site** siteptr, patch** pnewp, int landuse,
    /*calloc array for disturbance A history and set pointers*/
    if (landuse == LU_SCND) { 
       /*allocate memory for array*/
-      double* parray = (double *) calloc(data->n_years_to_simulate + 1, sizeof(double));
+      double* parray = (double *) pool_alloc(&current_site->phistory_pool);
       /*initialize array*/
       for (size_t j=0; j<data->n_years_to_simulate+1; j++)
          *(parray + j) = 0.0;
@@ -292,8 +291,7 @@ void update_patch (patch** current_patch, UserData* data) {
 //! @param  
 //! @return 
 ////////////////////////////////////////////////////////////////////////////////
-void patch_dynamics ( unsigned int t, patch** patchptr, 
-                      FILE* outfile, UserData* data ) {
+void patch_dynamics ( unsigned int t, patch** patchptr, UserData* data ) {
  
    patch* youngest_patch = *patchptr;
    int lu = youngest_patch->landuse; // Store this in case youngest_patch gets deleted in fusion
@@ -306,7 +304,7 @@ void patch_dynamics ( unsigned int t, patch** patchptr,
 
          if(data->patch_fusion) {
             if(data->cd_file) {
-               fprintf(outfile, "fusing patches... \n");
+               log_printf(data->cd_log, currents->sdata->name_, "fusing patches... \n");
             }
             fuse_patches(t, &youngest_patch, data);
          }
@@ -315,7 +313,7 @@ void patch_dynamics ( unsigned int t, patch** patchptr,
 
          /*patch dynamics*/   
          if(data->cd_file) {
-            fprintf(outfile,"patch dynamics...  \n");
+            log_printf(data->cd_log, currents->sdata->name_, "patch dynamics...  \n");
          }
 
          currentp = youngest_patch;
@@ -436,14 +434,11 @@ void patch_dynamics ( unsigned int t, patch** patchptr,
                   cohort* currentc = currentp->shortest;
                   while (currentc != NULL) {                    
                      // make new cohort
-                     cohort* newcohort = (cohort*) malloc(sizeof(cohort));
-                     if (newcohort == NULL) {
-                        printf("pd: out of memory\n");
-                        while(getchar() != '\n');
-                     }
+                     cohort* newcohort = (cohort*) pool_alloc(&currents->cohort_pool);
                        
                      // copy cohort
                      copy_cohort(&currentc,&newcohort);
+                     newcohort->id = currents->next_cohort_id++;
       
                      // surviving indivs
                      newcohort->nindivs = currentc->survivorship_from_disturbance(q, data)
@@ -518,8 +513,8 @@ void patch_dynamics ( unsigned int t, patch** patchptr,
                terminate_cohorts(&target->tallest,&target->shortest,data);
             } else { /*not using track*/  
                if (newp->landuse == LU_SCND)
-                  free(newp->phistory);
-               free(newp); 
+                  pool_free(&currents->phistory_pool, newp->phistory);
+               pool_free(&currents->patch_pool, newp); 
             }
          } /* end loop over tracks */
 
@@ -540,7 +535,7 @@ void patch_dynamics ( unsigned int t, patch** patchptr,
          if(data->patch_termination) {
             /* patch termination */
             if(data->cd_file)
-               fprintf(outfile, "terminating patches \n");  
+               log_printf(data->cd_log, currents->sdata->name_, "terminating patches \n");  
 
             /* TODO: should this also be done for secondary? - justin */
             if (youngest_patch->landuse == LU_NTRL)
@@ -568,16 +563,7 @@ void fuse_patches (unsigned int t, patch** patchptr, UserData* data) {
    /*if within criterion, fuse, otherwise, skip*/
 
    patch* youngest_patch = *patchptr;
-   
-   char filename[256];
-   FILE* outfile;
-   if(data->fp_file) {
-      strcpy(filename,data->base_filename);
-      strcat(filename,".fp");
-      if (t==0) outfile=fopen(filename, "w");
-      else if(t != 0 && data->long_fp_file) outfile=fopen(filename, "a");
-      else outfile=fopen(filename, "w");    
-   }
+   const char* site_name = youngest_patch->siteptr->sdata->name_;
    
    /* loop over patches and create species size profiles */
    patch* currentp = youngest_patch;
@@ -632,7 +618,7 @@ void fuse_patches (unsigned int t, patch** patchptr, UserData* data) {
          /*fusion*/
          if (currentp->fuse_flag == 1) {
              if(data->fp_file)
-               fprintf(outfile,
+               log_printf(data->fp_log, site_name,
                     "fp: time %f FUSION donorp %p dt %u age %f area %f targetp %p dt %u age %f area %f\n",
                     t * TIMESTEP, currentp, currentp->track, currentp->age, currentp->area,
                     targetp, targetp->track, targetp->age, targetp->area);
@@ -641,7 +627,7 @@ void fuse_patches (unsigned int t, patch** patchptr, UserData* data) {
             fuse_2_patches(&currentp, &targetp, 1, data);
             currentp = tmpptr;
             if(data->fp_file)
-               fprintf(outfile,
+               log_printf(data->fp_log, site_name,
                     "fp: time %f FUSION RESULT p %p dt %u age %f area %f\n",
                     t * TIMESTEP, targetp, targetp->track, targetp->age, targetp->area);      
          } else {
@@ -654,8 +640,7 @@ void fuse_patches (unsigned int t, patch** patchptr, UserData* data) {
    }
 
    if(data->fp_file) {
-      fprintf(outfile,"fp: exiting fuse patches \n"); 
-      fclose(outfile);
+      log_printf(data->fp_log, site_name, "fp: exiting fuse patches \n"); 
    }
 }
 
@@ -774,11 +759,11 @@ void fuse_2_patches (patch** patchptr1, patch** patchptr2,
    bool stop = (cc == NULL);
    while (! stop) {
       if (cc->taller == NULL) {
-         free(cc);
+         pool_free(&dp->siteptr->cohort_pool, cc);
          stop = true;
       } else {
          cc = cc->taller;
-         free(cc->shorter);
+         pool_free(&dp->siteptr->cohort_pool, cc->shorter);
       }
    }
 #endif /* ED */
@@ -786,10 +771,10 @@ void fuse_2_patches (patch** patchptr1, patch** patchptr2,
 #if LANDUSE
    /*free the array if present as well*/
    if (dp->landuse == LU_SCND)
-      free(dp->phistory);
+      pool_free(&dp->siteptr->phistory_pool, dp->phistory);
 #endif  
 
-   free(dp);
+   pool_free(&dp->siteptr->patch_pool, dp);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -845,16 +830,16 @@ void terminate_patch (patch** patchptr) {
    while (cc != NULL) {
       if (cc->taller != NULL) {
          cc = cc->taller;
-         free(cc->shorter);
+         pool_free(&cp->siteptr->cohort_pool, cc->shorter);
       } else {
-         free(cc);
+         pool_free(&cp->siteptr->cohort_pool, cc);
          cc = NULL;
       }
    }
 #endif
    
    if (cp->landuse == LU_SCND) 
-      free(cp->phistory);
+      pool_free(&cp->siteptr->phistory_pool, cp->phistory);
 
    /* update links */
    if (cp->younger == NULL) 
@@ -866,7 +851,7 @@ void terminate_patch (patch** patchptr) {
    else
       cp->older->younger = cp->younger;
 
-   free(cp);
+   pool_free(&cp->siteptr->patch_pool, cp);
 }
 
 
@@ -908,6 +893,33 @@ void light_levels (patch** patchptr, UserData* data) {
    } /* end if */
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//! canopy_vm0
+//! Downregulated Vm0, its mechanism bin and the light bin for every cohort
+//! of a patch.
+//! LAI above each cohort is accumulated as a running sum from the top of
+//! the canopy, so the patch costs O(n) rather than a walk per cohort.
+//!
+//! @param  patchptr patch
+//! @param  data Userdata structure
+//! @return Nothing, updates cohort Vm0, Vm0_bin and light_index
+////////////////////////////////////////////////////////////////////////////////
+void canopy_vm0 (patch** patchptr, UserData* data) {
+
+   patch* cp = *patchptr;
+   double lai_above = 0.0;
+
+   cohort* cc = cp->tallest;
+   while (cc != NULL) {
+      // half of the cohort's own LAI shades it, see get_cohort_vm0
+      cc->downregulate_vm0(lai_above + cc->lai/2.0, data);
+      cc->Vm0_bin = cc->get_cohort_vm0_bin(cc->Vm0, data);
+      cc->set_light_index(data);
+      lai_above += cc->lai;
+      cc = cc->shorter;
+   }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //! species_patch_size_profile
 //! binned patch size profiles
@@ -58,6 +58,7 @@ struct patch {
    int fire_as_dndt_flag;
    double fire_dndt_factor;
     
+   unsigned int id;           ///< unique within the site, see state_dump.cc
    unsigned int track;        ///< Disturbance track id. track = 1 if fire was
                               ///< last disturbance, equals 0 otherwise, i.e.
                               ///< if treefall was last disturbance
@@ -128,6 +129,8 @@ struct patch {
    double old_fast_soil_N;
    double old_passive_soil_C;
    double old_structural_soil_L; 
+
+   double ode_step;          ///< last step size of the adaptive integrator (yrs), 0 if unset
 #endif // ED
 
    // landuse
@@ -179,8 +182,7 @@ void create_patch (site** siteptr, patch** pnewp, int landuse,
                    double stsc, double tb, UserData* data);
 #endif
 void update_patch (patch** current_patch, UserData* data);
-void patch_dynamics (unsigned int t, patch** patchptr, 
-                     FILE* outfile, UserData* data);
+void patch_dynamics (unsigned int t, patch** patchptr, UserData* data);
 void terminate_patches (patch** patchptr, UserData* data);
 void terminate_patch (patch** patchptr);
 void fuse_patches (unsigned int t, patch** patchptr, UserData* data);
@@ -190,6 +192,7 @@ void calculate_patch_disturbance_rates (unsigned int t,
                                         patch** current_patch, 
                                         UserData* data);
 void light_levels(patch** patchptr, UserData* data);
+void canopy_vm0(patch** patchptr, UserData* data);
 void species_patch_size_profile (patch** pcurrentp,
                                  unsigned int nbins, UserData* data);
 
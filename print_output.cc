@@ -13,6 +13,10 @@
 #if LANDUSE
 #include "landuse.h"
 #endif
+#if TBB
+#include "tbb/parallel_reduce.h"
+#include "tbb/blocked_range.h"
+#endif
 
 #include "print_output.h"
 
@@ -322,7 +326,7 @@ void print_region_files (unsigned int t, site** firsts, UserData* data) {
    if(!data->is_site) {
       /* if(((t >= n*PRINTFREQ) && (t < n*PRINTFREQ + N_CLIMATE ))){*/
       if (t % PRINTFREQ == 0) {
-         data->outputter->outputAll(*firsts);
+         data->outputter->outputAll(t, *firsts);
       } 
    } /*REGION*/  
 }
@@ -370,6 +374,7 @@ void print_soi_files (unsigned int t, site** current_site,
          print_landuse(t, current_site, data);
          print_harvest(t, current_site, data);
 #endif  
+         soi_flush(cs->soi_out); // files stay open, keep them current
       }
    }
 }
@@ -403,12 +408,12 @@ FILE* open_landuse_file (unsigned int t, int lu, const char* fname, int bypatch,
       sprintf(filename, "%s.%s.%s.%s", data->base_filename, cs->sdata->name_, luname, fname);
 
    if (bypatch && ! data->long_patch_file) {
-      outfile = fopen(filename, "w");
+      outfile = soi_open(cs->soi_out, filename, "w");
    } else {
       if (t == 0)
-         outfile = fopen(filename, "w");
+         outfile = soi_open(cs->soi_out, filename, "w");
       else
-         outfile = fopen(filename, "a");
+         outfile = soi_open(cs->soi_out, filename, "a");
    }
 
    return outfile;
@@ -450,7 +455,7 @@ void print_light_levels (site** siteptr, unsigned int time,
          }
          cp=cp->older;
       }
-      fclose(outfile);
+      soi_close(cs->soi_out, outfile);
    }
 }
 
@@ -478,9 +483,9 @@ void print_water (unsigned int time, site** siteptr, UserData* data) {
    strcat(filename,".water");
 
    if(time==0)
-      outfile=fopen(filename,"w");
+      outfile=soi_open(cs->soi_out, filename, "w");
    else
-      outfile=fopen(filename,"a");
+      outfile=soi_open(cs->soi_out, filename, "a");
    
    fprintf(outfile,
            "%s t= %f theta= %f w= %f rain= %f uptake= %f demand= %f perc= %f soil_evap= %f pet= %f\n",
@@ -489,7 +494,7 @@ void print_water (unsigned int time, site** siteptr, UserData* data) {
            cs->site_total_water_demand, cs->site_total_perc,
            cs->site_total_soil_evap, cs->sdata->pet[data->time_period]);
 
-   fclose(outfile);   
+   soi_close(cs->soi_out, outfile);   
 
    for (lu=0; lu<N_LANDUSE_TYPES; lu++) {
 
@@ -503,7 +508,7 @@ void print_water (unsigned int time, site** siteptr, UserData* data) {
               cs->total_water_demand[lu], cs->perc[lu], cs->soil_evap[lu],
               cs->sdata->pet[data->time_period]);
  
-      fclose(outfile);
+      soi_close(cs->soi_out, outfile);
  
       outfile = open_landuse_file(time, lu, "water", 1, siteptr, data);
       cp = cs->youngest_patch[lu];
@@ -519,7 +524,7 @@ void print_water (unsigned int time, site** siteptr, UserData* data) {
 
          cp = cp->older;
       }
-      fclose(outfile);
+      soi_close(cs->soi_out, outfile);
    }
 }
 #endif /* ED */
@@ -549,9 +554,9 @@ void print_cfluxes (unsigned int time, site** siteptr, UserData* data) {
    strcat(filename, ".cfluxes");
 
    if (time == 0)
-      outfile = fopen(filename,"w");
+      outfile = soi_open(cs->soi_out, filename, "w");
    else
-      outfile = fopen(filename,"a");
+      outfile = soi_open(cs->soi_out, filename, "a");
  
 #ifdef ED
    fprintf(outfile,
@@ -564,7 +569,7 @@ void print_cfluxes (unsigned int time, site** siteptr, UserData* data) {
            cs->sdata->name_, time*TIMESTEP, cs->site_npp, cs->site_rh, cs->site_nep,
            cs->site_dndt);
 #endif 
-   fclose(outfile);
+   soi_close(cs->soi_out, outfile);
 
    for (lu=0; lu<N_LANDUSE_TYPES; lu++) {
       /* total biomass by landuse */
@@ -583,7 +588,7 @@ void print_cfluxes (unsigned int time, site** siteptr, UserData* data) {
           cs->dndt[lu]);
 #endif
 
-      fclose(outfile);
+      soi_close(cs->soi_out, outfile);
 
       outfile = open_landuse_file(time, lu, "cfluxes", 1, siteptr, data);
 
@@ -603,7 +608,7 @@ void print_cfluxes (unsigned int time, site** siteptr, UserData* data) {
          cp = cp->older;    
       }  /* end loop over patches */
  
-      fclose(outfile);
+      soi_close(cs->soi_out, outfile);
    }
  
    /***********************/
@@ -619,9 +624,9 @@ void print_cfluxes (unsigned int time, site** siteptr, UserData* data) {
       strcat(filename, ".aa.cfluxes");
    
       if (time == N_CLIMATE-1)
-         outfile = fopen(filename, "w");
+         outfile = soi_open(cs->soi_out, filename, "w");
       else
-         outfile = fopen(filename, "a");
+         outfile = soi_open(cs->soi_out, filename, "a");
 
       /* print site level annual averages to file */
 #if defined ED
@@ -635,7 +640,7 @@ void print_cfluxes (unsigned int time, site** siteptr, UserData* data) {
               cs->sdata->name_, time*TIMESTEP, cs->site_aa_npp, cs->site_aa_rh,
               cs->site_aa_nep, cs->site_nep2);
 #endif
-      fclose(outfile);
+      soi_close(cs->soi_out, outfile);
 
       for (lu=0; lu<N_LANDUSE_TYPES; lu++) {
          /* total biomass by landuse */
@@ -647,9 +652,9 @@ void print_cfluxes (unsigned int time, site** siteptr, UserData* data) {
          strcat(filename, luname);
         
          if (time == N_CLIMATE - 1)
-            outfile = fopen(filename, "w");
+            outfile = soi_open(cs->soi_out, filename, "w");
          else
-            outfile = fopen(filename, "a");
+            outfile = soi_open(cs->soi_out, filename, "a");
  
 #if defined ED
          fprintf(outfile,
@@ -663,7 +668,7 @@ void print_cfluxes (unsigned int time, site** siteptr, UserData* data) {
                  cs->aa_nep[lu], cs->nep2[lu]);
 #endif
 
-         fclose(outfile);
+         soi_close(cs->soi_out, outfile);
 
          strcpy(filename, data->base_filename);
          strcat(filename, ".");
@@ -673,11 +678,11 @@ void print_cfluxes (unsigned int time, site** siteptr, UserData* data) {
  
          if(data->long_patch_file) {
             if (time == N_CLIMATE - 1)
-               outfile = fopen(filename, "w");
+               outfile = soi_open(cs->soi_out, filename, "w");
             else
-               outfile = fopen(filename, "a");
+               outfile = soi_open(cs->soi_out, filename, "a");
          } else {
-            outfile = fopen(filename, "w");
+            outfile = soi_open(cs->soi_out, filename, "w");
          }
      
          cp = cs->youngest_patch[lu];
@@ -696,7 +701,7 @@ void print_cfluxes (unsigned int time, site** siteptr, UserData* data) {
             cp = cp->older;    
          }  /* end loop over patches */
  
-         fclose(outfile);
+         soi_close(cs->soi_out, outfile);
       } /* end loop over landuse */
    } /* end if on time period */
 }
@@ -730,9 +735,9 @@ void print_soil_pools (unsigned int time, site** siteptr,
    strcat(filename,".sc");
    
    if (time == 0)
-      outfile = fopen(filename, "w");
+      outfile = soi_open(cs->soi_out, filename, "w");
    else
-      outfile = fopen(filename, "a");
+      outfile = soi_open(cs->soi_out, filename, "a");
 
    /* print to files */
 #if defined ED
@@ -753,7 +758,7 @@ void print_soil_pools (unsigned int time, site** siteptr,
       fprintf(outfile, "\n");
    }
  
-   fclose(outfile);
+   soi_close(cs->soi_out, outfile);
  
    for (lu=0; lu<N_LANDUSE_TYPES; lu++) {
       outfile = open_landuse_file(time, lu, "sc", 0, siteptr, data);
@@ -771,7 +776,7 @@ void print_soil_pools (unsigned int time, site** siteptr,
               cs->fast_soil_C[lu], cs->structural_soil_C[lu]);
 #endif
 
-      fclose(outfile);
+      soi_close(cs->soi_out, outfile);
 
       outfile = open_landuse_file(time, lu, "sc", 1, siteptr, data);
 
@@ -793,7 +798,7 @@ void print_soil_pools (unsigned int time, site** siteptr,
        
          cp = cp->older;    
       }  /* end loop over patches */
-      fclose(outfile);
+      soi_close(cs->soi_out, outfile);
    } /* end loop over landuse */
 }
 
@@ -824,9 +829,9 @@ void print_biomass (unsigned int time, site** siteptr, UserData* data) {
    strcat(filename,".biomass");
 
    if (time == 0)
-      outfile = fopen(filename,"w");
+      outfile = soi_open(cs->soi_out, filename, "w");
    else
-      outfile = fopen(filename,"a");
+      outfile = soi_open(cs->soi_out, filename, "a");
 
    /* print to files */
    cp = *cs->oldest_patch;
@@ -855,7 +860,7 @@ void print_biomass (unsigned int time, site** siteptr, UserData* data) {
            cs->site_total_biomass, cs->site_total_ag_biomass);
 #endif
 
-   fclose(outfile);
+   soi_close(cs->soi_out, outfile);
  
 
    for (lu=0; lu<N_LANDUSE_TYPES; lu++) {
@@ -884,7 +889,7 @@ void print_biomass (unsigned int time, site** siteptr, UserData* data) {
               cs->total_biomass[lu], cs->total_ag_biomass[lu]);
 #endif
 
-      fclose(outfile);
+      soi_close(cs->soi_out, outfile);
 
       outfile = open_landuse_file(time, lu, "biomass", 1, siteptr, data);
  
@@ -921,7 +926,7 @@ void print_biomass (unsigned int time, site** siteptr, UserData* data) {
          cp = cp->older;
       }  /* end loop over patches */
  
-      fclose(outfile);
+      soi_close(cs->soi_out, outfile);
    }
 }
 
@@ -949,9 +954,9 @@ void print_harvest (unsigned int time, site** siteptr, UserData* data) {
    strcat(filename,".harvest");
  
    if (time == 0)
-      outfile=fopen(filename,"w");
+      outfile=soi_open(cs->soi_out, filename, "w");
    else
-      outfile=fopen(filename,"a");
+      outfile=soi_open(cs->soi_out, filename, "a");
 
   area = cs->sdata->grid_cell_area * KM2_PER_M2;
   /* TODO: this doesn't work with sbh3 added in LUH glm output -justin */
@@ -966,7 +971,7 @@ void print_harvest (unsigned int time, site** siteptr, UserData* data) {
           cs->biomass_harvested[LU_NTRL][0] * cs->sdata->grid_cell_area / data->area * T_PER_KG,
           cs->biomass_harvested[LU_SCND][1] * cs->sdata->grid_cell_area / data->area * T_PER_KG,
           cs->biomass_harvested[LU_NTRL][1] * cs->sdata->grid_cell_area / data->area * T_PER_KG);
-  fclose(outfile);
+  soi_close(cs->soi_out, outfile);
 }
 #endif
 
@@ -991,9 +996,9 @@ void print_area_burned (unsigned int time, site** siteptr,
    strcat(filename,".area_burned");
  
    if (time == 0)
-      outfile = fopen(filename, "w");
+      outfile = soi_open(cs->soi_out, filename, "w");
    else
-      outfile = fopen(filename, "a");
+      outfile = soi_open(cs->soi_out, filename, "a");
  
    fprintf(outfile, "%s t= %5.2f site_area %f area_burned %f\n",
            cs->sdata->name_,
@@ -1001,7 +1006,7 @@ void print_area_burned (unsigned int time, site** siteptr,
            cs->sdata->grid_cell_area * KM2_PER_M2,
            cs->area_burned / data->area * cs->sdata->grid_cell_area * KM2_PER_M2);
    
-   fclose(outfile);
+   soi_close(cs->soi_out, outfile);
 }
 
 
@@ -1039,9 +1044,9 @@ void print_diagnostics (unsigned int time, site** siteptr,
    strcat(filename, cs->sdata->name_);
    strcat(filename, ".diagnostics");
    if (time == 0)
-      outfile = fopen(filename, "w");
+      outfile = soi_open(cs->soi_out, filename, "w");
    else
-      outfile = fopen(filename, "a");
+      outfile = soi_open(cs->soi_out, filename, "a");
 
    fprintf(outfile, "site %s time %f ", cs->sdata->name_, time * TIMESTEP);
 
@@ -1078,7 +1083,7 @@ void print_diagnostics (unsigned int time, site** siteptr,
               cs->disturbance_rate[0][0],
               cs->disturbance_rate[1][0]);
 #endif
-      fclose(outfile);
+      soi_close(cs->soi_out, outfile);
 
       total_patches += npatches;
 #ifdef ED
@@ -1093,7 +1098,7 @@ void print_diagnostics (unsigned int time, site** siteptr,
    fprintf(outfile, "t_patches %d \n",
            total_patches);
 #endif
-   fclose(outfile);
+   soi_close(cs->soi_out, outfile);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1127,11 +1132,11 @@ void print_patches (unsigned int time, site** siteptr, UserData* data) {
 
       if(data->long_patch_file) {
          if (time == 0)
-            patchfile = fopen(filename, "w");
+            patchfile = soi_open(cs->soi_out, filename, "w");
          else
-            patchfile = fopen(filename, "a");
+            patchfile = soi_open(cs->soi_out, filename, "a");
       } else {
-         patchfile = fopen(filename, "w");
+         patchfile = soi_open(cs->soi_out, filename, "w");
       }
  
  
@@ -1165,7 +1170,7 @@ void print_patches (unsigned int time, site** siteptr, UserData* data) {
 #endif
          cp = cp->older;
       }
-      fclose(patchfile);
+      soi_close(cs->soi_out, patchfile);
    }
 }
 
@@ -1433,11 +1438,11 @@ void print_cohorts (unsigned int time, site** siteptr, UserData* data) {
 
       if(data->long_cohort_file) {
          if (time==0)   
-            cohortfile = fopen(filename, "w");
+            cohortfile = soi_open(cs->soi_out, filename, "w");
          else
-            cohortfile = fopen(filename, "a");
+            cohortfile = soi_open(cs->soi_out, filename, "a");
       } else {
-         cohortfile = fopen(filename, "w");
+         cohortfile = soi_open(cs->soi_out, filename, "w");
       }
  
       cp = cs->oldest_patch[LU_NTRL];
@@ -1486,7 +1491,7 @@ void print_cohorts (unsigned int time, site** siteptr, UserData* data) {
          }
          cp = cp->younger;
       }
-      fclose(cohortfile);
+      soi_close(cs->soi_out, cohortfile);
    }
 }
 
@@ -1514,8 +1519,8 @@ void print_nitrogen_budget(unsigned int time, site** currents, UserData* data){
    strcat(filename,".");
    strcat(filename,siteptr->sdata->name_);
    strcat(filename,".nbudget");
-   if(time==0) nbudgetfile=fopen(filename,"w");
-   else nbudgetfile=fopen(filename,"a");
+   if(time==0) nbudgetfile=soi_open(siteptr->soi_out, filename, "w");
+   else nbudgetfile=soi_open(siteptr->soi_out, filename, "a");
 
    currentp = siteptr->oldest_patch[LU_NTRL];
 
@@ -1547,157 +1552,255 @@ void print_nitrogen_budget(unsigned int time, site** currents, UserData* data){
  
    /* printf("t= %f n_veg= %f n_soil= %f n_total= %f\n",time*TIMESTEP,n_veg,n_soil,n_total); */
 
-   fclose(nbudgetfile);
+   soi_close(siteptr->soi_out, nbudgetfile);
 
    return;
 }
 #endif /* ED */
 
+////////////////////////////////////////
+//    Typedef: domain_totals
+//    Domain sums for print_domain_stats.
+//    Also a body for parallel_reduce:
+//    each split sums a range of site_arr
+//    and the pieces are joined.
+////////////////////////////////////////
+struct domain_totals {
+   site** site_arr;
+   UserData* data;
+   int n;
+   double area_modeled;
+   double area_burned;
+   double biomass;
+   double ag_biomass;
+   double soil_sc;
+   double nep2;
+#if LANDUSE
+   double area_lu[N_LANDUSE_TYPES];
+   double biomass_lu[N_LANDUSE_TYPES];
+   double agb_lu[N_LANDUSE_TYPES];
+   double sc_lu[N_LANDUSE_TYPES];
+   double area_forest;
+   double biomass_forest;
+   double agb_forest;
+   double sc_forest;
+   double forest_dndt;
+   double biomass_for_sec;
+   double agb_forest_sec;
+   double sc_forest_sec;
+   double mean_AGE_sec;
+   double area_harvested_secondary;
+   double area_harvested_virgin;
+   double area_harvested_virgin_vbh2;
+   double area_harvested_secondary_sbh2;
+   double biomass_harvested_secondary;
+   double biomass_harvested_virgin;
+   double biomass_harvested_virgin_vbh2;
+   double biomass_harvested_secondary_sbh2;
+#endif /* LANDUSE */
+   double hurr_litter;
+
+   domain_totals (site** site_arr, UserData* data) : site_arr(site_arr), data(data) {
+      clear();
+   }
+#if TBB
+   domain_totals (domain_totals& other, tbb::split) 
+      : site_arr(other.site_arr), data(other.data) {
+      clear();
+   }
+   void operator() (const tbb::blocked_range<size_t>& r) {
+      for (size_t i=r.begin(); i!=r.end(); ++i) {
+         add_site(site_arr[i]);
+      }
+   }
+#endif
+   void clear ();
+   void add_site (site* cs);
+   void join (const domain_totals& rhs);
+};
+
 ////////////////////////////////////////////////////////////////////////////////
-//! print_domain_stats
-//! 
+//! domain_totals::clear
+//! Zero all sums
 //!
 //! @param  
 //! @return 
 ////////////////////////////////////////////////////////////////////////////////
-void print_domain_stats (unsigned int t, site** sitrptr, UserData* data) {
-   site* cs;
-   FILE *outfile;
+void domain_totals::clear () {
+   n                               = 0;
+   area_modeled                    = 0.0;
+   area_burned                     = 0.0;
+   biomass                         = 0.0;
+   ag_biomass                      = 0.0;
+   soil_sc                         = 0.0;
+   nep2                            = 0.0;
 #if LANDUSE
-   char luname[STR_LEN];
-#endif
-   char filename[STR_LEN];
-   double area, scale_factor;
-   int n = 0;
-   double total_area_modeled                     = 0.0;
-   double total_area_burned                      = 0.0;
-   double total_biomass                          = 0.0;
-   double total_ag_biomass                       = 0.0;
-   double total_soil_sc                          = 0.0;
-   double total_nep2                             = 0.0;
-#if LANDUSE
-   int lu;
-   double total_area_lu[N_LANDUSE_TYPES];
-   double total_biomass_lu[N_LANDUSE_TYPES];
-   double total_agb_lu[N_LANDUSE_TYPES];
-   double total_sc_lu[N_LANDUSE_TYPES];
-   double total_area_forest                      = 0.0;
-   double total_biomass_forest                   = 0.0;
-   double total_agb_forest                       = 0.0;
-   double total_sc_forest                        = 0.0;
-   double total_forest_dndt                      = 0.0;
-   double total_biomass_for_sec                  = 0.0;
-   double total_agb_forest_sec                   = 0.0;
-   double total_sc_forest_sec                    = 0.0;
-   double mean_AGE_sec                           = 0.0;
-   double total_area_harvested_secondary         = 0.0;
-   double total_area_harvested_virgin            = 0.0;
-   double total_area_harvested_virgin_vbh2       = 0.0;
-   double total_area_harvested_secondary_sbh2    = 0.0;
-   double total_biomass_harvested_secondary      = 0.0;
-   double total_biomass_harvested_virgin         = 0.0;
-   double total_biomass_harvested_virgin_vbh2    = 0.0;
-   double total_biomass_harvested_secondary_sbh2 = 0.0;
-#if 0
-   double total_biomass_harvested_unmet_vbh      = 0.0;
-   double total_biomass_harvested_unmet_vbh2     = 0.0;
-   double total_biomass_harvested_unmet_sbh      = 0.0;
-   double total_biomass_harvested_unmet_sbh2     = 0.0;
-#endif
-#endif /* LANDUSE */
-   double hurr_litter                            = 0.0;
-
-#if LANDUSE
-   for (lu=0; lu<N_LANDUSE_TYPES; lu++) {
-      total_area_lu[lu]                          = 0.0;
-      total_biomass_lu[lu]                       = 0.0;
-      total_agb_lu[lu]                           = 0.0;
-      total_sc_lu[lu]                            = 0.0;
+   for (int lu=0; lu<N_LANDUSE_TYPES; lu++) {
+      area_lu[lu]                  = 0.0;
+      biomass_lu[lu]               = 0.0;
+      agb_lu[lu]                   = 0.0;
+      sc_lu[lu]                    = 0.0;
    }
-#endif
+   area_forest                     = 0.0;
+   biomass_forest                  = 0.0;
+   agb_forest                      = 0.0;
+   sc_forest                       = 0.0;
+   forest_dndt                     = 0.0;
+   biomass_for_sec                 = 0.0;
+   agb_forest_sec                  = 0.0;
+   sc_forest_sec                   = 0.0;
+   mean_AGE_sec                    = 0.0;
+   area_harvested_secondary        = 0.0;
+   area_harvested_virgin           = 0.0;
+   area_harvested_virgin_vbh2      = 0.0;
+   area_harvested_secondary_sbh2   = 0.0;
+   biomass_harvested_secondary     = 0.0;
+   biomass_harvested_virgin        = 0.0;
+   biomass_harvested_virgin_vbh2   = 0.0;
+   biomass_harvested_secondary_sbh2= 0.0;
+#endif /* LANDUSE */
+   hurr_litter                     = 0.0;
+}
 
-   /* TODO: this doesn't handle sbh3 -justin */
-   cs = *sitrptr;
-   while (cs != NULL) {
-      n++;
+////////////////////////////////////////////////////////////////////////////////
+//! domain_totals::add_site
+//! Add one site to the sums
+//!
+//! @param  cs site
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void domain_totals::add_site (site* cs) {
+   n++;
    
-      area = cs->sdata->grid_cell_area * KM2_PER_M2;
-      scale_factor = cs->sdata->grid_cell_area * T_PER_KG * GT_PER_T;
+   double area = cs->sdata->grid_cell_area * KM2_PER_M2;
+   double scale_factor = cs->sdata->grid_cell_area * T_PER_KG * GT_PER_T;
 
-      /*ALL LAND*/
-      total_area_modeled += area;
-      total_area_burned += cs->area_burned / data->c2b * area;
-      total_biomass += cs->site_total_biomass * scale_factor;
-      total_ag_biomass += cs->site_total_ag_biomass * scale_factor;
-      total_soil_sc += cs->site_total_soil_c * scale_factor;
-      total_nep2 += cs->site_nep2 * scale_factor;
+   /*ALL LAND*/
+   area_modeled += area;
+   area_burned += cs->area_burned / data->c2b * area;
+   biomass += cs->site_total_biomass * scale_factor;
+   ag_biomass += cs->site_total_ag_biomass * scale_factor;
+   soil_sc += cs->site_total_soil_c * scale_factor;
+   nep2 += cs->site_nep2 * scale_factor;
 
 #if LANDUSE
-      /*FOREST*/ 
-      if (cs->forest_harvest_flag == 1) {
-         total_area_forest += (cs->area_fraction[LU_NTRL] + cs->area_fraction[LU_SCND]) * area;
-         total_biomass_forest += (cs->total_biomass[LU_NTRL] * cs->area_fraction[LU_NTRL]
-                                  + cs->total_biomass[LU_SCND] * cs->area_fraction[LU_SCND]) * scale_factor;
-         total_agb_forest += (cs->total_ag_biomass[LU_NTRL] * cs->area_fraction[LU_NTRL]
-                              + cs->total_ag_biomass[LU_SCND] * cs->area_fraction[LU_SCND]) * scale_factor;
-         total_sc_forest += (cs->total_soil_c[LU_NTRL] * cs->area_fraction[LU_NTRL]
-                             + cs->total_soil_c[LU_SCND] * cs->area_fraction[LU_SCND]) * scale_factor;
-         total_forest_dndt += (cs->dndt[LU_NTRL] * cs->area_fraction[LU_NTRL]
-                               + cs->dndt[LU_SCND] * cs->area_fraction[LU_SCND]) * scale_factor;
-
-         total_biomass_for_sec += (cs->total_biomass[LU_SCND] * cs->area_fraction[LU_SCND]) * scale_factor;
-         total_agb_forest_sec += (cs->total_ag_biomass[LU_SCND] * cs->area_fraction[LU_SCND]) * scale_factor;
-         total_sc_forest_sec += (cs->total_soil_c[LU_SCND] * cs->area_fraction[LU_SCND]) * scale_factor;
-      }
-#endif
+   /*FOREST*/ 
+   if (cs->forest_harvest_flag == 1) {
+      area_forest += (cs->area_fraction[LU_NTRL] + cs->area_fraction[LU_SCND]) * area;
+      biomass_forest += (cs->total_biomass[LU_NTRL] * cs->area_fraction[LU_NTRL]
+                         + cs->total_biomass[LU_SCND] * cs->area_fraction[LU_SCND]) * scale_factor;
+      agb_forest += (cs->total_ag_biomass[LU_NTRL] * cs->area_fraction[LU_NTRL]
+                     + cs->total_ag_biomass[LU_SCND] * cs->area_fraction[LU_SCND]) * scale_factor;
+      sc_forest += (cs->total_soil_c[LU_NTRL] * cs->area_fraction[LU_NTRL]
+                    + cs->total_soil_c[LU_SCND] * cs->area_fraction[LU_SCND]) * scale_factor;
+      forest_dndt += (cs->dndt[LU_NTRL] * cs->area_fraction[LU_NTRL]
+                      + cs->dndt[LU_SCND] * cs->area_fraction[LU_SCND]) * scale_factor;
+
+      biomass_for_sec += (cs->total_biomass[LU_SCND] * cs->area_fraction[LU_SCND]) * scale_factor;
+      agb_forest_sec += (cs->total_ag_biomass[LU_SCND] * cs->area_fraction[LU_SCND]) * scale_factor;
+      sc_forest_sec += (cs->total_soil_c[LU_SCND] * cs->area_fraction[LU_SCND]) * scale_factor;
+   }
 
+   for (int lu=0; lu<N_LANDUSE_TYPES; lu++) {
+      area_lu[lu] += cs->area_fraction[lu] * area;
+      biomass_lu[lu] += cs->total_biomass[lu] * cs->area_fraction[lu] * scale_factor;
+      agb_lu[lu] += cs->total_ag_biomass[lu] * cs->area_fraction[lu] * scale_factor;
+      sc_lu[lu] += cs->total_soil_c[lu] * cs->area_fraction[lu] * scale_factor;
+   }
+   mean_AGE_sec += cs->mean_AGE_sec * cs->area_fraction[LU_SCND] * cs->sdata->grid_cell_area;
+
+   /* TODO: fix to work with vbh/sbh arrays */
+   area_harvested_secondary += cs->area_harvested[LU_SCND][0] / data->area * area;
+   area_harvested_virgin += cs->area_harvested[LU_NTRL][0] / data->area * area;
+   area_harvested_secondary_sbh2 += cs->area_harvested[LU_SCND][1] / data->area * area;
+   area_harvested_virgin_vbh2 += cs->area_harvested[LU_NTRL][1] / data->area * area;
+   biomass_harvested_secondary += cs->biomass_harvested[LU_SCND][0] / data->area * scale_factor;
+   biomass_harvested_virgin += cs->biomass_harvested[LU_NTRL][0] / data->area * scale_factor;
+   biomass_harvested_secondary_sbh2 += cs->biomass_harvested[LU_SCND][1] / data->area * scale_factor;
+   biomass_harvested_virgin_vbh2 += cs->biomass_harvested[LU_NTRL][1] / data->area * scale_factor;
+#endif /* LANDUSE */
+
+   if(data->do_hurricane) {
+      hurr_litter += cs->hurricane_litter * T_PER_KG * cs->sdata->grid_cell_area * GT_PER_T;
+   }
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//! domain_totals::join
+//! Add the sums of another range of sites
+//!
+//! @param  rhs sums to add
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void domain_totals::join (const domain_totals& rhs) {
+   n                                += rhs.n;
+   area_modeled                     += rhs.area_modeled;
+   area_burned                      += rhs.area_burned;
+   biomass                          += rhs.biomass;
+   ag_biomass                       += rhs.ag_biomass;
+   soil_sc                          += rhs.soil_sc;
+   nep2                             += rhs.nep2;
 #if LANDUSE
-      for (lu=0; lu<N_LANDUSE_TYPES; lu++) {
-         total_area_lu[lu] += cs->area_fraction[lu] * area;
-         total_biomass_lu[lu] += cs->total_biomass[lu] * cs->area_fraction[lu] * scale_factor;
-         total_agb_lu[lu] += cs->total_ag_biomass[lu] * cs->area_fraction[lu] * scale_factor;
-         total_sc_lu[lu] += cs->total_soil_c[lu] * cs->area_fraction[lu] * scale_factor;
+   for (int lu=0; lu<N_LANDUSE_TYPES; lu++) {
+      area_lu[lu]                   += rhs.area_lu[lu];
+      biomass_lu[lu]                += rhs.biomass_lu[lu];
+      agb_lu[lu]                    += rhs.agb_lu[lu];
+      sc_lu[lu]                     += rhs.sc_lu[lu];
+   }
+   area_forest                      += rhs.area_forest;
+   biomass_forest                   += rhs.biomass_forest;
+   agb_forest                       += rhs.agb_forest;
+   sc_forest                        += rhs.sc_forest;
+   forest_dndt                      += rhs.forest_dndt;
+   biomass_for_sec                  += rhs.biomass_for_sec;
+   agb_forest_sec                   += rhs.agb_forest_sec;
+   sc_forest_sec                    += rhs.sc_forest_sec;
+   mean_AGE_sec                     += rhs.mean_AGE_sec;
+   area_harvested_secondary         += rhs.area_harvested_secondary;
+   area_harvested_virgin            += rhs.area_harvested_virgin;
+   area_harvested_virgin_vbh2       += rhs.area_harvested_virgin_vbh2;
+   area_harvested_secondary_sbh2    += rhs.area_harvested_secondary_sbh2;
+   biomass_harvested_secondary      += rhs.biomass_harvested_secondary;
+   biomass_harvested_virgin         += rhs.biomass_harvested_virgin;
+   biomass_harvested_virgin_vbh2    += rhs.biomass_harvested_virgin_vbh2;
+   biomass_harvested_secondary_sbh2 += rhs.biomass_harvested_secondary_sbh2;
+#endif /* LANDUSE */
+   hurr_litter                      += rhs.hurr_litter;
+}
 
-      }
-      mean_AGE_sec += cs->mean_AGE_sec * cs->area_fraction[LU_SCND] * cs->sdata->grid_cell_area;
-
-      /* TODO: fix to work with vbh/sbh arrays */
-      total_area_harvested_secondary += cs->area_harvested[LU_SCND][0] / data->area * area;
-      total_area_harvested_virgin += cs->area_harvested[LU_NTRL][0] / data->area * area;
-      total_area_harvested_secondary_sbh2 += cs->area_harvested[LU_SCND][1] / data->area * area;
-      total_area_harvested_virgin_vbh2 += cs->area_harvested[LU_NTRL][1] / data->area * area;
-      total_biomass_harvested_secondary += cs->biomass_harvested[LU_SCND][0]
-         / data->area * scale_factor;
-      total_biomass_harvested_virgin += cs->biomass_harvested[LU_NTRL][0] / data->area * scale_factor;
-      total_biomass_harvested_secondary_sbh2 += cs->biomass_harvested[LU_SCND][1]
-         / data->area * scale_factor;
-      total_biomass_harvested_virgin_vbh2 += cs->biomass_harvested[LU_NTRL][1]
-         / data->area * scale_factor;
-#if 0
-      /*already scaled to total area in landuse.c*/
-      total_biomass_harvested_unmet_vbh += cs->biomass_harvested_unmet[LU_NTRL][0]
-         * T_PER_KG * GT_PER_T;
-      total_biomass_harvested_unmet_vbh2 += cs->biomass_harvested_unmet[LU_NTRL][1]
-         * T_PER_KG * GT_PER_T;
-      total_biomass_harvested_unmet_sbh += cs->biomass_harvested_unmet[LU_SCND][0]
-         * T_PER_KG * GT_PER_T;
-      total_biomass_harvested_unmet_sbh2+=cs->biomass_harvested_unmet[LU_SCND][1]
-         * T_PER_KG * GT_PER_T;
+////////////////////////////////////////////////////////////////////////////////
+//! print_domain_stats
+//! 
+//!
+//! @param  
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void print_domain_stats (unsigned int t, site** sitrptr, UserData* data) {
+   FILE *outfile;
+#if LANDUSE
+   int lu;
+   char luname[STR_LEN];
 #endif
-#endif /* LANDUSE */
+   char filename[STR_LEN];
 
-      if(data->do_hurricane) {
-         hurr_litter += cs->hurricane_litter * T_PER_KG * cs->sdata->grid_cell_area * GT_PER_T;
-      }
-   
+   /* TODO: this doesn't handle sbh3 -justin */
+#if TBB
+   // deterministic so the sums do not depend on how the range was split
+   domain_totals tot(data->site_arr, data);
+   tbb::parallel_deterministic_reduce(tbb::blocked_range<size_t>(0, data->number_of_sites, 64), tot);
+#else
+   domain_totals tot(NULL, data);
+   site* cs = *sitrptr;
+   while (cs != NULL) {
+      tot.add_site(cs);
       cs = cs->next_site;
    }
+#endif
 
 #if LANDUSE
-   if(total_area_lu[LU_SCND] > 0.0)
-      mean_AGE_sec /= total_area_lu[LU_SCND];
-   else mean_AGE_sec = 0.00;
+   double mean_AGE_sec = 0.0;
+   if(tot.area_lu[LU_SCND] > 0.0)
+      mean_AGE_sec = tot.mean_AGE_sec / tot.area_lu[LU_SCND];
 #endif
 
    strcpy(filename, data->base_filename);
@@ -1710,14 +1813,14 @@ void print_domain_stats (unsigned int t, site** sitrptr, UserData* data) {
    fprintf(outfile,
            "t %f Nsites %d amod(km2) %f aburned(km2) %f b(Gt) %f agb(Gt) %f tot_sc(Gt) %f total_c(Gt) %f nep2(Gt/y) %f ",
            t * data->deltat,
-           n,
-           total_area_modeled,
-           total_area_burned,
-           total_biomass,
-           total_ag_biomass,
-           total_soil_sc,
-           total_biomass + total_soil_sc,
-           total_nep2);
+           tot.n,
+           tot.area_modeled,
+           tot.area_burned,
+           tot.biomass,
+           tot.ag_biomass,
+           tot.soil_sc,
+           tot.biomass + tot.soil_sc,
+           tot.nep2);
 
 #if LANDUSE
    for (lu=0; lu<N_LANDUSE_TYPES; lu++) {
@@ -1726,43 +1829,35 @@ void print_domain_stats (unsigned int t, site** sitrptr, UserData* data) {
          fprintf(outfile, "mA_scnd(yrs) %f ", mean_AGE_sec);
       fprintf(outfile,
               "a_%s(km2) %f  b_%s(Gt) %f agb_%s(Gt) %f sc_%s(Gt) %f ",
-              luname, total_area_lu[lu],
-              luname, total_biomass_lu[lu],
-              luname, total_agb_lu[lu],
-              luname, total_sc_lu[lu]);
+              luname, tot.area_lu[lu],
+              luname, tot.biomass_lu[lu],
+              luname, tot.agb_lu[lu],
+              luname, tot.sc_lu[lu]);
 
    }
    fprintf(outfile,
            "a_for(km2) %f b_for(Gt) %f agb_for(Gt) %f sc_for(Gt) %f dndt_for(Gt/y) %f ",
-           total_area_forest,
-           total_biomass_forest,
-           total_agb_forest,
-           total_sc_forest,
-           total_forest_dndt );
+           tot.area_forest,
+           tot.biomass_forest,
+           tot.agb_forest,
+           tot.sc_forest,
+           tot.forest_dndt );
    fprintf(outfile,
            "b_scnd_for(Gt) %f agb_scnd_for(Gt) %f sc_scnd_for(Gt) %f ",
-           total_biomass_for_sec,
-           total_agb_forest_sec,
-           total_sc_forest_sec);
+           tot.biomass_for_sec,
+           tot.agb_forest_sec,
+           tot.sc_forest_sec);
   
    fprintf(outfile,
            " aharv_virgin(km2) %f aharv_sec(km2) %f aharv_virgin_vbh2(km2) %f aharv_sec_sbh2(km2) %f bharv_virgin(Gt) %f bharv_sec(Gt) %f bharv_virgin_vbh2(Gt) %f bharv_sec_sbh2(Gt) %f ",
-           total_area_harvested_virgin, total_area_harvested_secondary,
-           total_area_harvested_virgin_vbh2, total_area_harvested_secondary_sbh2,
-           total_biomass_harvested_virgin, total_biomass_harvested_secondary,
-           total_biomass_harvested_virgin_vbh2, total_biomass_harvested_secondary_sbh2);
-#if 0
-   prinf(outfile,
-         "unmet_vbh(Gt) %f unmet_vbh2(Gt) %f unmet_sbh(Gt) %f unmet_sbh2(Gt) %f total_unmet(Gt) %f ",
-         total_biomass_harvested_unmet_vbh, total_biomass_harvested_unmet_vbh2,
-         total_biomass_harvested_unmet_sbh, total_biomass_harvested_unmet_sbh2,
-         total_biomass_harvested_unmet_vbh + total_biomass_harvested_unmet_vbh2
-         + total_biomass_harvested_unmet_sbh + total_biomass_harvested_unmet_sbh2);
-#endif
+           tot.area_harvested_virgin, tot.area_harvested_secondary,
+           tot.area_harvested_virgin_vbh2, tot.area_harvested_secondary_sbh2,
+           tot.biomass_harvested_virgin, tot.biomass_harvested_secondary,
+           tot.biomass_harvested_virgin_vbh2, tot.biomass_harvested_secondary_sbh2);
 #endif /* LANDUSE */
 
    if(data->do_hurricane) {
-      fprintf(outfile, "hurr_litter %f ", hurr_litter);
+      fprintf(outfile, "hurr_litter %f ", tot.hurr_litter);
    }
  
    fprintf(outfile, "\n");
@@ -1,4 +1,5 @@
 #include <cstdio>
+#include <cstdlib>
 #include <cmath>
 #include <cstring>
 #include "netcdf.h"
@@ -14,10 +15,25 @@
 #endif
 #include "fire.h"
 #include "read_site_data.h"
+#ifdef ED
+#include "mech_store.h"
+
+#if MECH_FLOAT
+#define NC_GET_VARA_MECH nc_get_vara_float
+#else
+#define NC_GET_VARA_MECH nc_get_vara_double
+#endif
+#endif
 
 
 size_t read_gridspec (UserData* data);
 void read_sois (UserData* data);
+
+// netcdf is not thread safe; the forcing reader and the output share it
+std::mutex netcdf_mutex;
+#ifdef ED
+void read_environmental_layers (UserData* data);
+#endif
 ////////////////////////////////////////////////////////////////////////////////
 //! read_input_data_layers
 //! 
@@ -29,6 +45,9 @@ size_t read_input_data_layers (UserData* data) {
 
    read_sois(data);
    size_t nPotentialSites = read_gridspec(data);
+#ifdef ED
+   read_environmental_layers(data);
+#endif
 #if LANDUSE
 #ifndef COUPLED
    read_initial_landuse_fractions(data);
@@ -386,9 +405,185 @@ SiteData::SiteData (size_t y, size_t x, UserData& data) {
    }
    L_top  = 1.0;  // Light at the top of the canopy
    Rn_top = 1.0;  // Net Radn flx at the top of the canopy
+
+   // mechanism tables are attached in readMechanismLUT
+   light_levels = data.mech_tables->light_levels;
+#if !FTS
+   An  = NULL;
+   E   = NULL;
+   Anb = NULL;
+   Eb  = NULL;
+   mech_slot_ = NULL;
+#endif
 #endif
+
+#if LANDUSE
+   lu_rates = NULL;  // allocated by read_transition_rates
+#endif
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//! ~SiteData
+//! 
+//!
+//! @param  
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+SiteData::~SiteData () {
+#if LANDUSE
+   free(lu_rates);
+#endif
+}
+
+
+#ifdef ED
+////////////////////////////////////////////////////////////////////////////////
+//! read_layer
+//! Read one variable over the whole region in a single hyperslab
+//!
+//! @param  ncid  open file
+//! @param  name  variable name
+//! @param  alt   variable to use if name is missing, or NULL
+//! @param  index start of the hyperslab
+//! @param  count size of the hyperslab
+//! @param  buf   destination, contiguous
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+static void read_layer (int ncid, const char* name, const char* alt, 
+                        const size_t* index, const size_t* count, double* buf) {
+   int rv, varid;
+   if ((rv = nc_inq_varid(ncid, name, &varid))) {
+      if ((alt == NULL) || (rv = nc_inq_varid(ncid, alt, &varid))) {
+         NCERR(name, rv);
+      }
+   }
+   if ((rv = nc_get_vara_double(ncid, varid, index, count, buf))) {
+      NCERR(name, rv);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! read_environmental_layers
+//! Read the soil and climate inputs of the (local) region up front, one
+//! hyperslab per variable, instead of a handful of tiny reads per site.
+//! readEnvironmentalData then picks each site's values out of the layers.
+//!
+//! @param  data Userdata structure, needs the grid bounds from read_gridspec
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void read_environmental_layers (UserData* data) {
+   int rv, ncid;
+
+   size_t index2[2] = { data->start_lat, data->start_lon };
+   size_t count2[2] = { data->n_lat, data->n_lon };
+   size_t ncells = data->n_lat * data->n_lon;
+
+   printf("read_soil_layers...\n");
+   if (data->soil_file_ncid == 0) {
+      if ((rv = nc_open(data->soil_file, NC_NOWRITE, &ncid))) {
+         NCERR(data->soil_file, rv);
+      }
+      data->soil_file_ncid = ncid;
+   } else {
+      ncid = data->soil_file_ncid;
+   }
+   data->soil_depth_layer = (double **)malloc_2d(data->n_lat, data->n_lon, sizeof(double));
+   data->theta_max_layer  = (double **)malloc_2d(data->n_lat, data->n_lon, sizeof(double));
+   data->k_sat_layer      = (double **)malloc_2d(data->n_lat, data->n_lon, sizeof(double));
+   data->tau_layer        = (double **)malloc_2d(data->n_lat, data->n_lon, sizeof(double));
+   read_layer(ncid, "soil_depth", NULL, index2, count2, &data->soil_depth_layer[0][0]);
+   read_layer(ncid, "soil_theta_max", NULL, index2, count2, &data->theta_max_layer[0][0]);
+   read_layer(ncid, "soil_k_sat", NULL, index2, count2, &data->k_sat_layer[0][0]);
+   read_layer(ncid, "soil_tau", NULL, index2, count2, &data->tau_layer[0][0]);
+
+   // Added below for yearly climate 
+   char nc[4] = ".nc"  ;
+   char base[256] = "";  
+   char convert[256]; 
+   char climatename[256];   
+   if (data->do_yearly_mech) {
+      if (data->m_int) {
+         sprintf(convert, "%s%d", base, data->mechanism_year);  
+         strcpy(climatename, data->climate_file);
+         strcat(climatename, convert);
+         strcat(climatename, nc);
+      }
+    
+      if(data->m_string) {
+         strcpy(climatename,data->climate_file);
+         strcat(climatename,data->mech_year_string);
+         strcat(climatename, nc);
+      }
+   } else if(data->single_year) {
+      strcpy(climatename, data->climate_file);
+   }
+
+   printf("read_climate_layers...\n");
+   if (data->climate_file_ncid == 0) {
+      if ((rv = nc_open(climatename, NC_NOWRITE, &ncid))) {
+         NCERR(climatename, rv);
+      }
+      data->climate_file_ncid = ncid;
+   } else {
+      ncid = data->climate_file_ncid;
+   }
+   data->precip_layer    = (double **)malloc_2d(N_CLIMATE, ncells, sizeof(double));
+   data->temp_layer      = (double **)malloc_2d(N_CLIMATE, ncells, sizeof(double));
+   data->soil_temp_layer = (double **)malloc_2d(N_CLIMATE, ncells, sizeof(double));
+   read_climate_layers(ncid, data, data->precip_layer, data->temp_layer, data->soil_temp_layer);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//! read_climate_layers
+//! Read the monthly climate of the region from an open climate file. Also
+//! used by the forcing reader for the years after the first, see forcing.cc
+//!
+//! @param  ncid      open climate file
+//! @param  data      Userdata structure, for the grid bounds
+//! @param  precip    destination [N_CLIMATE][n_lat*n_lon]
+//! @param  temp      destination [N_CLIMATE][n_lat*n_lon]
+//! @param  soil_temp destination [N_CLIMATE][n_lat*n_lon]
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void read_climate_layers (int ncid, const UserData* data, 
+                          double** precip, double** temp, double** soil_temp) {
+   size_t index3[3] = { 0, data->start_lat, data->start_lon };
+   size_t count3[3] = { N_CLIMATE, data->n_lat, data->n_lon };
+
+   read_layer(ncid, "precipitation", NULL, index3, count3, &precip[0][0]);
+   read_layer(ncid, "temperature", NULL, index3, count3, &temp[0][0]);
+   // if no soil_temp, default to air temp
+   read_layer(ncid, "soil_temp", "temperature", index3, count3, &soil_temp[0][0]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! free_environmental_layers
+//! Release the layers once every site has picked out its values
+//!
+//! @param  data Userdata structure
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void free_environmental_layers (UserData* data) {
+   double** layers[7] = { data->soil_depth_layer, data->theta_max_layer, 
+                          data->k_sat_layer, data->tau_layer, data->precip_layer,
+                          data->temp_layer, data->soil_temp_layer };
+   for (size_t i=0; i<7; i++) {
+      if (layers[i] != NULL) {
+         free(layers[i][0]);
+         free(layers[i]);
+      }
+   }
+   data->soil_depth_layer = NULL;
+   data->theta_max_layer  = NULL;
+   data->k_sat_layer      = NULL;
+   data->tau_layer        = NULL;
+   data->precip_layer     = NULL;
+   data->temp_layer       = NULL;
+   data->soil_temp_layer  = NULL;
+}
+#endif
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //! readSiteData
@@ -403,13 +598,8 @@ bool SiteData::readSiteData (UserData& data) {
       return false;
    }
 
-   calcPETAverage ();
-
 #ifdef ED
-   for (size_t i=0; i<12; i++) {
-      pet[i] = calcPETMonthly (i);
-   }
-   calcSiteDrynessIndex(data);
+   calcClimateIndices(data);
    
    // read in physiology or FTS data
 #if FTS
@@ -424,6 +614,8 @@ bool SiteData::readSiteData (UserData& data) {
     
 
 #elif defined MIAMI_LU
+   calcPETAverage ();
+
    // calculate miami npp
    miami_npp = miami(precip_average, temp_average);
 #endif
@@ -512,50 +704,18 @@ bool SiteData::readEnvironmentalData (UserData& data) {
 //! @return 
 ////////////////////////////////////////////////////////////////////////////////
 bool SiteData::readEnvironmentalData (UserData& data) {
-   int rv, ncid, varid;
-
-   size_t index1[2] = { globY_, globX_ };
-   size_t index2[3] = { 0, globY_, globX_ };
-   size_t count[3]  = { N_CLIMATE, 1, 1 };
-
-   if (data.soil_file_ncid == 0) {
-      if ((rv = nc_open(data.soil_file, NC_NOWRITE, &ncid))) {
-         NCERR(data.soil_file, rv);
-      }
-      data.soil_file_ncid = ncid;
-   } else {
-      ncid = data.soil_file_ncid;
+   // values come from the region layers, see read_environmental_layers
+   if (data.soil_depth_layer == NULL) {
+      fprintf(stderr, "readEnvironmentalData: soil and climate layers not loaded\n");
+      exit(1);
    }
-  
+
    // soil chars 
-   if ((rv = nc_inq_varid(ncid, "soil_depth", &varid))) {
-      NCERR("soil_depth", rv);
-   }
-   if ((rv = nc_get_var1_double(ncid, varid, index1, &soil_depth))) {
-      NCERR("soil_depth", rv);
-   }
+   soil_depth = data.soil_depth_layer[y_][x_];
    //soil_depth *= 10.0; // convert from cm to mm
-
-   if ((rv = nc_inq_varid(ncid, "soil_theta_max", &varid))) {
-      NCERR("theta_max", rv);
-   }
-   if ((rv = nc_get_var1_double(ncid, varid, index1, &theta_max))) {
-      NCERR("theta_max", rv);
-   }
-
-   if ((rv = nc_inq_varid(ncid, "soil_k_sat", &varid))) {
-      NCERR("k_sat", rv);
-   }
-   if ((rv = nc_get_var1_double(ncid, varid, index1, &k_sat))) {
-      NCERR("k_sat", rv);
-   }
-
-   if ((rv = nc_inq_varid(ncid, "soil_tau", &varid))) {
-      NCERR("tau", rv);
-   }
-   if ((rv = nc_get_var1_double(ncid, varid, index1, &tau))) {
-      NCERR("tau", rv);
-   }
+   theta_max  = data.theta_max_layer[y_][x_];
+   k_sat      = data.k_sat_layer[y_][x_];
+   tau        = data.tau_layer[y_][x_];
     
    if ( (soil_depth <= 0) || (theta_max == -9999.0) 
         || (k_sat == -9999.0) || (tau == -9999.0) ) {
@@ -563,72 +723,42 @@ bool SiteData::readEnvironmentalData (UserData& data) {
       return false;
    } 
 
-   // Added below for yearly climate 
-   // TODO: this should not be done here. needs to be done once, not every site
-   char nc[4] = ".nc"  ;
-   char base[256] = "";  
-   char convert[256]; 
-   char climatename[256];   
-   if (data.do_yearly_mech) {
-      if (data.m_int) {
-         sprintf(convert, "%s%d", base, data.mechanism_year);  
-         strcpy(climatename, data.climate_file);
-         strcat(climatename, convert);
-         strcat(climatename, nc);
-      }
-    
-      if(data.m_string) {
-         strcpy(climatename,data.climate_file);
-         strcat(climatename,data.mech_year_string);
-         strcat(climatename, nc);
-      }
-   } else if(data.single_year) {
-      strcpy(climatename, data.climate_file);
-   }
+   return loadClimate(data.precip_layer, data.temp_layer, data.soil_temp_layer, data.n_lon);
+}
 
-   if (data.climate_file_ncid == 0) {
-      if ((rv = nc_open(climatename, NC_NOWRITE, &ncid))) {
-         NCERR(climatename, rv);
-      }
-      data.climate_file_ncid = ncid;
-   } else {
-      ncid = data.climate_file_ncid;
+////////////////////////////////////////////////////////////////////////////////
+//! loadClimate
+//! Pick the site's monthly climate out of region layers. The site is left
+//! untouched if the cell has no data.
+//!
+//! @param  precip_layer    [N_CLIMATE][n_lat*n_lon] precipitation
+//! @param  temp_layer      [N_CLIMATE][n_lat*n_lon] air temperature (K)
+//! @param  soil_temp_layer [N_CLIMATE][n_lat*n_lon] soil temperature (K)
+//! @param  n_lon           width of the region
+//! @return false if the cell has no climate data
+////////////////////////////////////////////////////////////////////////////////
+bool SiteData::loadClimate (double** precip_layer, double** temp_layer, 
+                            double** soil_temp_layer, size_t n_lon) {
+   size_t cell = y_ * n_lon + x_;
+
+   double climate_temp[N_CLIMATE], climate_precip[N_CLIMATE], climate_soil[N_CLIMATE];
+   for (size_t i=0; i<N_CLIMATE; i++) {
+      climate_precip[i] = precip_layer[i][cell];
+      climate_temp[i]   = temp_layer[i][cell];
+      climate_soil[i]   = soil_temp_layer[i][cell];
    }
-   
-   double climate_temp[12], climate_precip[12], climate_soil[12];
 
    // precip 
-   if ((rv = nc_inq_varid(ncid, "precipitation", &varid))) {
-      NCERR("precip", rv);
-   }
-   if ((rv = nc_get_vara_double(ncid, varid, index2, count, &climate_precip[0]))) {
-      NCERR("precip", rv);
-   }
    if (climate_precip[0] < 0.0) {
       //fprintf(stderr, "No precip data found for site lat %f lon %f\n", cs->lat, cs->lon);
       return false;
    } 
    
-   if ((rv = nc_inq_varid(ncid, "temperature", &varid))) {
-      NCERR("temp", rv);
-   }
-   if ((rv = nc_get_vara_double(ncid, varid, index2, count, &climate_temp[0]))) {
-      NCERR("temp", rv);
-   }
    if (climate_temp[0] == -9999.0) { // TODO: better test?
       //fprintf(stderr, "No temp data found for site lat %f lon %f\n", cs->lat, cs->lon);
       return false;
    } 
    
-   if ((rv = nc_inq_varid(ncid, "soil_temp", &varid))) {
-      // if no soil_temp, default to air temp
-      if ((rv = nc_inq_varid(ncid, "temperature", &varid))) {
-         NCERR("soil_temp", rv);
-      }
-   }
-   if ((rv = nc_get_vara_double(ncid, varid, index2, count, &climate_soil[0]))) {
-      NCERR("soil_temp", rv);
-   }
    if (climate_soil[0] == -9999.0) { // TODO: better test?
       //fprintf(stderr, "No soil temp data found for site lat %f lon %f\n", cs->lat, cs->lon);
       return false;
@@ -813,36 +943,42 @@ bool SiteData::readMechanismLUT (UserData& data) {
    size_t index2[4] = { globY_, globX_, 0, 0 };
    size_t count2[4] = { 1, 1, N_CLIMATE, N_LIGHT };
 
-   // TODO: this shouldn't be here. Do once, not for each site.
-   char nc[] = ".nc"  ;
-   char base[] = "";  
-   char convert[256];
-   char c3name[256]; 
-   char c4name[256];  
    if (data.do_yearly_mech) {
       // NOTE!!! do_yearly_mech does not work with the multiple Vm0 bins mechanism (currently)
       // Please use FTS
-       if (data.m_int) {
-          sprintf(convert, "%s%d", base, data.mechanism_year);  
-          strcpy(c3name, data.mech_c3_file);
-          strcpy(c4name, data.mech_c4_file);
-     
-          strcat(c3name, convert);
-          strcat(c4name, convert);   
-    
-          strcat(c3name, nc);
-          strcat(c4name, nc); 
-       } else if (data.m_string) {
-          strcpy(c3name, data.mech_c3_file);
-          strcpy(c4name, data.mech_c4_file);
-    
-          strcat(c3name, data.mech_year_string);
-          strcat(c4name, data.mech_year_string);   
-    
-          strcat(c3name, nc);
-          strcat(c4name, nc); 
-       }
-   } else if (data.single_year) {
+      // tables of each year are attached by the forcing reader, see forcing.cc
+      return true;
+   }
+
+   // serve the site straight from the mapped cache if it is there
+   const mech_cache_block* cb = find_mech_cache_block(data.mech_tables, globY_, globX_);
+   if (cb != NULL) {
+      mech_tables* mt = const_cast<mech_tables*>(&cb->t); // read-only mapping
+      An  = mt->An;
+      E   = mt->E;
+      Anb = mt->Anb;
+      Eb  = mt->Eb;
+      memcpy(tf, cb->tf, sizeof(tf));
+      return true;
+   }
+
+   // sites missing from the cache are read here while others are read in
+   // parallel, see init_sites
+   std::lock_guard<std::mutex> lock(netcdf_mutex);
+
+   if (An == NULL) {
+      mech_tables* mt = alloc_mech_tables(data.mech_tables);
+      An  = mt->An;
+      E   = mt->E;
+      Anb = mt->Anb;
+      Eb  = mt->Eb;
+      mech_slot_ = mt;
+   }
+
+   // TODO: this shouldn't be here. Do once, not for each site.
+   char c3name[256]; 
+   char c4name[256];  
+   if (data.single_year) {
       size_t i = 0;
       for(; i < data.num_Vm0; i++) {
           if (data.num_Vm0 > 1) {
@@ -876,13 +1012,15 @@ bool SiteData::readMechanismLUT (UserData& data) {
             } else {
                ncid = data.mech_c4_file_ncid[i];
             }
-            // light levels 
-            // TODO: is this worth storing for each site? Same for everywhere.
-            if ((rv = nc_inq_varid(ncid, "shade", &varid))) {
-               NCERR("shade", rv);
-            }
-            if ((rv = nc_get_var_double(ncid, varid, &light_levels[pt][i][0]))) {
-               NCERR("shade", rv);
+            // light levels, same everywhere so only read for the first site
+            if (! data.mech_tables->have_light_levels[pt][i]) {
+               if ((rv = nc_inq_varid(ncid, "shade", &varid))) {
+                  NCERR("shade", rv);
+               }
+               if ((rv = nc_get_var_double(ncid, varid, &light_levels[pt][i][0]))) {
+                  NCERR("shade", rv);
+               }
+               data.mech_tables->have_light_levels[pt][i] = 1;
             }
 
             // temp function 
@@ -897,7 +1035,7 @@ bool SiteData::readMechanismLUT (UserData& data) {
             if ((rv = nc_inq_varid(ncid, "An", &varid))) {
                NCERR("An", rv);
             }
-            if ((rv = nc_get_vara_double(ncid, varid, index2, count2, &An[pt][i][0][0]))) {
+            if ((rv = NC_GET_VARA_MECH(ncid, varid, index2, count2, &An[pt][i][0][0]))) {
                NCERR("An", rv);
             }
 
@@ -905,7 +1043,7 @@ bool SiteData::readMechanismLUT (UserData& data) {
             if ((rv = nc_inq_varid(ncid, "Anb", &varid))) {
                NCERR("Anb", rv);
             }
-            if ((rv = nc_get_vara_double(ncid, varid, index2, count2, &Anb[pt][i][0][0]))) {
+            if ((rv = NC_GET_VARA_MECH(ncid, varid, index2, count2, &Anb[pt][i][0][0]))) {
                NCERR("Anb", rv);
             }
 
@@ -913,7 +1051,7 @@ bool SiteData::readMechanismLUT (UserData& data) {
             if ((rv = nc_inq_varid(ncid, "E", &varid))) {
                NCERR("E", rv);
             }
-            if ((rv = nc_get_vara_double(ncid, varid, index2, count2, &E[pt][i][0][0]))) {
+            if ((rv = NC_GET_VARA_MECH(ncid, varid, index2, count2, &E[pt][i][0][0]))) {
                NCERR("E", rv);
             }
 
@@ -921,7 +1059,7 @@ bool SiteData::readMechanismLUT (UserData& data) {
             if ((rv = nc_inq_varid(ncid, "Eb", &varid))) {
                NCERR("Eb", rv);
             }
-            if ((rv = nc_get_vara_double(ncid, varid, index2, count2, &Eb[pt][i][0][0]))) {
+            if ((rv = NC_GET_VARA_MECH(ncid, varid, index2, count2, &Eb[pt][i][0][0]))) {
                NCERR("Eb", rv);
             }
          }
@@ -933,6 +1071,27 @@ bool SiteData::readMechanismLUT (UserData& data) {
 }
 #endif
 
+////////////////////////////////////////////////////////////////////////////////
+//! releaseMechanismLUT
+//! Give tables taken by readMechanismLUT back to the store, for sites
+//! dropped after their tables were read. Mapped tables are left alone.
+//!
+//! @param  data Userdata structure
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void SiteData::releaseMechanismLUT (UserData& data) {
+#if !FTS
+   if (mech_slot_ != NULL) {
+      free_mech_tables(data.mech_tables, mech_slot_);
+      mech_slot_ = NULL;
+      An  = NULL;
+      E   = NULL;
+      Anb = NULL;
+      Eb  = NULL;
+   }
+#endif
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //! calcPETMonthly
 //! 
@@ -1025,6 +1184,22 @@ double SiteData::calcPETMonthly (size_t month) {
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+//! calcClimateIndices
+//! Derive pet and the dryness index from the site's current climate
+//!
+//! @param  data Userdata structure
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void SiteData::calcClimateIndices (UserData& data) {
+   calcPETAverage ();
+   for (size_t i=0; i<12; i++) {
+      pet[i] = calcPETMonthly (i);
+   }
+   calcSiteDrynessIndex(data);
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 //! calcSiteDrynessIndex
 //! 
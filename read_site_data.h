@@ -1,13 +1,77 @@
 #ifndef EDM_READ_SITE_DATA_H_
 #define EDM_READ_SITE_DATA_H_
 
+#include <mutex>
+
 #include "edmodels.h"
 
+struct mech_tables;
+
+#if LANDUSE
+////////////////////////////////////////
+//    Typedef: landuse_rates
+//    Landuse transition and harvest rates
+//    of a site for one year. Sites hold
+//    one per simulated year, outside
+//    SiteData, see read_transition_rates
+////////////////////////////////////////
+struct landuse_rates {
+   double beta[N_LANDUSE_TYPES][N_LANDUSE_TYPES-1]; ///< transitions (fr_total_area/yr)
+   double vbh[N_VBH_TYPES];                         ///< virgin harvest
+   double sbh[N_SBH_TYPES];                         ///< secondary harvest
+};
+#endif // LANDUSE
+
 ////////////////////////////////////////
 //    SiteData contains site-related 
-//    environmental data
+//    environmental data. Fields used 
+//    every step come first, so that the
+//    part the integrator reads shares a
+//    few cache lines; the rest follows,
+//    and the large yearly inputs are
+//    allocated separately.
 ////////////////////////////////////////
 struct SiteData {
+   ////////////////////////////////////////
+   //    HOT: read every step
+   ////////////////////////////////////////
+#ifdef ED
+   double temp[N_CLIMATE];           ///< monthly mean temperature (deg C)
+   double precip[N_CLIMATE];         ///< monthly rate of rainfall (mm/yr)
+   double soil_temp[N_CLIMATE];      ///< monthly mean soil temp (deg C)
+   double pet[N_CLIMATE];            ///< potential evapotranspiration (mm/yr) 
+
+   double N_conc_in_rain;            ///< concentration of N in rain water 
+   double L_top;                     ///< Light at the top of the canopy 
+   double Rn_top;                    ///< Net Radiative flux at top of canopy
+
+   double theta_max;                 ///< volume of water in saturated soil (mm/mm^3)
+   double k_sat;                     ///< conductivity of saturated soil (yr^-1) 
+   double tau;                       ///< conductivity exponent 
+#endif // ED
+
+   double soil_depth;                ///< depth of soil (mm)
+   double soil_evap_conductivity;    ///< soil conductivity for evap water loss
+   double dryness_index[N_CLIMATE];  ///< used in fire model */
+   double loss_fraction[NUM_TRACKS]; ///< loss fractions following disturbance
+   double grid_cell_area;            ///< land area of grid cell  (m^2)
+
+#ifdef ED
+   // potential photosynthesis and evap, held in data.mech_tables
+   double (*light_levels)[NUM_Vm0s][N_LIGHT];    ///< shade grid, shared by all sites
+#if !FTS
+   mech_real (*An)[NUM_Vm0s][N_CLIMATE][N_LIGHT];  ///< pot. net photosynthesis (gC/(m2 mo)) 
+   mech_real (*E)[NUM_Vm0s][N_CLIMATE][N_LIGHT];   ///< potential transpitation (gW/(m2 mo))
+   mech_real (*Anb)[NUM_Vm0s][N_CLIMATE][N_LIGHT]; ///< pot. psyn when shut (g/(m2 mo))
+   mech_real (*Eb)[NUM_Vm0s][N_CLIMATE][N_LIGHT];  ///< pot. transp when shut (gW/(m2 mo)) 
+   mech_tables* mech_slot_;                        ///< tables taken from the store, NULL if mapped
+#endif
+   double tf[PT][NUM_Vm0s][N_CLIMATE];           ///< value of temp function (used in resp calc) (Dimensionless???)
+#endif // ED
+
+   ////////////////////////////////////////
+   //    COLD: setup, yearly and output
+   ////////////////////////////////////////
    size_t x_;
    size_t y_;
 
@@ -16,64 +80,29 @@ struct SiteData {
 
    double lat_;
    double lon_;
-   
-   char name_[STR_LEN];
 
    bool soi;
 
-   double grid_cell_area;            ///< land area of grid cell  (m^2)
    double grid_cell_area_total;      ///< total area of grid cell (m^2)
 
-#ifdef ED
-   double temp[N_CLIMATE];           ///< monthly mean temperature (deg C)
-   double precip[N_CLIMATE];         ///< monthly rate of rainfall (mm/yr)
-   double soil_temp[N_CLIMATE];      ///< monthly mean soil temp (deg C)
-   double pet[N_CLIMATE];            ///< potential evapotranspiration (mm/yr) 
-#endif // ED
    double precip_average;            ///< avg. yrly precip (mm/yr) 
    double temp_average;              ///< average annual temperature (deg C)
    double soil_temp_average;         ///< annual average soil temp (deg C)
    double pet_average;
 
-   double soil_depth;                ///< depth of soil (mm)
-   double soil_evap_conductivity;    ///< soil conductivity for evap water loss
-
-   double dryness_index[N_CLIMATE];  ///< used in fire model */
    double dryness_index_avg;         ///< used in fire model 
 
-   double loss_fraction[NUM_TRACKS]; ///< loss fractions following disturbance
-
 #ifdef MIAMI_LU
    double miami_npp;                 ///< annual net primary production (Kg / (m^2 yr)) 
 #endif
 
 #ifdef ED
-   double N_conc_in_rain;            ///< concentration of N in rain water 
-   double L_top;                     ///< Light at the top of the canopy 
-   double Rn_top;                    ///< Net Radiative flux at top of canopy
-
-   double theta_max;                 ///< volume of water in saturated soil (mm/mm^3)
-   double k_sat;                     ///< conductivity of saturated soil (yr^-1) 
-   double tau;                       ///< conductivity exponent 
-    
-   // potential photosynthesis and evap 
-   double light_levels[PT][NUM_Vm0s][N_LIGHT];
-   double tf[PT][NUM_Vm0s][N_CLIMATE];           ///< value of temp function (used in resp calc) (Dimensionless???)
-
 #if FTS
    bool readFTSdata (UserData& data);
    double Input_Temperature[N_CLIMATE_INPUT*CLIMATE_INPUT_INTERVALS];
    double Input_Specific_Humidity[N_CLIMATE_INPUT*CLIMATE_INPUT_INTERVALS];
    double Input_Par[N_CLIMATE_INPUT*CLIMATE_INPUT_INTERVALS];
-#else
-   double An[PT][NUM_Vm0s][N_CLIMATE][N_LIGHT];  ///< pot. net photosynthesis (gC/(m2 mo)) 
-   double E[PT][NUM_Vm0s][N_CLIMATE][N_LIGHT];   ///< potential transpitation (gW/(m2 mo))
-   double Anb[PT][NUM_Vm0s][N_CLIMATE][N_LIGHT]; ///< pot. psyn when shut (g/(m2 mo))
-   double Eb[PT][NUM_Vm0s][N_CLIMATE][N_LIGHT];  ///< pot. transp when shut (gW/(m2 mo)) 
 #endif
-   
-
-
 
    // N.A. stuff 
    double first_frost;
@@ -82,15 +111,14 @@ struct SiteData {
 #endif // ED 
 
 #if LANDUSE
-   double beta[N_LANDUSE_TYPES][N_LANDUSE_TYPES-1][N_LANDUSE_YEARS];
-
-   double vbh[N_VBH_TYPES][N_LANDUSE_YEARS];
-   double sbh[N_SBH_TYPES][N_LANDUSE_YEARS];
+   landuse_rates* lu_rates;          ///< years data.lu_first_year.., data.lu_n_years of them
 #endif // LANDUSE 
   
    double avg_hurricane_disturbance_rate;
    double *hurricane_disturbance_rate;
     
+   char name_[STR_LEN];
+
 #if 0 // Disabled temporarily until fixed
    double ph[N_LANDUSE_YEARS]; ///< prob_harvest(A) (1/yr) 
 #endif
@@ -113,7 +141,14 @@ struct SiteData {
 #endif
 
    SiteData (size_t y, size_t x, UserData& data);
+   ~SiteData ();
    bool readSiteData (UserData& data);
+#ifdef ED
+   void releaseMechanismLUT (UserData& data);
+   bool loadClimate (double** precip_layer, double** temp_layer, double** soil_temp_layer,
+                     size_t n_lon);
+   void calcClimateIndices (UserData& data);
+#endif
 
  private:
 
@@ -127,8 +162,15 @@ struct SiteData {
 };
 
 
+extern std::mutex netcdf_mutex; ///< held around netcdf calls made while the model runs
+
 bool is_soi(double lat,double lon, UserData& data); ///< flag sites of interest
 size_t read_input_data_layers (UserData* data);
+#ifdef ED
+void read_climate_layers (int ncid, const UserData* data, 
+                          double** precip, double** temp, double** soil_temp);
+void free_environmental_layers (UserData* data);
+#endif
 int read_hurricane_disturbance (site** siteptr, UserData* data);
 
 #endif // EDM_READ_SITE_DATA_H_ 
@@ -2,6 +2,9 @@
 #include <sys/stat.h>
 #include "edmodels.h"
 #include "outputter.h"
+#ifdef ED
+#include "mech_store.h"
+#endif
 
 #include "readconfiguration.h"
 
@@ -164,6 +167,9 @@ return(EXIT_SUCCESS);
 void free_user_data(UserData* data) {
     free(data->lats);
     free(data->lons);
+#ifdef ED
+    free_mech_store(&data->mech_tables);
+#endif
 
     delete(data->outputter);
     delete(data->model_cfg);
@@ -228,6 +234,9 @@ void initialize_model_params(UserData* data) {
     data->do_yearly_mech    = get_val<int>(data, MODEL_IO, data->which_mech_to_use, "do_yearly_mech"); 
     data->m_int             = get_val<int>(data, MODEL_IO, data->which_mech_to_use, "m_int");   
     data->m_string          = get_val<int>(data, MODEL_IO, data->which_mech_to_use, "m_string"); 
+#ifdef ED
+    data->mech_cache_file   = get_val<const char*>(data, MODEL_IO, "", "mech_cache_file");
+#endif
 
 
     /* MULTIPLE Vm0s*/
@@ -259,9 +268,19 @@ void initialize_model_params(UserData* data) {
     /***    INTEGRATION                ***/
     /*************************************/
     data->tmax                   = get_val<double>(data, PARAMS, "", "tmax"); /*number of years to simulated */
+    data->site_grain             = get_val<int>(data, PARAMS, "", "site_grain");      /* sites per parallel task */
+    data->cost_scheduling        = get_val<int>(data, PARAMS, "", "cost_scheduling"); /* 1= most expensive sites first */
+    data->n_threads              = get_val<int>(data, PARAMS, "", "n_threads");       /* 0= all cores */
+    data->thread_pinning         = get_val<int>(data, PARAMS, "", "thread_pinning");
+    data->numa_arenas            = get_val<int>(data, PARAMS, "", "numa_arenas");
 #ifdef ED
     data->stiff_light            = get_val<int>(data, PARAMS, "", "stiff_light"); /* 1= yes to stiff integration of light levels */
+    data->light_interpolation    = get_val<int>(data, PARAMS, "", "light_interpolation"); /* 1= interpolate between light bins */
     data->substeps               = get_val<int>(data, PARAMS, "", "substeps"); 
+    data->soa_integration        = get_val<int>(data, PARAMS, "", "soa_integration"); /* 1= integrate cohorts from contiguous arrays */
+    data->integrator             = get_val<int>(data, PARAMS, "", "integrator");      /* 0= split-step rk2, 1= adaptive rk 3(2) */
+    data->ode_rtol               = get_val<double>(data, PARAMS, "", "ode_rtol");
+    data->ode_atol               = get_val<double>(data, PARAMS, "", "ode_atol");
 #endif
     data->patch_dynamics         = get_val<int>(data, PARAMS, "", "patch_dynamics");  /* patch dynamics flag, 1=yes to patch dynamics */
    
@@ -273,6 +292,8 @@ void initialize_model_params(UserData* data) {
     data->new_restart_write        = get_val<int>(data, PARAMS, "", "new_restart_write");
     data->new_restart_read         = get_val<int>(data, PARAMS, "", "new_restart_read");
     data->restart_dir              = get_val<const char*>(data, PARAMS, "", "restart_dir");  
+    data->blob_restart_write       = get_val<int>(data, PARAMS, "", "blob_restart_write");
+    data->blob_restart_read        = get_val<int>(data, PARAMS, "", "blob_restart_read");
     
 #ifdef ED
     /**************************************/
@@ -353,7 +374,26 @@ void initialize_model_params(UserData* data) {
    data->print_output_files = get_val<int>(data, MODEL_IO, "", "print_output_files");     
    data->print_system_state = get_val<int>(data, MODEL_IO, "", "print_system_state");   /* flag to print system state files */
    data->print_ss_freq      = get_val<int>(data, MODEL_IO, "", "print_ss_freq");     /* in NSUB units */
-   /* these two (cd_file, fp_file) have to be off if using gcd !!!! */
+   data->region_sync_freq   = get_val<int>(data, MODEL_IO, "", "region_sync_freq");  /* in records */
+   data->region_land_only   = get_val<int>(data, MODEL_IO, "", "region_land_only");
+   data->region_deflate     = get_val<int>(data, MODEL_IO, "", "region_deflate");
+   data->region_aggregate_window = get_val<int>(data, MODEL_IO, "", "region_aggregate_window");
+   const char* aggregate = get_val<const char*>(data, MODEL_IO, "", "region_aggregate");
+   if (strcmp(aggregate, "mean") == 0) {
+      data->region_aggregate = AGG_MEAN;
+   } else if (strcmp(aggregate, "min") == 0) {
+      data->region_aggregate = AGG_MIN;
+   } else if (strcmp(aggregate, "max") == 0) {
+      data->region_aggregate = AGG_MAX;
+   } else if (strcmp(aggregate, "sum") == 0) {
+      data->region_aggregate = AGG_SUM;
+   } else {
+      fprintf(stderr, "Unknown region_aggregate %s, use mean, min, max or sum\n", aggregate);
+      exit(1);
+   }
+   data->state_dump_freq    = get_val<int>(data, MODEL_IO, "", "state_dump_freq");   /* in NSUB units */
+   data->state_dump_deflate = get_val<int>(data, MODEL_IO, "", "state_dump_deflate");
+   /* cd_file, fp_file are safe with TBB, see ed_log.cc */
    data->cd_file            = get_val<int>(data, MODEL_IO, "", "cd_file");              
    data->fp_file            = get_val<int>(data, MODEL_IO, "", "fp_file");        
    data->long_patch_file    = get_val<int>(data, MODEL_IO, "", "long_patch_file");
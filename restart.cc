@@ -123,6 +123,55 @@ void Restart::storeStates (site* first_site, int year) {
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+//! fillPatchRestart
+//! Restart record of a patch, shared by the db and binary restarts
+//!
+//! @param  pr record to fill, id_ is the patch id, the db restart keys it anew
+//! @param  p  patch
+//! @param  lu land use of the patch
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+static void fillPatchRestart (PatchRestart& pr, const patch& p, int lu) {
+   pr.id_ = p.id;
+   pr.landUse_ = lu;
+   pr.disturbanceTrack_ = p.track;
+   pr.age_ = p.age;
+   pr.area_ = p.area;
+   pr.fastSoilCarbon_ = p.fast_soil_C;
+   pr.structuralSoilCarbon_ = p.structural_soil_C;
+#ifdef ED
+   pr.slowSoilCarbon_ = p.slow_soil_C;
+   pr.passiveSoilCarbon_ = p.passive_soil_C;
+   pr.structuralSoilLignin_ = p.structural_soil_L;
+   pr.fastSoilNitrogen_ = p.fast_soil_N;
+   pr.mineralizedSoilNitrogen_ = p.mineralized_soil_N;
+   pr.water_ = p.water;
+#elif defined MIAMI_LU
+   pr.totalBiomass_ = p.total_biomass;
+#endif
+}
+
+#ifdef ED
+////////////////////////////////////////////////////////////////////////////////
+//! fillCohortRestart
+//! Restart record of a cohort, shared by the db and binary restarts
+//!
+//! @param  cr record to fill
+//! @param  c  cohort
+//! @param  p  patch of the cohort
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+static void fillCohortRestart (CohortRestart& cr, const cohort& c, const patch& p) {
+   cr.pft_ = c.species;
+   cr.dbh_ = c.dbh;
+   cr.height_ = c.hite;
+   cr.nIndivs_ = c.nindivs / p.area;
+   cr.bDead_ = c.bdead;
+   cr.bAlive_ = c.balive;
+}
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 //! storeState
 //! 
@@ -148,23 +197,8 @@ void Restart::storeState (site& s, int year) {
    for (int lu=0; lu<N_LANDUSE_TYPES; lu++) {
       for (patch* p=s.youngest_patch[lu]; p!=NULL; p=p->older) {
          PatchRestart pr;
+         fillPatchRestart(pr, *p, lu);
          pr.id_ = patchSequence_++;
-         pr.landUse_ = lu;
-         pr.disturbanceTrack_ = p->track;
-         pr.age_ = p->age;
-         pr.area_ = p->area;
-         pr.fastSoilCarbon_ = p->fast_soil_C;
-         pr.structuralSoilCarbon_ = p->structural_soil_C;
-#ifdef ED
-         pr.slowSoilCarbon_ = p->slow_soil_C;
-         pr.passiveSoilCarbon_ = p->passive_soil_C;
-         pr.structuralSoilLignin_ = p->structural_soil_L;
-         pr.fastSoilNitrogen_ = p->fast_soil_N;
-         pr.mineralizedSoilNitrogen_ = p->mineralized_soil_N;
-         pr.water_ = p->water;
-#elif defined MIAMI_LU
-         pr.totalBiomass_ = p->total_biomass;
-#endif
          Dbt pk (&sr.id_, sizeof(sr.id_));
          Dbt pd (&pr, sizeof(PatchRestart));
          if (patchDB_->put(dbTxn_, &pk, &pd, 0) != 0) {
@@ -189,12 +223,7 @@ void Restart::storeState (site& s, int year) {
 #if ED
          for (cohort* c=p->shortest; c!=NULL; c=c->taller) {
             CohortRestart cr;
-            cr.pft_ = c->species;
-            cr.dbh_ = c->dbh;
-            cr.height_ = c->hite;
-            cr.nIndivs_ = c->nindivs / p->area;
-            cr.bDead_ = c->bdead;
-            cr.bAlive_ = c->balive;
+            fillCohortRestart(cr, *c, *p);
             Dbt ck (&pr.id_, sizeof(pr.id_));
             Dbt cd (&cr, sizeof(CohortRestart));
             if (cohortDB_->put(dbTxn_, &ck, &cd, 0) != 0) {
@@ -670,3 +699,407 @@ void read_cohort_distribution( char* filename, site** siteptr,
    fclose(infile);
 }
 #endif // ED
+
+
+/******************************************************************************/
+// Binary restart functions
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#if TBB
+#include "tbb/parallel_for.h"
+#include "tbb/blocked_range.h"
+#endif
+
+#ifdef ED
+#define BLOB_RESTART_MODEL 1
+#elif defined MIAMI_LU
+#define BLOB_RESTART_MODEL 2
+#endif
+
+struct BlobRestart {
+   int fd;
+   char filename[STR_LEN];
+   BlobRestartHeader header;
+   std::vector<BlobRestartIndex> index;   ///< sorted by row, column
+};
+
+static bool indexLess (const BlobRestartIndex& a, const BlobRestartIndex& b) {
+   return (a.y_ < b.y_) || ((a.y_ == b.y_) && (a.x_ < b.x_));
+}
+
+template <class T> static void blobPut (vector<char>& buf, const T& v) {
+   const char* p = (const char*)&v;
+   buf.insert(buf.end(), p, p + sizeof(T));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! packSite
+//! Binary restart record of one site, layout in restart.h
+//!
+//! @param  s    site
+//! @param  year year of the restart
+//! @param  buf  receives the record
+//! @return 1 if the site has patches other than natural ones
+////////////////////////////////////////////////////////////////////////////////
+static int packSite (site& s, int year, vector<char>& buf) {
+   uint32_t nPatches = 0;
+   for (int lu=0; lu<N_LANDUSE_TYPES; lu++) {
+      for (patch* p=s.youngest_patch[lu]; p!=NULL; p=p->older) nPatches++;
+   }
+   uint32_t nextPatchId = s.next_patch_id;
+   uint32_t nextCohortId = s.next_cohort_id;
+   blobPut(buf, nextPatchId);
+   blobPut(buf, nextCohortId);
+   blobPut(buf, nPatches);
+
+   int hasLanduse = 0;
+   for (int lu=0; lu<N_LANDUSE_TYPES; lu++) {
+      for (patch* p=s.youngest_patch[lu]; p!=NULL; p=p->older) {
+         if (lu > LU_NTRL) hasLanduse = 1;
+         PatchRestart pr;
+         fillPatchRestart(pr, *p, lu);
+         blobPut(buf, pr);
+
+         uint32_t nCohorts = 0;
+#ifdef ED
+         for (cohort* c=p->shortest; c!=NULL; c=c->taller) nCohorts++;
+#endif
+         uint32_t nHistory = (lu == LU_SCND) ? year + 1 : 0;
+         blobPut(buf, nCohorts);
+         blobPut(buf, nHistory);
+         for (uint32_t h=0; h<nHistory; h++) {
+            blobPut(buf, p->phistory[h]);
+         }
+#ifdef ED
+         for (cohort* c=p->shortest; c!=NULL; c=c->taller) {
+            uint32_t id = c->id;
+            CohortRestart cr;
+            fillCohortRestart(cr, *c, *p);
+            blobPut(buf, id);
+            blobPut(buf, cr);
+         }
+#endif
+      }
+   }
+   return hasLanduse;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! writeAll
+//! pwrite all of a buffer, safe to call from several threads on one file
+//!
+//! @param  fd       open file
+//! @param  buf      data
+//! @param  len      bytes
+//! @param  offset   position in the file
+//! @param  filename for errors
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+static void writeAll (int fd, const char* buf, size_t len, off_t offset, const char* filename) {
+   while (len > 0) {
+      ssize_t n = pwrite(fd, buf, len, offset);
+      if (n <= 0) {
+         fprintf(stderr, "write_blob_restart: write to %s failed\n", filename);
+         exit(1);
+      }
+      buf += n;
+      len -= n;
+      offset += n;
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! write_blob_restart
+//! Write the state of all sites to <outdir>/RESTART/restart.bin. Sites are
+//! packed and written in parallel, into a temporary file that replaces the
+//! previous restart once it is complete.
+//!
+//! @param  first_site first site in list
+//! @param  year       year of the restart
+//! @param  data       UserData structure
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void write_blob_restart (site* first_site, int year, UserData* data) {
+   auto t0 = chrono::steady_clock::now();
+
+   vector<site*> sites;
+   for (site* s=first_site; s!=NULL; s=s->next_site) {
+      sites.push_back(s);
+   }
+   size_t nSites = sites.size();
+
+   vector< vector<char> > blobs(nSites);
+   vector<int> hasLanduse(nSites);
+#if TBB
+   tbb::parallel_for(tbb::blocked_range<size_t>(0, nSites, 16),
+                     [&] (const tbb::blocked_range<size_t>& r) {
+      for (size_t i=r.begin(); i!=r.end(); i++) 
+         hasLanduse[i] = packSite(*sites[i], year, blobs[i]);
+   });
+#else
+   for (size_t i=0; i<nSites; i++) 
+      hasLanduse[i] = packSite(*sites[i], year, blobs[i]);
+#endif
+
+   BlobRestartHeader header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, BLOB_RESTART_MAGIC, sizeof(header.magic));
+   header.version    = BLOB_RESTART_VERSION;
+   header.byteOrder  = BLOB_RESTART_BYTE_ORDER;
+   header.model      = BLOB_RESTART_MODEL;
+   header.nLanduse   = N_LANDUSE_TYPES;
+   header.patchSize  = sizeof(PatchRestart);
+   header.cohortSize = sizeof(CohortRestart);
+   header.year       = year;
+   header.startTime  = 0;
+   header.nSites     = nSites;
+
+   vector<BlobRestartIndex> index(nSites);
+   uint64_t offset = sizeof(BlobRestartHeader);
+   for (size_t i=0; i<nSites; i++) {
+      index[i].y_     = sites[i]->sdata->y_ + data->start_lat;
+      index[i].x_     = sites[i]->sdata->x_ + data->start_lon;
+      index[i].offset = offset;
+      index[i].length = blobs[i].size();
+      offset += blobs[i].size();
+      // as read_patch_distribution, landuse restarts continue from the year
+      if (hasLanduse[i]) header.startTime = year * N_CLIMATE + 1;
+   }
+   header.indexOffset = offset;
+
+   char filename[STR_LEN], tmpname[STR_LEN];
+   sprintf(filename, "%s/RESTART/restart.bin", data->outdir);
+   sprintf(tmpname, "%s.tmp", filename);
+   int fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if (fd < 0) {
+      fprintf(stderr, "write_blob_restart: cannot create %s\n", tmpname);
+      exit(1);
+   }
+
+#if TBB
+   tbb::parallel_for(tbb::blocked_range<size_t>(0, nSites, 16),
+                     [&] (const tbb::blocked_range<size_t>& r) {
+      for (size_t i=r.begin(); i!=r.end(); i++) {
+         if (blobs[i].size() > 0)
+            writeAll(fd, &blobs[i][0], blobs[i].size(), index[i].offset, tmpname);
+      }
+   });
+#else
+   for (size_t i=0; i<nSites; i++) {
+      if (blobs[i].size() > 0)
+         writeAll(fd, &blobs[i][0], blobs[i].size(), index[i].offset, tmpname);
+   }
+#endif
+   if (nSites > 0) {
+      writeAll(fd, (const char*)&index[0], nSites * sizeof(BlobRestartIndex),
+               header.indexOffset, tmpname);
+   }
+   writeAll(fd, (const char*)&header, sizeof(header), 0, tmpname);
+
+   if ((fsync(fd) != 0) || (close(fd) != 0) || (rename(tmpname, filename) != 0)) {
+      fprintf(stderr, "write_blob_restart: cannot complete %s\n", filename);
+      exit(1);
+   }
+
+   printf("Binary restart %s: year %d, %lu sites, %.1f MB, %.2f s\n", filename, year,
+          (unsigned long)nSites, (header.indexOffset + nSites * sizeof(BlobRestartIndex)) / 1.0e6,
+          chrono::duration<double>(chrono::steady_clock::now() - t0).count());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! readAll
+//! pread all of a buffer, safe to call from several threads on one file
+//!
+//! @param  br     open restart
+//! @param  buf    receives the data
+//! @param  len    bytes
+//! @param  offset position in the file
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+static void readAll (BlobRestart* br, char* buf, size_t len, off_t offset) {
+   while (len > 0) {
+      ssize_t n = pread(br->fd, buf, len, offset);
+      if (n <= 0) {
+         fprintf(stderr, "read_blob_site: %s is truncated\n", br->filename);
+         exit(1);
+      }
+      buf += n;
+      len -= n;
+      offset += n;
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! open_blob_restart
+//! Open <dir>/restart.bin, check it was written by this model on a machine
+//! of the same byte order, and read its index. Sets data->start_time.
+//!
+//! @param  dir  restart directory
+//! @param  data UserData structure
+//! @return open restart
+////////////////////////////////////////////////////////////////////////////////
+BlobRestart* open_blob_restart (const char* dir, UserData* data) {
+   BlobRestart* br = new BlobRestart;
+   sprintf(br->filename, "%s/restart.bin", dir);
+   if ((br->fd = open(br->filename, O_RDONLY)) < 0) {
+      fprintf(stderr, "open_blob_restart: cannot open %s\n", br->filename);
+      exit(1);
+   }
+
+   BlobRestartHeader& h = br->header;
+   readAll(br, (char*)&h, sizeof(h), 0);
+   if (memcmp(h.magic, BLOB_RESTART_MAGIC, sizeof(h.magic)) != 0) {
+      fprintf(stderr, "open_blob_restart: %s is not a binary restart\n", br->filename);
+      exit(1);
+   }
+   if (h.byteOrder != BLOB_RESTART_BYTE_ORDER) {
+      fprintf(stderr, "open_blob_restart: %s was written with the other byte order\n", 
+              br->filename);
+      exit(1);
+   }
+   if (h.version != BLOB_RESTART_VERSION) {
+      fprintf(stderr, "open_blob_restart: %s is version %u, expected %u\n", 
+              br->filename, h.version, BLOB_RESTART_VERSION);
+      exit(1);
+   }
+   if ((h.model != BLOB_RESTART_MODEL) || (h.nLanduse != N_LANDUSE_TYPES) 
+       || (h.patchSize != sizeof(PatchRestart)) || (h.cohortSize != sizeof(CohortRestart))) {
+      fprintf(stderr, "open_blob_restart: %s was written by a different model build\n", 
+              br->filename);
+      exit(1);
+   }
+
+   br->index.resize(h.nSites);
+   if (h.nSites > 0) {
+      readAll(br, (char*)&br->index[0], h.nSites * sizeof(BlobRestartIndex), h.indexOffset);
+   }
+   sort(br->index.begin(), br->index.end(), indexLess);
+
+   data->start_time = h.startTime;
+   printf("Binary restart %s: year %d, %lu sites\n", br->filename, h.year, 
+          (unsigned long)h.nSites);
+   return br;
+}
+
+template <class T> static void blobGet (BlobRestart* br, const char*& p, const char* end, T& v) {
+   if (p + sizeof(T) > end) {
+      fprintf(stderr, "read_blob_site: corrupt site record in %s\n", br->filename);
+      exit(1);
+   }
+   memcpy(&v, p, sizeof(T));
+   p += sizeof(T);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! read_blob_site
+//! Restore the patches and cohorts of a site from its binary restart
+//! record. Touches nothing outside the site, so sites can be restored in
+//! parallel. A site missing from the restart starts from init_patches.
+//!
+//! @param  br   open restart
+//! @param  s    site
+//! @param  data UserData structure
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void read_blob_site (BlobRestart* br, site* s, UserData* data) {
+   BlobRestartIndex key;
+   key.y_ = s->sdata->y_ + data->start_lat;
+   key.x_ = s->sdata->x_ + data->start_lon;
+   vector<BlobRestartIndex>::const_iterator it = 
+      lower_bound(br->index.begin(), br->index.end(), key, indexLess);
+   if ((it == br->index.end()) || (it->y_ != key.y_) || (it->x_ != key.x_)) {
+      fprintf(stderr, "read_blob_site: no record for %s, starting from init_patches\n", 
+              s->sdata->name_);
+      init_patches(&s, data);
+      return;
+   }
+
+   vector<char> buf(it->length);
+   if (it->length > 0) {
+      readAll(br, &buf[0], it->length, it->offset);
+   }
+   const char* p = buf.empty() ? NULL : &buf[0];
+   const char* end = p + buf.size();
+
+   uint32_t nextPatchId, nextCohortId, nPatches;
+   blobGet(br, p, end, nextPatchId);
+   blobGet(br, p, end, nextCohortId);
+   blobGet(br, p, end, nPatches);
+   for (uint32_t k=0; k<nPatches; k++) {
+      PatchRestart pr;
+      uint32_t nCohorts, nHistory;
+      blobGet(br, p, end, pr);
+      blobGet(br, p, end, nCohorts);
+      blobGet(br, p, end, nHistory);
+
+      // create_patch and create_cohort take their id from the site counters
+      s->next_patch_id = (unsigned int) pr.id_;
+      patch* newp = NULL;
+#ifdef ED
+      create_patch(&s, &newp, pr.landUse_, pr.disturbanceTrack_, 
+                   pr.age_, pr.area_, pr.water_, 
+                   pr.fastSoilCarbon_, pr.structuralSoilCarbon_, 
+                   pr.structuralSoilLignin_, pr.slowSoilCarbon_, 
+                   pr.passiveSoilCarbon_, pr.mineralizedSoilNitrogen_, 
+                   pr.fastSoilNitrogen_, data);
+#elif defined MIAMI_LU
+      create_patch(&s, &newp, pr.landUse_, pr.disturbanceTrack_, 
+                   pr.age_, pr.area_,                       
+                   pr.fastSoilCarbon_, pr.structuralSoilCarbon_, 
+                   pr.totalBiomass_, data);
+#endif
+      for (uint32_t h=0; h<nHistory; h++) {
+         double value;
+         blobGet(br, p, end, value);
+         if ((pr.landUse_ == LU_SCND) && (h <= data->n_years_to_simulate)) 
+            newp->phistory[h] = value;
+      }
+
+#ifdef ED
+      newp->tallest  = NULL;
+      newp->shortest = NULL;
+      for (uint32_t c=0; c<nCohorts; c++) {
+         uint32_t id;
+         CohortRestart cr;
+         blobGet(br, p, end, id);
+         blobGet(br, p, end, cr);
+         s->next_cohort_id = id;
+         create_cohort(cr.pft_, cr.nIndivs_ * newp->area, cr.height_, 
+                       cr.dbh_, cr.bAlive_, cr.bDead_, &newp, data);
+      }
+#endif
+
+      // records are youngest first within each land use
+      int lu = pr.landUse_;
+      newp->older = NULL;
+      if (s->youngest_patch[lu] == NULL) {
+         newp->younger = NULL;
+         s->youngest_patch[lu] = newp;
+      } else {
+         newp->younger = s->oldest_patch[lu];
+         s->oldest_patch[lu]->older = newp;
+      }
+      s->oldest_patch[lu] = newp;
+   }
+   s->next_patch_id = nextPatchId;
+   s->next_cohort_id = nextCohortId;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! close_blob_restart
+//! 
+//!
+//! @param  pbr open restart, set to NULL
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void close_blob_restart (BlobRestart** pbr) {
+   BlobRestart* br = *pbr;
+   if (br == NULL) return;
+   close(br->fd);
+   delete br;
+   *pbr = NULL;
+}
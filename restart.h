@@ -1,6 +1,7 @@
 #ifndef EDM_RESTART_H_
 #define EDM_RESTART_H_
 
+#include <stdint.h>
 #include <string>
 #include "db_cxx.h"
 
@@ -86,4 +87,51 @@ void read_cohort_distribution(char* filename, site** siteptr, patch** patchptr,
                               char* paddress1, UserData* data);
 
 
+// binary restarts: <dir>/restart.bin holds a header, one self-contained
+// record per site and an index of the records. Sites are packed and
+// written in parallel, and restored in parallel in init_sites.
+//
+// site record:  uint32 next patch id, uint32 next cohort id,
+//               uint32 patches, then per patch
+//               PatchRestart (id_ is the patch id), uint32 cohorts,
+//               uint32 history years, history (double),
+//               cohorts (uint32 cohort id, CohortRestart)
+//
+// Patch and cohort ids, and the site's id counters, are kept so that a
+// run restarted from a binary restart continues the ids of the state
+// dumps, see state_dump.cc. The db and text restarts make new ids.
+
+#define BLOB_RESTART_MAGIC      "EDRSTBIN"
+#define BLOB_RESTART_VERSION    2
+#define BLOB_RESTART_BYTE_ORDER 0x01020304u
+
+struct BlobRestartHeader {
+   char magic[8];
+   uint32_t version;
+   uint32_t byteOrder;    ///< BLOB_RESTART_BYTE_ORDER as stored by the writer
+   uint32_t model;        ///< 1 ED, 2 MIAMI_LU
+   uint32_t nLanduse;     ///< N_LANDUSE_TYPES
+   uint32_t patchSize;    ///< sizeof(PatchRestart)
+   uint32_t cohortSize;   ///< sizeof(CohortRestart)
+   int32_t year;
+   int32_t startTime;     ///< start_time of a run restarting from the file
+   uint64_t nSites;
+   uint64_t indexOffset;  ///< nSites BlobRestartIndex from here
+};
+
+struct BlobRestartIndex {
+   uint32_t y_;           ///< global row of the site
+   uint32_t x_;           ///< global column of the site
+   uint64_t offset;
+   uint64_t length;
+};
+
+struct BlobRestart;
+
+void write_blob_restart (site* first_site, int year, UserData* data);
+BlobRestart* open_blob_restart (const char* dir, UserData* data);
+void read_blob_site (BlobRestart* br, site* s, UserData* data);
+void close_blob_restart (BlobRestart** pbr);
+
+
 #endif // EDM_RESTART_H_ 
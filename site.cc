@@ -1,11 +1,18 @@
  #include <cmath>
 #include <cstring>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
 
 #include "edmodels.h"
 #include "site.h"
+#include "ed_log.h"
+#include "site_sched.h"
 #include "patch.h"
 #ifdef ED
 #include "cohort.h"
+#include "cohort_soa.h"
+#include "mech_store.h"
 #endif
 #include "disturbance.h"
 #include "restart.h"
@@ -16,9 +23,12 @@
 #ifdef COUPLED // TODO: this makes things messy
 #include "../iGLM/glm_coupler.h"
 #endif
+#if TBB
+#include "tbb/parallel_for.h"
+#include "tbb/blocked_range.h"
+#endif
 
 
-int model_site(size_t lat, size_t lon, size_t counter, UserData* data);
 void update_site_landuse(site** siteptr, size_t lu, UserData* data);
 #ifdef ED
 void species_site_size_profile(site** pcurrents, unsigned int nbins, UserData* data);
@@ -130,160 +140,488 @@ double compute_dyl_factor (double lat, double day) {
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-//! init_sites
-//! 
+//! init_site_pools
+//! Set up the allocators for the patches and cohorts owned by a site
 //!
-//! @param  
+//! @param  siteptr site
+//! @param  data    UserData structure
 //! @return 
 ////////////////////////////////////////////////////////////////////////////////
-void init_sites (site** firsts, UserData* data) {
-   FILE *outfile;
+void init_site_pools (site* siteptr, UserData* data) {
+   init_pool(&siteptr->patch_pool, sizeof(patch), 16);
+   init_pool(&siteptr->phistory_pool, (data->n_years_to_simulate + 1) * sizeof(double), 8);
+#ifdef ED
+   init_pool(&siteptr->cohort_pool, sizeof(cohort), 64);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! free_site_pools
+//! Release all patch and cohort memory of a site at once
+//!
+//! @param  siteptr site
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void free_site_pools (site* siteptr) {
+   free_pool(&siteptr->patch_pool);
+   free_pool(&siteptr->phistory_pool);
+#ifdef ED
+   free_pool(&siteptr->cohort_pool);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! print_site_pool_counts
+//! Print allocation counters of the site pools summed over all sites
+//!
+//! @param  first_site first site in list
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void print_site_pool_counts (site* first_site) {
+   mem_pool patches, phistory;
+   init_pool(&patches, sizeof(patch), 0);
+   init_pool(&phistory, sizeof(double), 0);
+#ifdef ED
+   mem_pool cohorts;
+   init_pool(&cohorts, sizeof(cohort), 0);
+#endif
+
+   site* cs = first_site;
+   while (cs != NULL) {
+      add_pool_counts(&patches, &cs->patch_pool);
+      add_pool_counts(&phistory, &cs->phistory_pool);
+#ifdef ED
+      add_pool_counts(&cohorts, &cs->cohort_pool);
+#endif
+      cs = cs->next_site;
+   }
+
+   printf("Memory pools (all sites):\n");
+   print_pool_counts(stdout, "patches", &patches);
+   print_pool_counts(stdout, "phistory", &phistory);
+#ifdef ED
+   print_pool_counts(stdout, "cohorts", &cohorts);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! close_soi_files
+//! Flush and close the output files of all sites of interest
+//!
+//! @param  first_site first site in list
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void close_soi_files (site* first_site) {
+   soi_writer total;
+   total.n_streams = 0;
+   total.n_opens   = 0;
+   total.n_reuses  = 0;
+   total.n_unkept  = 0;
 
-   int first_site_flag = 1; /* flag for first site */
-   int model_site_flag = 0; /* flag to model site  */
-   site *new_site, *last_site;
+   site* cs = first_site;
+   while (cs != NULL) {
+      add_soi_counts(&total, cs->soi_out);
+      free_soi_writer(&cs->soi_out);
+      cs = cs->next_site;
+   }
+
+   if (total.n_opens + total.n_unkept > 0) {
+      printf("Site of interest files: %lu kept open, %lu reuses, %lu opened per call\n",
+             (unsigned long)total.n_streams, total.n_reuses, total.n_unkept);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! open_site
+//! First, serial, part of site initialization: set up the site in its slot
+//! of the site block, before its inputs are read.
+//!
+//! @param  y        row in region
+//! @param  x        column in region
+//! @param  new_site slot in the site block to fill
+//! @param  data     Userdata structure
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+static void open_site (size_t y, size_t x, site* new_site, UserData* data) {
+   new_site->next_site = NULL;
+#ifdef ED
+   new_site->cohort_arrays = NULL;
+#endif
+      
+   // assign site attributes 
+   new_site->data = data;
 
+   // allocate memory for site data 
+   new_site->sdata = new SiteData(y, x, *data);
+   if(data->do_downreg) {
+      for(size_t z=0;z<N_CLIMATE;z++) {
+         new_site->dyl_factor[z] = compute_dyl_factor(new_site->sdata->lat_, z);
+      }
+   }
    if(data->cd_file) {
-      char filename[STR_LEN];
+      log_printf(data->cd_log, new_site->sdata->name_, "new site name: %s\n", new_site->sdata->name_);
+   }
+
+   // check to see if site of interest
+   new_site->finished = 0;
+   new_site->skip_site = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! drop_site
+//! Free the site data of a site whose inputs are missing, leaving its slot
+//! free. Serial, since it returns mechanism tables to the shared store.
+//!
+//! @param  new_site site from open_site
+//! @param  data     Userdata structure
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+static void drop_site (site* new_site, UserData* data) {
+#ifdef ED
+   new_site->sdata->releaseMechanismLUT(*data);
+#endif
+   delete new_site->sdata;
+   new_site->sdata = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! parallel_site_inputs
+//! Whether readSiteData only picks values out of memory, so sites can read
+//! their inputs in parallel: soil and climate come from the region layers
+//! and mechanism tables from the mapped cache or the forcing reader. Any
+//! site missing from the cache falls back to netcdf under netcdf_mutex.
+//!
+//! @param  data Userdata structure
+//! @return true if inputs can be read in parallel
+////////////////////////////////////////////////////////////////////////////////
+static bool parallel_site_inputs (UserData* data) {
+#if defined ED && !FTS
+   return data->do_yearly_mech || (data->mech_tables->cache_map != NULL);
+#else
+   return false;
+#endif
+}
 
-      strcpy(filename, data->base_filename);
-      strcat(filename, ".cd");
-      if ( !(outfile = fopen(filename, "a")) ) {
-         fprintf(stderr, "init_sites: Can't open cd file: %s \n", filename);
+#ifdef ED
+////////////////////////////////////////////////////////////////////////////////
+//! free_cohort_arrays
+//! Release the integrator's cohort arrays of all sites
+//!
+//! @param  first_site first site in list
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void free_cohort_arrays (site* first_site) {
+   site* cs = first_site;
+   while (cs != NULL) {
+      free_cohort_soa(&cs->cohort_arrays);
+      cs = cs->next_site;
+   }
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//! read_site
+//! Serial part of site initialization once the inputs are read: pools,
+//! output and anything read from restarts (restart readers are not thread
+//! safe).
+//!
+//! @param  new_site site from open_site, with its inputs read
+//! @param  data     Userdata structure
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+static void read_site (site* new_site, UserData* data) {
+   init_site_pools(new_site, data);
+   new_site->next_patch_id = 0;
+   new_site->next_cohort_id = 0;
+   new_site->soi_out = new_site->sdata->soi ? create_soi_writer() : NULL;
+
+   new_site->area_burned                   = 0.0;
+   new_site->last_site_total_c             = 0.0;
+
+   for (size_t lu=0; lu<N_LANDUSE_TYPES; lu++) {
+      new_site->youngest_patch[lu]         = NULL;
+      new_site->oldest_patch[lu]           = NULL;
+      new_site->new_patch[lu]              = NULL;
+
+      new_site->months_below_rain_crit[lu] = 0.0;
+      new_site->fire_flag[lu]              = 0;    /* initialize site fire flag  */
+      new_site->fuel[lu]                   = 0.0;  /* initialize site fuel level */
+      new_site->last_total_c[lu]           = 0.0;
+   }
+
+   new_site->area_fraction[LU_NTRL]              = 1.0;
+
+   if (data->restart) {
+      if (data->old_restart_read) {
+         // read in inital patch distribution for the site 
+         read_patch_distribution(&new_site,data);
+      } else if (data->blobReader != NULL) {
+         // restored in parallel by build_site
+      } else if (data->new_restart_read) {
+         data->restartReader->readPatchDistribution(new_site, *data);
+      } else {
+         fprintf (stderr, "No restart read-type specified\n");
          exit(1);
       }
    }
 
+#if LANDUSE
+   for (size_t i=0; i<2; i++) {
+      for (size_t j=0; j<N_SBH_TYPES; j++) {
+         new_site->area_harvested[i][j]          = 0.0;
+         new_site->biomass_harvested[i][j]       = 0.0;
+         new_site->biomass_harvested_unmet[i][j] = 0.0;
+      }
+   }
+#endif
+   new_site->function_calls = 0;
+   new_site->step_cost = 0.0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! build_site
+//! Second part of site initialization: initial vegetation and site totals.
+//! Touches nothing outside the site, so sites can be built in parallel.
+//!
+//! @param  new_site site from read_site
+//! @param  data     Userdata structure
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+static void build_site (site* new_site, UserData* data) {
+   if (! data->restart) {
+      // create inital patches for the site 
+      init_patches(&new_site,data);
+   } else if (data->blobReader != NULL) {
+      read_blob_site(data->blobReader, new_site, data);
+   }
+
+#if LANDUSE
+   /* if data->start_year is > 0, then we are restarting from *
+    * previous landuse... no need to init_landuse_patches     */
+   if (data->start_time == 0) {
+      init_landuse_patches(&new_site, data);
+   }
+   update_landuse(new_site, *data);
+#endif
+             
+   /* calculate disturbance rates */
+   //ml-modified
+   //calculate_disturbance_rates(0, &(new_site->oldest_patch[LU_NTRL]), data);
+             
+   update_site(&new_site, data);
+}
+
+#if TBB
+class ReadSiteInputs {
+   site** const my_sites;
+   char* const have_inputs;
+   UserData *data;
+ public:
+   void operator() ( const tbb::blocked_range<size_t>& r ) const {
+      for (size_t i=r.begin(); i!=r.end(); ++i) {
+         have_inputs[i] = my_sites[i]->sdata->readSiteData(*data);
+      }
+   }
+   ReadSiteInputs (site* sites[], char have_inputs[], UserData *data) 
+      : my_sites(sites), have_inputs(have_inputs), data(data)
+   {}
+};
+
+class BuildSites {
+   site** const my_sites;
+   UserData *data;
+ public:
+   void operator() ( const tbb::blocked_range<size_t>& r ) const {
+      for (size_t i=r.begin(); i!=r.end(); ++i) {
+         build_site(my_sites[i], data);
+      }
+   }
+   BuildSites (site* sites[], UserData *data) 
+      : my_sites(sites), data(data)
+   {}
+};
+#endif
+
+// side of the square grid covered by the site ordering curve, must exceed
+// the global number of rows and columns
+#define HILBERT_SIDE 65536
+
+////////////////////////////////////////////////////////////////////////////////
+//! hilbert_index
+//! Distance of a cell along a Hilbert curve over the global grid. Cells
+//! close on the curve are close on the map.
+//!
+//! @param  y global row
+//! @param  x global column
+//! @return position on the curve
+////////////////////////////////////////////////////////////////////////////////
+static unsigned long long hilbert_index (size_t y, size_t x) {
+   unsigned long long d = 0;
+   for (size_t s=HILBERT_SIDE/2; s>0; s/=2) {
+      size_t rx = (x & s) > 0;
+      size_t ry = (y & s) > 0;
+      d += (unsigned long long)s * s * ((3 * rx) ^ ry);
+      /* rotate the quadrant */
+      if (ry == 0) {
+         if (rx == 1) {
+            x = HILBERT_SIDE - 1 - x;
+            y = HILBERT_SIDE - 1 - y;
+         }
+         size_t tmp = x;
+         x = y;
+         y = tmp;
+      }
+   }
+   return d;
+}
+
+struct site_cell {
+   unsigned long long key;
+   size_t y, x;
+   bool operator< (const site_cell& rhs) const { return key < rhs.key; }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//! init_sites
+//! Sites are stored in one block, ordered along a Hilbert curve over their
+//! global (y, x), so that neighbouring cells are close in memory and a
+//! contiguous range of sites (a thread or arena's part) is a compact area.
+//! Inputs are read in parallel when they are already in memory (see
+//! parallel_site_inputs), otherwise serially. Restarts are read serially,
+//! sites are built in parallel, then linked serially in block order, so
+//! the site list is the same as a serial run.
+//! data->map[y][x] points into the block. *firsts is the start of the
+//! block, which is freed as a whole.
+//! Each site is built in the arena that will later step it, so that with
+//! numa_arenas its patches and cohorts are first touched on that node.
+//!
+//! @param  
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void init_sites (site** firsts, UserData* data) {
    printf("intializing sites \n");
 
-   /* loop over region */
+   if (! data->restart) {
+      data->start_time = 0;
+   }
+
+   /* cells to model, loop over region */
+   std::vector<site_cell> cells;
    size_t counter = 0;
    for (size_t y=0; y<data->n_lat; y++) {
       for (size_t x=0; x<data->n_lon; x++) {
          data->map[y][x] = NULL;
          counter ++;
-         model_site_flag = model_site(y, x, counter, data);
-         if (model_site_flag == 1) {
-            /* allocate memory for new site */
-            new_site = (site *) malloc (sizeof(site));
-            if (new_site == NULL) {
-               fprintf(stderr,"init_sites: malloc site: out of memory\n");
-               exit(1);
-            }
-            new_site->next_site = NULL;
-      
-            // assign site attributes 
-            new_site->data = data;
-
-            // allocate memory for site data 
-            new_site->sdata = new SiteData(y, x, *data);
-            if(data->do_downreg) {
-               for(size_t z=0;z<N_CLIMATE;z++) {
-                  new_site->dyl_factor[z] = compute_dyl_factor(new_site->sdata->lat_, z);
-               }
-            }
-            if(data->cd_file) {
-               fprintf(outfile, "new site name: %s\n", new_site->sdata->name_);
-            }
-
-            // check to see if site of interest
-            new_site->finished = 0;
-            new_site->skip_site = 0;
-            
-            if ( ! new_site->sdata->readSiteData(*data) ) {
-               // missing inputs... free memory and move on 
-               delete new_site->sdata;
-               free(new_site);
-               continue;
-            }
-
-            new_site->area_burned                   = 0.0;
-            new_site->last_site_total_c             = 0.0;
-
-            for (size_t lu=0; lu<N_LANDUSE_TYPES; lu++) {
-               new_site->youngest_patch[lu]         = NULL;
-               new_site->oldest_patch[lu]           = NULL;
-               new_site->new_patch[lu]              = NULL;
-
-               new_site->months_below_rain_crit[lu] = 0.0;
-               new_site->fire_flag[lu]              = 0;    /* initialize site fire flag  */
-               new_site->fuel[lu]                   = 0.0;  /* initialize site fuel level */
-               new_site->last_total_c[lu]           = 0.0;
-            }
-
-            new_site->area_fraction[LU_NTRL]              = 1.0;
-
-            if (data->restart) {
-               if (data->old_restart_read) {
-                  // read in inital patch distribution for the site 
-                  read_patch_distribution(&new_site,data);
-               } else if (data->new_restart_read) {
-                  data->restartReader->readPatchDistribution(new_site, *data);
-               } else {
-                  fprintf (stderr, "No restart read-type specified\n");
-                  exit(1);
-               }
-            } else {
-               data->start_time = 0;
-               // create inital patches for the site 
-               init_patches(&new_site,data);
-            }
+         if (model_site(y, x, counter, data) == 1) {
+            site_cell cell;
+            cell.key = hilbert_index(y + data->start_lat, x + data->start_lon);
+            cell.y = y;
+            cell.x = x;
+            cells.push_back(cell);
+         }
+      } /* end loops over grid */
+   } /* end loops over grid */
+   std::sort(cells.begin(), cells.end());
 
-#if LANDUSE
-            for (size_t i=0; i<2; i++) {
-               for (size_t j=0; j<N_SBH_TYPES; j++) {
-                  new_site->area_harvested[i][j]          = 0.0;
-                  new_site->biomass_harvested[i][j]       = 0.0;
-                  new_site->biomass_harvested_unmet[i][j] = 0.0;
-               }
-            }
-            /* if data->start_year is > 0, then we are restarting from *
-             * previous landuse... no need to init_landuse_patches     */
-            if (data->start_time == 0) {
-               init_landuse_patches(&new_site, data);
-            }
-#ifndef COUPLED
-            read_transition_rates(&new_site, data);
-#endif
-            update_landuse(new_site, *data);
+   /* read inputs */
+   site* block = (site*) malloc ((cells.size() + 1) * sizeof(site));
+   if (block == NULL) {
+      fprintf(stderr,"init_sites: malloc sites: out of memory\n");
+      exit(1);
+   }
+   bool parallel_inputs = parallel_site_inputs(data);
+   std::vector<site*> sites;
+   for (size_t i=0; i<cells.size(); i++) {
+      site* new_site = &block[sites.size()];
+      open_site(cells[i].y, cells[i].x, new_site, data);
+      if (parallel_inputs || new_site->sdata->readSiteData(*data)) {
+         sites.push_back(new_site);
+      } else {
+         // missing inputs... free memory and move on 
+         drop_site(new_site, data);
+      }
+   }
+   if (parallel_inputs && ! sites.empty()) {
+      std::vector<char> have_inputs(sites.size());
+#if TBB
+      tbb::parallel_for(tbb::blocked_range<size_t>(0, sites.size(), 10), 
+                        ReadSiteInputs(&sites[0], &have_inputs[0], data));
+#else
+      for (size_t i=0; i<sites.size(); i++) {
+         have_inputs[i] = sites[i]->sdata->readSiteData(*data);
+      }
 #endif
-             
-            /* calculate disturbance rates */
-             //ml-modified
-            //calculate_disturbance_rates(0, &(new_site->oldest_patch[LU_NTRL]), data);
-             
-            update_site(&new_site, data);
-
-            /* link sites */
-            data->map[y][x] = new_site;
-            if (first_site_flag == 1) { /* if first site do this, otherwise link it */
-               *firsts = new_site;
-               new_site->next_site = NULL;
-               last_site = new_site;
-               first_site_flag = 0; /* reset flag */
-            } else {
-               new_site->next_site = NULL;
-               last_site->next_site = new_site;
-               last_site = new_site;
-            }
-
-            data->number_of_sites++; /* increment counter */
-            new_site->function_calls = 0;
-#ifndef USEMPI
-            if (data->number_of_sites % 50 == 0) {
-               printf("N sites = %d\n",data->number_of_sites);
-            }
+      // drop sites with missing inputs and close up the block
+      size_t n = 0;
+      for (size_t i=0; i<sites.size(); i++) {
+         if (! have_inputs[i]) {
+            drop_site(sites[i], data);
+            continue;
+         }
+         if (n != i) block[n] = block[i];
+         sites[n] = &block[n];
+         n++;
+      }
+      sites.resize(n);
+   }
+   for (size_t i=0; i<sites.size(); i++) {
+      read_site(sites[i], data);
+   }
+   if (sites.empty()) {
+      free(block);
+   }
+#if LANDUSE && !defined COUPLED
+   else {
+      // after the restart reads above, which set start_time
+      read_transition_rates(&sites[0], sites.size(), data);
+   }
 #endif
 
-         } /* end model_site_flag loop */
-      } /* end loops over grid */
-   } /* end loops over grid */
+   printf("Per site bytes: site %lu, SiteData %lu (first %lu used every step)",
+          (unsigned long)sizeof(site), (unsigned long)sizeof(SiteData), 
+          (unsigned long)offsetof(SiteData, x_));
+#if LANDUSE && !defined COUPLED
+   printf(", landuse rates %lu", (unsigned long)(data->lu_n_years * sizeof(landuse_rates)));
+#endif
+   printf("\n");
+
+   /* initial vegetation */
+   if (! sites.empty()) {
+#if TBB
+      run_site_parts(data->sched, sites.size(), [&] (size_t begin, size_t end) {
+         tbb::parallel_for(tbb::blocked_range<size_t>(begin, end, 10), 
+                           BuildSites(&sites[0], data));
+      });
+#else
+      for (size_t i=0; i<sites.size(); i++) {
+         build_site(sites[i], data);
+      }
+#endif
+   }
+
+   /* link sites */
+   site* last_site = NULL;
+   for (size_t i=0; i<sites.size(); i++) {
+      site* new_site = sites[i];
+      data->map[new_site->sdata->y_][new_site->sdata->x_] = new_site;
+      if (last_site == NULL) { /* if first site do this, otherwise link it */
+         *firsts = new_site;
+      } else {
+         last_site->next_site = new_site;
+      }
+      new_site->next_site = NULL;
+      last_site = new_site;
+
+      data->number_of_sites++; /* increment counter */
+#ifndef USEMPI
+      if (data->number_of_sites % 50 == 0) {
+         printf("N sites = %d\n",data->number_of_sites);
+      }
+#endif
+   }
 
    printf("Total N sites = %d\n",data->number_of_sites);
    fprintf(stdout,"Init sites complete\n");
-   if(data->cd_file) {
-      fclose(outfile);
-   }
 }
 
 
@@ -342,26 +680,6 @@ int model_site (size_t y, size_t x, size_t counter, UserData* data) {
 void community_dynamics (unsigned int t, double t1, double t2, 
                          site** siteptr, UserData* data) {
   
-   FILE* outfile = NULL;
-   if(data->cd_file) {
-      char filename[STR_LEN];
-   
-      strcpy(filename, data->base_filename);
-      strcat(filename, ".cd");
-      if(data->long_cd_file) {
-         if( !(outfile = fopen(filename, "a")) ) {
-            fprintf(stderr, "cd: Can't open file: %s \n", filename);
-            while(getchar() != '\n');
-         }
-      }
-      else {
-         if( !(outfile = fopen(filename, "w")) ) {
-            fprintf(stderr, "cd: Can't open file: %s \n", filename);
-            while(getchar() != '\n');
-         }
-      }
-   } /* if CD_FILE */
-
    site* currents = *siteptr;
    
 #if FTS
@@ -372,7 +690,8 @@ void community_dynamics (unsigned int t, double t1, double t2,
    /* assign current site to site strucutre in UserData structure data *
     * (address of site containing patch to be integrated)              */  
    if(data->cd_file) {
-      fprintf(outfile, "Community dynamics for %s %p t=%d t1=%f t2=%f \n",
+      log_printf(data->cd_log, currents->sdata->name_,
+                 "Community dynamics for %s %p t=%d t1=%f t2=%f \n",
               currents->sdata->name_, currents, t, t1, t2); 
    }
 
@@ -383,7 +702,7 @@ void community_dynamics (unsigned int t, double t1, double t2,
    for (size_t lu=0; lu<N_LANDUSE_TYPES; lu++) {
       patch* currentp = currents->youngest_patch[lu];
       if (currentp != NULL) 
-         cohort_dynamics(t, t1, t2, &currentp, outfile, data);
+         cohort_dynamics(t, t1, t2, &currentp, data);
       if (currents->skip_site)
          return;
    } 
@@ -404,7 +723,7 @@ void community_dynamics (unsigned int t, double t1, double t2,
 
        for (size_t lu=0; lu<N_LANDUSE_TYPES; lu++) {
           if ( (lu != LU_CROP) && (currents->youngest_patch[lu] != NULL) ) {
-             patch_dynamics(t, &(currents->youngest_patch[lu]), outfile, data);
+             patch_dynamics(t, &(currents->youngest_patch[lu]), data);
           }
        }
    } /*PATCH_DYNAMICS*/
@@ -417,9 +736,7 @@ void community_dynamics (unsigned int t, double t1, double t2,
 #endif
 
    if(data->cd_file) {
-      fprintf(outfile, "\n");
-      fprintf(outfile, "end of community dynamics\n");
-      fclose(outfile);
+      log_printf(data->cd_log, currents->sdata->name_, "end of community dynamics\n");
    }
 }
 
@@ -2,10 +2,13 @@
 #define EDM_SITE_H
 
 #include "edmodels.h"
+#include "mempool.h"
+#include "soi_writer.h"
 
 struct SiteData;
 struct patch;
 struct cohort;
+struct cohort_soa;
 
 ////////////////////////////////////////
 //    Typedef: site
@@ -164,9 +167,23 @@ struct site {
 #endif
 
    double time_finished;              ///< the year when the site finished being integrated
+#ifdef ED
+   cohort_soa* cohort_arrays;         ///< reusable contiguous cohort storage for the integrator
+#endif
+
+   // allocators for the patches and cohorts owned by this site
+   mem_pool patch_pool;
+   mem_pool phistory_pool;            ///< disturbance histories of secondary patches
+#ifdef ED
+   mem_pool cohort_pool;
+#endif
+   soi_writer* soi_out;               ///< open output files, sites of interest only
   
    double area_fraction[N_LANDUSE_TYPES]; ///< land area in each land use type
    int function_calls;
+   unsigned int next_patch_id;        ///< ids of the next patch and cohort made at the site
+   unsigned int next_cohort_id;
+   double step_cost;                  ///< wall time of the last community_dynamics step (s)
 
    void Update_FTS(unsigned int);
    double An[2][101];
@@ -186,6 +203,14 @@ struct site {
 void community_dynamics (unsigned int t, double t1, double t2, 
                         site** first_site, UserData* data);
 void init_sites (site** firsts, UserData* data);
+int model_site (size_t y, size_t x, size_t counter, UserData* data);
 void update_site (site** siteptr,  UserData* data);
+void init_site_pools (site* siteptr, UserData* data);
+void free_site_pools (site* siteptr);
+void print_site_pool_counts (site* first_site);
+void close_soi_files (site* first_site);
+#ifdef ED
+void free_cohort_arrays (site* first_site);
+#endif
 int cm_sodeint (patch** patchptr, int timestep, double x1, double x2, UserData* data);
 #endif // EDM_SITE_H_ 
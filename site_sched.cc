@@ -0,0 +1,205 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "edmodels.h"
+#include "site_sched.h"
+
+#if TBB
+#include <sched.h>
+#include "tbb/global_control.h"
+#include "tbb/task_arena.h"
+#include "tbb/task_group.h"
+#include "tbb/task_scheduler_observer.h"
+#include "tbb/info.h"
+
+////////////////////////////////////////
+//    Typedef: pin_observer
+//    Pins each thread that joins an arena
+//    to one cpu, by arena slot. The
+//    calling (master) thread gets its
+//    original mask back when it leaves.
+////////////////////////////////////////
+class pin_observer : public tbb::task_scheduler_observer {
+   std::vector<int> cpus;
+   cpu_set_t process_mask;
+ public:
+   pin_observer (tbb::task_arena& arena, const std::vector<int>& cpus, 
+                 const cpu_set_t& process_mask) 
+      : tbb::task_scheduler_observer(arena), cpus(cpus), process_mask(process_mask) {
+      observe(true);
+   }
+   void on_scheduler_entry (bool is_worker) override {
+      int slot = tbb::this_task_arena::current_thread_index();
+      if (slot < 0) return;
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(cpus[slot % cpus.size()], &set);
+      sched_setaffinity(0, sizeof(set), &set);
+   }
+   void on_scheduler_exit (bool is_worker) override {
+      if (! is_worker) sched_setaffinity(0, sizeof(process_mask), &process_mask);
+   }
+};
+#endif
+
+struct site_sched {
+#if TBB
+   tbb::global_control* limit;         ///< NULL when n_threads is 0 (use all)
+   std::vector<tbb::task_arena*> arenas;
+   std::vector<pin_observer*> pins;
+#endif
+   std::vector<size_t> weight_sum;     ///< running sum of arena concurrency, size n_parts+1
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//! create_site_sched
+//! Set up the site threads from n_threads, thread_pinning and numa_arenas.
+//! NUMA arenas need TBB built with hwloc support (tbbbind); without it TBB
+//! reports a single node and one arena is used. thread_pinning applies to
+//! the single arena only, NUMA arenas are already bound to their node.
+//!
+//! @param  data Userdata structure
+//! @return scheduler
+////////////////////////////////////////////////////////////////////////////////
+site_sched* create_site_sched (UserData* data) {
+   site_sched* sched = new site_sched;
+   sched->weight_sum.push_back(0);
+
+#if TBB
+   sched->limit = NULL;
+   if (data->n_threads > 0) {
+      sched->limit = new tbb::global_control(tbb::global_control::max_allowed_parallelism,
+                                             data->n_threads);
+   }
+
+   std::vector<tbb::numa_node_id> nodes = tbb::info::numa_nodes();
+   int n_nodes = nodes.size();
+   if (data->numa_arenas && n_nodes > 1) {
+      for (int k=0; k<n_nodes; k++) {
+         int conc = tbb::info::default_concurrency(nodes[k]);
+         if (data->n_threads > 0) {
+            // split the thread limit evenly over nodes
+            conc = data->n_threads / n_nodes + (k < data->n_threads % n_nodes ? 1 : 0);
+            if (conc < 1) conc = 1;
+         }
+         tbb::task_arena* arena = new tbb::task_arena(
+            tbb::task_arena::constraints().set_numa_id(nodes[k]).set_max_concurrency(conc));
+         arena->initialize();
+         sched->arenas.push_back(arena);
+         sched->weight_sum.push_back(sched->weight_sum.back() + arena->max_concurrency());
+      }
+      if (data->thread_pinning) {
+         printf("site_sched: thread_pinning ignored with numa_arenas, arenas are bound to nodes\n");
+      }
+   } else {
+      if (data->numa_arenas) {
+         printf("site_sched: one NUMA node visible to TBB, using a single arena\n");
+      }
+      tbb::task_arena* arena = new tbb::task_arena(
+         data->n_threads > 0 ? data->n_threads : tbb::task_arena::automatic);
+      arena->initialize();
+      sched->arenas.push_back(arena);
+      sched->weight_sum.push_back(arena->max_concurrency());
+
+      if (data->thread_pinning) {
+         cpu_set_t mask;
+         sched_getaffinity(0, sizeof(mask), &mask);
+         std::vector<int> cpus;
+         for (int c=0; c<CPU_SETSIZE; c++) {
+            if (CPU_ISSET(c, &mask)) cpus.push_back(c);
+         }
+         if (! cpus.empty()) {
+            sched->pins.push_back(new pin_observer(*arena, cpus, mask));
+         }
+      }
+   }
+
+   printf("site_sched: %lu arena(s), %lu threads\n", 
+          (unsigned long)sched->arenas.size(), (unsigned long)sched->weight_sum.back());
+#else
+   sched->weight_sum.push_back(1);
+#endif
+
+   return sched;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! free_site_sched
+//! 
+//!
+//! @param  psched scheduler to free, set to NULL
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void free_site_sched (site_sched** psched) {
+   site_sched* sched = *psched;
+   if (sched == NULL) return;
+
+#if TBB
+   for (size_t i=0; i<sched->pins.size(); i++) {
+      sched->pins[i]->observe(false);
+      delete sched->pins[i];
+   }
+   for (size_t k=0; k<sched->arenas.size(); k++) {
+      delete sched->arenas[k];
+   }
+   delete sched->limit;
+#endif
+   delete sched;
+   *psched = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! site_sched_n_parts
+//! 
+//!
+//! @param  sched scheduler
+//! @return number of parts the sites are split into
+////////////////////////////////////////////////////////////////////////////////
+size_t site_sched_n_parts (const site_sched* sched) {
+   return sched->weight_sum.size() - 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! run_site_parts
+//! Split sites 0..n-1 into one contiguous part per arena, sized by arena
+//! concurrency, and call body(begin, end) for each part inside its arena.
+//! The parts run concurrently; body normally does a parallel_for over its
+//! range. Returns when all parts are done. The split only depends on n, so
+//! the same site always lands in the same arena.
+//!
+//! @param  sched scheduler
+//! @param  n     number of sites
+//! @param  body  work for a range of sites
+//! @return 
+////////////////////////////////////////////////////////////////////////////////
+void run_site_parts (site_sched* sched, size_t n, 
+                     const std::function<void (size_t, size_t)>& body) {
+   size_t n_parts = site_sched_n_parts(sched);
+   size_t total = sched->weight_sum[n_parts];
+   std::vector<size_t> begin(n_parts + 1);
+   for (size_t k=0; k<=n_parts; k++) {
+      begin[k] = n * sched->weight_sum[k] / total;
+   }
+
+#if TBB
+   if (n_parts == 1) {
+      sched->arenas[0]->execute([&] { body(0, n); });
+      return;
+   }
+
+   tbb::task_group* groups = new tbb::task_group[n_parts];
+   for (size_t k=0; k<n_parts; k++) {
+      size_t b = begin[k], e = begin[k+1];
+      sched->arenas[k]->execute([&, k, b, e] { 
+         groups[k].run([&body, b, e] { body(b, e); }); 
+      });
+   }
+   for (size_t k=0; k<n_parts; k++) {
+      sched->arenas[k]->execute([&, k] { groups[k].wait(); });
+   }
+   delete [] groups;
+#else
+   body(0, n);
+#endif
+}
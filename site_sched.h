@@ -0,0 +1,34 @@
+#ifndef EDM_SITE_SCHED_H_
+#define EDM_SITE_SCHED_H_
+
+#include <cstddef>
+#include <functional>
+
+struct UserData;
+
+////////////////////////////////////////
+//    Typedef: site_sched
+//    Threads that run the site loops:
+//    the global thread limit and one TBB
+//    arena, or one arena per NUMA node
+//    when numa_arenas is on. Sites are
+//    split into contiguous parts, one per
+//    arena, and part k always runs in
+//    arena k so that a site's memory is
+//    touched first, and then used, by
+//    the threads of a single node.
+//    See site_sched.cc
+////////////////////////////////////////
+struct site_sched;
+
+
+////////////////////////////////////////
+//    Function Prototypes
+////////////////////////////////////////
+site_sched* create_site_sched (UserData* data);
+void free_site_sched (site_sched** psched);
+size_t site_sched_n_parts (const site_sched* sched);
+void run_site_parts (site_sched* sched, size_t n, 
+                     const std::function<void (size_t, size_t)>& body);
+
+#endif // EDM_SITE_SCHED_H_
@@ -0,0 +1,194 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "soi_writer.h"
+
+// descriptors left for netcdf, logs, restarts and unkept files
+#define SOI_RESERVED_FILES 128
+
+struct soi_stream {
+   char* name;
+   FILE* file;
+   char* buffer;
+};
+
+// files kept open by all writers, and how many may be
+static std::atomic<long> kept_files(0);
+static long max_kept_files = -1;
+
+////////////////////////////////////////////////////////////////////////////////
+//! create_soi_writer
+//! Writer with no open files. Called serially while sites are read.
+//!
+//! @return new writer
+////////////////////////////////////////////////////////////////////////////////
+soi_writer* create_soi_writer () {
+   if (max_kept_files < 0) {
+      struct rlimit rl;
+      if ((getrlimit(RLIMIT_NOFILE, &rl) == 0) && (rl.rlim_cur != RLIM_INFINITY)) {
+         max_kept_files = (long)rl.rlim_cur - SOI_RESERVED_FILES;
+         if (max_kept_files < 0) max_kept_files = 0;
+      } else {
+         max_kept_files = 1L << 20;
+      }
+   }
+
+   soi_writer* w = (soi_writer*) malloc(sizeof(soi_writer));
+   if (w == NULL) {
+      fprintf(stderr, "create_soi_writer: out of memory\n");
+      exit(1);
+   }
+   w->n_streams   = 0;
+   w->max_streams = 0;
+   w->streams     = NULL;
+   w->last        = 0;
+   w->n_opens     = 0;
+   w->n_reuses    = 0;
+   w->n_unkept    = 0;
+   return w;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! soi_open
+//! Stream for a site of interest file, used like fopen. The first call for
+//! a file opens it with mode, later calls return the open stream: with "a"
+//! it is left at the end, with "w" it is emptied first, so a file opened
+//! "w" every month still only holds the last month.
+//! Once the process runs low on descriptors files are opened and closed per
+//! call as before.
+//!
+//! @param  w        writer of the site, NULL to just fopen
+//! @param  filename file name
+//! @param  mode     "w" or "a"
+//! @return stream, to be given back with soi_close, NULL if it can't be opened
+////////////////////////////////////////////////////////////////////////////////
+FILE* soi_open (soi_writer* w, const char* filename, const char* mode) {
+   if (w == NULL) return fopen(filename, mode);
+
+   // print_* functions ask for their files in the same order every month,
+   // so the one after the last is almost always the one wanted
+   for (size_t k=1; k<=w->n_streams; k++) {
+      size_t i = (w->last + k) % w->n_streams;
+      soi_stream* s = &w->streams[i];
+      if (strcmp(s->name, filename) == 0) {
+         if (mode[0] == 'w') {
+            fflush(s->file);
+            if (ftruncate(fileno(s->file), 0) != 0) {
+               fprintf(stderr, "soi_open: cannot truncate %s\n", filename);
+            }
+            rewind(s->file);
+         }
+         w->last = i;
+         w->n_reuses++;
+         return s->file;
+      }
+   }
+
+   FILE* file = fopen(filename, mode);
+   if (file == NULL) return NULL;
+   if (kept_files.fetch_add(1) >= max_kept_files) {
+      kept_files--;
+      w->n_unkept++;
+      return file;
+   }
+
+   if (w->n_streams == w->max_streams) {
+      w->max_streams = (w->max_streams > 0) ? 2 * w->max_streams : 32;
+      w->streams = (soi_stream*) realloc(w->streams, w->max_streams * sizeof(soi_stream));
+      if (w->streams == NULL) {
+         fprintf(stderr, "soi_open: out of memory\n");
+         exit(1);
+      }
+   }
+   soi_stream* s = &w->streams[w->n_streams];
+   s->name   = strdup(filename);
+   s->file   = file;
+   s->buffer = (char*) malloc(SOI_BUFFER);
+   if ((s->name == NULL) || (s->buffer == NULL)) {
+      fprintf(stderr, "soi_open: out of memory\n");
+      exit(1);
+   }
+   setvbuf(file, s->buffer, _IOFBF, SOI_BUFFER);
+
+   w->last = w->n_streams;
+   w->n_streams++;
+   w->n_opens++;
+   return file;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! soi_close
+//! Give back a stream from soi_open. Files kept by the writer stay open,
+//! any other is closed.
+//!
+//! @param  w    writer the stream came from, may be NULL
+//! @param  file stream
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void soi_close (soi_writer* w, FILE* file) {
+   if (file == NULL) return;
+   if (w != NULL) {
+      if ((w->last < w->n_streams) && (w->streams[w->last].file == file)) return;
+      for (size_t i=0; i<w->n_streams; i++) {
+         if (w->streams[i].file == file) return;
+      }
+   }
+   fclose(file);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! soi_flush
+//! Write out the buffers of all files kept by a writer, so the files are
+//! complete up to the last output step while the run goes on
+//!
+//! @param  w writer, may be NULL
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void soi_flush (soi_writer* w) {
+   if (w == NULL) return;
+   for (size_t i=0; i<w->n_streams; i++) {
+      fflush(w->streams[i].file);
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! free_soi_writer
+//! Flush and close all files of a writer and free it
+//!
+//! @param  pw writer, set to NULL
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void free_soi_writer (soi_writer** pw) {
+   soi_writer* w = *pw;
+   if (w == NULL) return;
+
+   for (size_t i=0; i<w->n_streams; i++) {
+      fclose(w->streams[i].file);
+      free(w->streams[i].buffer);
+      free(w->streams[i].name);
+   }
+   kept_files -= (long)w->n_streams;
+   free(w->streams);
+   free(w);
+   *pw = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! add_soi_counts
+//! Accumulate the diagnostic counters of a writer, e.g. to sum over sites
+//!
+//! @param  total writer receiving the sums (only counters are used)
+//! @param  w     writer to add, may be NULL
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void add_soi_counts (soi_writer* total, const soi_writer* w) {
+   if (w == NULL) return;
+   total->n_streams += w->n_streams;
+   total->n_opens   += w->n_opens;
+   total->n_reuses  += w->n_reuses;
+   total->n_unkept  += w->n_unkept;
+}
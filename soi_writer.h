@@ -0,0 +1,45 @@
+#ifndef EDM_SOI_WRITER_H_
+#define EDM_SOI_WRITER_H_
+
+#include <cstddef>
+#include <cstdio>
+
+#define SOI_BUFFER 16384  ///< stdio buffer of each site of interest file (bytes)
+
+////////////////////////////////////////
+//    Typedef: soi_writer
+//    Text files of one site of interest.
+//    Each file is opened on first use and
+//    kept open, with a large buffer
+//    flushed after each output step, until
+//    the writer is freed, instead of being
+//    opened and closed by every print_*
+//    call. Only touched by the task that
+//    steps the site. See soi_writer.cc
+////////////////////////////////////////
+struct soi_stream;
+
+struct soi_writer {
+   size_t n_streams;
+   size_t max_streams;
+   soi_stream* streams;
+   size_t last;              ///< stream of the last soi_open, files are used in a fixed order
+
+   // diagnostics
+   unsigned long n_opens;    ///< files opened
+   unsigned long n_reuses;   ///< soi_open calls served by an open file
+   unsigned long n_unkept;   ///< files not kept open, descriptor budget exhausted
+};
+
+
+////////////////////////////////////////
+//    Function Prototypes
+////////////////////////////////////////
+soi_writer* create_soi_writer ();
+FILE* soi_open (soi_writer* w, const char* filename, const char* mode);
+void soi_close (soi_writer* w, FILE* file);
+void soi_flush (soi_writer* w);
+void free_soi_writer (soi_writer** pw);
+void add_soi_counts (soi_writer* total, const soi_writer* w);
+
+#endif // EDM_SOI_WRITER_H_
@@ -0,0 +1,398 @@
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "netcdf.h"
+
+#include "edmodels.h"
+#include "site.h"
+#include "patch.h"
+#ifdef ED
+#include "cohort.h"
+#endif
+#include "read_site_data.h"
+#include "state_dump.h"
+
+#if TBB
+#include "tbb/parallel_for.h"
+#include "tbb/blocked_range.h"
+#endif
+
+/* A state dump is one netcdf-4 file per dump time, <base>.state.<t>.nc,  *
+ * holding every patch and cohort of the region as a table: one row per  *
+ * site, patch and cohort along the site, patch and cohort dimensions,    *
+ * one typed, deflated column per quantity. Rows point at their parent    *
+ * by row number (patch_site, cohort_patch). site_cell, patch_id and      *
+ * cohort_id identify the same site, patch or cohort in every dump of a   *
+ * run, unlike the pointers printed in the text files. The ids carry on   *
+ * across a restart from a binary restart (blob_restart_read) only; the   *
+ * db and text restarts number patches and cohorts anew.                  */
+
+////////////////////////////////////////
+//    Typedef: dump_column
+//    Value column of a state dump, a
+//    double at offset in the patch or
+//    cohort, written as float
+////////////////////////////////////////
+struct dump_column {
+   const char* name;
+   const char* units;
+   size_t offset;
+   int per_area;           ///< divided by the patch area
+};
+
+static const dump_column patch_columns[] = {
+   { "age",                "years",     offsetof(patch, age),                0 },
+   { "area",               "m2",        offsetof(patch, area),               0 },
+   { "total_ag_biomass",   "kgC/m2",    offsetof(patch, total_ag_biomass),   0 },
+   { "total_biomass",      "kgC/m2",    offsetof(patch, total_biomass),      0 },
+   { "total_soil_c",       "kgC/m2",    offsetof(patch, total_soil_c),       0 },
+   { "npp",                "kgC/m2/yr", offsetof(patch, npp),                0 },
+   { "rh",                 "kgC/m2/yr", offsetof(patch, rh),                 0 },
+   { "nep",                "kgC/m2/yr", offsetof(patch, nep),                0 },
+   { "fast_soil_C",        "kgC/m2",    offsetof(patch, fast_soil_C),        0 },
+   { "structural_soil_C",  "kgC/m2",    offsetof(patch, structural_soil_C),  0 },
+#ifdef ED
+   { "slow_soil_C",        "kgC/m2",    offsetof(patch, slow_soil_C),        0 },
+   { "passive_soil_C",     "kgC/m2",    offsetof(patch, passive_soil_C),     0 },
+   { "structural_soil_L",  "kg/m2",     offsetof(patch, structural_soil_L),  0 },
+   { "mineralized_soil_N", "kgN/m2",    offsetof(patch, mineralized_soil_N), 0 },
+   { "fast_soil_N",        "kgN/m2",    offsetof(patch, fast_soil_N),        0 },
+   { "water",              "mm",        offsetof(patch, water),              0 },
+   { "lai",                "m2/m2",     offsetof(patch, lai),                0 },
+   { "basal_area",         "cm2/m2",    offsetof(patch, basal_area),         0 },
+#endif
+};
+
+#ifdef ED
+static const dump_column cohort_columns[] = {
+   { "nindivs",            "1/m2",         offsetof(cohort, nindivs), 1 },
+   { "dbh",                "cm",           offsetof(cohort, dbh),     0 },
+   { "hite",               "m",            offsetof(cohort, hite),    0 },
+   { "balive",             "kgC/indiv",    offsetof(cohort, balive),  0 },
+   { "bdead",              "kgC/indiv",    offsetof(cohort, bdead),   0 },
+   { "bl",                 "kgC/indiv",    offsetof(cohort, bl),      0 },
+   { "br",                 "kgC/indiv",    offsetof(cohort, br),      0 },
+   { "bsw",                "kgC/indiv",    offsetof(cohort, bsw),     0 },
+   { "lai",                "m2/m2",        offsetof(cohort, lai),     0 },
+   { "gpp",                "kgC/yr/indiv", offsetof(cohort, gpp),     0 },
+   { "npp",                "kgC/yr/indiv", offsetof(cohort, npp),     0 },
+   { "resp",               "kgC/yr/indiv", offsetof(cohort, resp),    0 },
+   { "md",                 "kgC/yr/indiv", offsetof(cohort, md),      0 },
+   { "fs_open",            "1",            offsetof(cohort, fs_open), 0 },
+   { "fsw",                "1",            offsetof(cohort, fsw),     0 },
+};
+#endif
+
+#define N_COLUMNS(c) (sizeof(c) / sizeof((c)[0]))
+
+////////////////////////////////////////////////////////////////////////////////
+//! column_value
+//!
+//!
+//! @param  obj  patch or cohort
+//! @param  col  column
+//! @param  area area of the patch
+//! @return value of the column
+////////////////////////////////////////////////////////////////////////////////
+static inline float column_value (const void* obj, const dump_column& col, double area) {
+   double v = *(const double*)((const char*)obj + col.offset);
+   return (float)(col.per_area ? v / area : v);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! def_column
+//! Define a one dimensional variable of a state dump
+//!
+//! @param  ncid     open file, in define mode
+//! @param  prefix   "site", "patch" or "cohort"
+//! @param  name     column name
+//! @param  type     netcdf type
+//! @param  dim      dimension
+//! @param  units    units attribute, NULL for none
+//! @param  deflate  deflate level, 0 for none
+//! @return variable id
+////////////////////////////////////////////////////////////////////////////////
+static int def_column (int ncid, const char* prefix, const char* name, nc_type type,
+                       int dim, const char* units, int deflate) {
+   char vname[NC_MAX_NAME+1];
+   int rv, varid;
+
+   snprintf(vname, sizeof(vname), "%s_%s", prefix, name);
+   if ((rv = nc_def_var(ncid, vname, type, 1, &dim, &varid))) NCERR(vname, rv);
+   if (deflate > 0) {
+      if ((rv = nc_def_var_deflate(ncid, varid, 1, 1, deflate))) NCERR(vname, rv);
+   }
+   if (units != NULL) {
+      if ((rv = nc_put_att_text(ncid, varid, "units", strlen(units), units))) NCERR(vname, rv);
+   }
+   return varid;
+}
+
+////////////////////////////////////////
+//    Typedef: dump_tables
+//    Columns of one state dump,
+//    gathered on the model thread and
+//    written by the dump writer
+////////////////////////////////////////
+struct dump_tables {
+   char filename[STR_LEN];
+   double time;
+   double area;
+   int deflate;
+   size_t n_sites, n_patches, n_cohorts;
+   std::vector<int> site_cell;
+   std::vector<float> site_lat, site_lon;
+   std::vector<int> patch_site, patch_landuse, patch_track;
+   std::vector<unsigned int> patch_id;
+   std::vector<float> pcols;
+#ifdef ED
+   std::vector<int> cohort_patch, cohort_pft;
+   std::vector<unsigned int> cohort_id;
+   std::vector<float> ccols;
+#endif
+   double gather_time;     ///< model thread time spent gathering (s)
+};
+
+// writes the last dump while the model goes on, see write_state_dump
+static std::thread dump_writer;
+
+////////////////////////////////////////////////////////////////////////////////
+//! write_dump_file
+//! Body of the dump writer: write one dump to its file and free it
+//!
+//! @param  d gathered dump
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+static void write_dump_file (dump_tables* d) {
+   auto t0 = std::chrono::steady_clock::now();
+   const size_t n_pcols = N_COLUMNS(patch_columns);
+#ifdef ED
+   const size_t n_ccols = N_COLUMNS(cohort_columns);
+#endif
+   const char* filename = d->filename;
+   int deflate = d->deflate;
+   {
+      std::lock_guard<std::mutex> lock(netcdf_mutex);
+      int rv, ncid;
+      if ((rv = nc_create(filename, NC_CLOBBER | NC_NETCDF4, &ncid))) NCERR(filename, rv);
+
+      // a zero length dimension would be unlimited, its variables are just left empty
+      int site_dim, patch_dim, cohort_dim;
+      if ((rv = nc_def_dim(ncid, "site", d->n_sites, &site_dim))) NCERR("site", rv);
+      if ((rv = nc_def_dim(ncid, "patch", d->n_patches, &patch_dim))) NCERR("patch", rv);
+      if ((rv = nc_def_dim(ncid, "cohort", d->n_cohorts, &cohort_dim))) NCERR("cohort", rv);
+
+      const char* layout = "patch_site and cohort_patch are row numbers of the parent; "
+                           "site_cell (lat_index*n_lon+lon_index), patch_id and cohort_id "
+                           "are the same in every dump of the run and of runs restarted "
+                           "from its binary restarts";
+      nc_put_att_double(ncid, NC_GLOBAL, "time", NC_DOUBLE, 1, &d->time);
+      nc_put_att_double(ncid, NC_GLOBAL, "site_area", NC_DOUBLE, 1, &d->area);
+      nc_put_att_text(ncid, NC_GLOBAL, "layout", strlen(layout), layout);
+
+      int v_site_cell = def_column(ncid, "site", "cell", NC_INT, site_dim, NULL, deflate);
+      int v_site_lat  = def_column(ncid, "site", "lat", NC_FLOAT, site_dim, "degrees_north", deflate);
+      int v_site_lon  = def_column(ncid, "site", "lon", NC_FLOAT, site_dim, "degrees_east", deflate);
+      int v_patch_site    = def_column(ncid, "patch", "site", NC_INT, patch_dim, NULL, deflate);
+      int v_patch_id      = def_column(ncid, "patch", "id", NC_UINT, patch_dim, NULL, deflate);
+      int v_patch_landuse = def_column(ncid, "patch", "landuse", NC_INT, patch_dim, NULL, deflate);
+      int v_patch_track   = def_column(ncid, "patch", "track", NC_INT, patch_dim, NULL, deflate);
+      std::vector<int> v_pcols(n_pcols);
+      for (size_t k=0; k<n_pcols; k++) {
+         v_pcols[k] = def_column(ncid, "patch", patch_columns[k].name, NC_FLOAT, patch_dim,
+                                 patch_columns[k].units, deflate);
+      }
+#ifdef ED
+      int v_cohort_patch = def_column(ncid, "cohort", "patch", NC_INT, cohort_dim, NULL, deflate);
+      int v_cohort_id    = def_column(ncid, "cohort", "id", NC_UINT, cohort_dim, NULL, deflate);
+      int v_cohort_pft   = def_column(ncid, "cohort", "pft", NC_INT, cohort_dim, NULL, deflate);
+      std::vector<int> v_ccols(n_ccols);
+      for (size_t k=0; k<n_ccols; k++) {
+         v_ccols[k] = def_column(ncid, "cohort", cohort_columns[k].name, NC_FLOAT, cohort_dim,
+                                 cohort_columns[k].units, deflate);
+      }
+#endif
+      if ((rv = nc_enddef(ncid))) NCERR(filename, rv);
+
+      if (d->n_sites > 0) {
+         if ((rv = nc_put_var_int(ncid, v_site_cell, &d->site_cell[0]))) NCERR("site_cell", rv);
+         if ((rv = nc_put_var_float(ncid, v_site_lat, &d->site_lat[0]))) NCERR("site_lat", rv);
+         if ((rv = nc_put_var_float(ncid, v_site_lon, &d->site_lon[0]))) NCERR("site_lon", rv);
+      }
+      if (d->n_patches > 0) {
+         if ((rv = nc_put_var_int(ncid, v_patch_site, &d->patch_site[0]))) NCERR("patch_site", rv);
+         if ((rv = nc_put_var_uint(ncid, v_patch_id, &d->patch_id[0]))) NCERR("patch_id", rv);
+         if ((rv = nc_put_var_int(ncid, v_patch_landuse, &d->patch_landuse[0]))) NCERR("patch_landuse", rv);
+         if ((rv = nc_put_var_int(ncid, v_patch_track, &d->patch_track[0]))) NCERR("patch_track", rv);
+         for (size_t k=0; k<n_pcols; k++) {
+            if ((rv = nc_put_var_float(ncid, v_pcols[k], &d->pcols[k * d->n_patches]))) {
+               NCERR(patch_columns[k].name, rv);
+            }
+         }
+      }
+#ifdef ED
+      if (d->n_cohorts > 0) {
+         if ((rv = nc_put_var_int(ncid, v_cohort_patch, &d->cohort_patch[0]))) NCERR("cohort_patch", rv);
+         if ((rv = nc_put_var_uint(ncid, v_cohort_id, &d->cohort_id[0]))) NCERR("cohort_id", rv);
+         if ((rv = nc_put_var_int(ncid, v_cohort_pft, &d->cohort_pft[0]))) NCERR("cohort_pft", rv);
+         for (size_t k=0; k<n_ccols; k++) {
+            if ((rv = nc_put_var_float(ncid, v_ccols[k], &d->ccols[k * d->n_cohorts]))) {
+               NCERR(cohort_columns[k].name, rv);
+            }
+         }
+      }
+#endif
+      if ((rv = nc_close(ncid))) NCERR(filename, rv);
+   }
+
+   printf("State dump %s: %lu sites, %lu patches, %lu cohorts, gather %.2f s, write %.2f s\n",
+          filename, (unsigned long)d->n_sites, (unsigned long)d->n_patches,
+          (unsigned long)d->n_cohorts, d->gather_time,
+          std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+   delete d;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! write_state_dump
+//! Write the patch and cohort state of all sites to <base>.state.<t>.nc.
+//! Sites are gathered into columns in parallel, each site fills the rows
+//! after those of the sites before it in the site list. The file is written
+//! by the dump writer thread while the model goes on; the model thread only
+//! waits here if the previous dump is still being written.
+//!
+//! @param  t          time step
+//! @param  first_site first site in list
+//! @param  data       UserData structure
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void write_state_dump (unsigned int t, site* first_site, UserData* data) {
+   auto t0 = std::chrono::steady_clock::now();
+
+   std::vector<site*> sites;
+   for (site* cs=first_site; cs!=NULL; cs=cs->next_site) {
+      sites.push_back(cs);
+   }
+   size_t n_sites = sites.size();
+
+   /* rows of each site */
+   std::vector<size_t> first_patch(n_sites + 1, 0);
+   std::vector<size_t> first_cohort(n_sites + 1, 0);
+   auto count_site = [&] (size_t i) {
+      size_t np = 0, nc = 0;
+      for (size_t lu=0; lu<N_LANDUSE_TYPES; lu++) {
+         for (patch* cp=sites[i]->youngest_patch[lu]; cp!=NULL; cp=cp->older) {
+            np++;
+#ifdef ED
+            for (cohort* cc=cp->tallest; cc!=NULL; cc=cc->shorter) nc++;
+#endif
+         }
+      }
+      first_patch[i+1]  = np;
+      first_cohort[i+1] = nc;
+   };
+#if TBB
+   tbb::parallel_for(tbb::blocked_range<size_t>(0, n_sites, 16),
+                     [&] (const tbb::blocked_range<size_t>& r) {
+      for (size_t i=r.begin(); i!=r.end(); i++) count_site(i);
+   });
+#else
+   for (size_t i=0; i<n_sites; i++) count_site(i);
+#endif
+   for (size_t i=0; i<n_sites; i++) {
+      first_patch[i+1]  += first_patch[i];
+      first_cohort[i+1] += first_cohort[i];
+   }
+   size_t n_patches = first_patch[n_sites];
+   size_t n_cohorts = first_cohort[n_sites];
+
+   /* columns */
+   dump_tables* d = new dump_tables;
+   sprintf(d->filename, "%s.state.%06u.nc", data->base_filename, t);
+   d->time      = t * TIMESTEP;
+   d->area      = data->area;
+   d->deflate   = data->state_dump_deflate;
+   d->n_sites   = n_sites;
+   d->n_patches = n_patches;
+   d->n_cohorts = n_cohorts;
+   const size_t n_pcols = N_COLUMNS(patch_columns);
+   d->site_cell.resize(n_sites);
+   d->site_lat.resize(n_sites);
+   d->site_lon.resize(n_sites);
+   d->patch_site.resize(n_patches);
+   d->patch_landuse.resize(n_patches);
+   d->patch_track.resize(n_patches);
+   d->patch_id.resize(n_patches);
+   d->pcols.resize(n_pcols * n_patches);
+#ifdef ED
+   const size_t n_ccols = N_COLUMNS(cohort_columns);
+   d->cohort_patch.resize(n_cohorts);
+   d->cohort_pft.resize(n_cohorts);
+   d->cohort_id.resize(n_cohorts);
+   d->ccols.resize(n_ccols * n_cohorts);
+#endif
+
+   auto fill_site = [&] (size_t i) {
+      site* cs = sites[i];
+      d->site_cell[i] = (int)(cs->sdata->y_ * data->n_lon + cs->sdata->x_);
+      d->site_lat[i]  = (float)cs->sdata->lat_;
+      d->site_lon[i]  = (float)cs->sdata->lon_;
+
+      size_t p = first_patch[i];
+#ifdef ED
+      size_t c = first_cohort[i];
+#endif
+      for (size_t lu=0; lu<N_LANDUSE_TYPES; lu++) {
+         for (patch* cp=cs->youngest_patch[lu]; cp!=NULL; cp=cp->older) {
+            d->patch_site[p]    = (int)i;
+            d->patch_id[p]      = cp->id;
+            d->patch_landuse[p] = (int)lu;
+            d->patch_track[p]   = (int)cp->track;
+            for (size_t k=0; k<n_pcols; k++) {
+               d->pcols[k * n_patches + p] = column_value(cp, patch_columns[k], cp->area);
+            }
+#ifdef ED
+            for (cohort* cc=cp->tallest; cc!=NULL; cc=cc->shorter) {
+               d->cohort_patch[c] = (int)p;
+               d->cohort_id[c]    = cc->id;
+               d->cohort_pft[c]   = cc->species;
+               for (size_t k=0; k<n_ccols; k++) {
+                  d->ccols[k * n_cohorts + c] = column_value(cc, cohort_columns[k], cp->area);
+               }
+               c++;
+            }
+#endif
+            p++;
+         }
+      }
+   };
+#if TBB
+   tbb::parallel_for(tbb::blocked_range<size_t>(0, n_sites, 16),
+                     [&] (const tbb::blocked_range<size_t>& r) {
+      for (size_t i=r.begin(); i!=r.end(); i++) fill_site(i);
+   });
+#else
+   for (size_t i=0; i<n_sites; i++) fill_site(i);
+#endif
+   d->gather_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+   finish_state_dump();
+   dump_writer = std::thread(write_dump_file, d);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! finish_state_dump
+//! Wait for the dump writer to finish the last dump
+//!
+//! @param  
+//! @return
+////////////////////////////////////////////////////////////////////////////////
+void finish_state_dump () {
+   if (dump_writer.joinable()) {
+      dump_writer.join();
+   }
+}
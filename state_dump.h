@@ -0,0 +1,14 @@
+#ifndef EDM_STATE_DUMP_H_
+#define EDM_STATE_DUMP_H_
+
+// Forward declarations
+struct UserData;
+struct site;
+
+////////////////////////////////////////
+//    Function Prototypes
+////////////////////////////////////////
+void write_state_dump (unsigned int t, site* first_site, UserData* data);
+void finish_state_dump ();
+
+#endif // EDM_STATE_DUMP_H_